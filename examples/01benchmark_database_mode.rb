@@ -0,0 +1,52 @@
+require "simple-proj"
+
+#########################################
+# Construction latency by database mode
+#########################################
+#
+# Each mode is measured in a forked process, so that the database of
+# the context is opened from scratch. Note that the OS page cache is
+# shared among the processes; drop it before each run to see cold reads
+# from the storage (e.g. echo 3 > /proc/sys/vm/drop_caches).
+
+PAIRS = [
+  ["EPSG:4326", "EPSG:3857"],
+  ["EPSG:4326", "EPSG:32654"],
+  ["EPSG:4326", "EPSG:6677"],
+  ["EPSG:4612", "EPSG:6668"],
+  ["EPSG:4267", "EPSG:4269"],
+  ["EPSG:4326", "EPSG:27700"],
+  ["EPSG:4258", "EPSG:25832"],
+  ["EPSG:4326", "EPSG:2154"],
+  ["EPSG:4326", "EPSG:3413"],
+  ["EPSG:4326", "EPSG:28355"],
+]
+
+def measure (mode)
+  reader, writer = IO.pipe
+  pid = fork do
+    reader.close
+    t0 = Time.now
+    PROJ.use_database(mode: mode)
+    setup = Time.now - t0
+    times = PAIRS.map { |src, dst|
+      t = Time.now
+      PROJ.new(src, dst)
+      Time.now - t
+    }
+    writer.write(Marshal.dump([setup, times]))
+    writer.close
+    exit!(0)
+  end
+  writer.close
+  result = Marshal.load(reader.read)
+  Process.wait(pid)
+  return result
+end
+
+printf("%-10s %10s %10s %10s %10s\n", "mode", "setup(ms)", "first(ms)", "mean(ms)", "max(ms)")
+[:file, :immutable, :memory].each do |mode|
+  setup, times = measure(mode)
+  printf("%-10s %10.2f %10.2f %10.2f %10.2f\n", mode,
+         setup*1000, times.first*1000, times.sum/times.size*1000, times.max*1000)
+end
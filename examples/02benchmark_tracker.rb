@@ -0,0 +1,78 @@
+require "simple-proj"
+
+#########################################
+# Tracker vs exact per-point transforms
+#########################################
+#
+# NTRACKS vehicles move at about 15 m/s with random heading changes and
+# report their positions every second. The points are transformed by
+# PROJ#forward one by one, and by PROJ::Tracker with several error bounds.
+# The maximum error is measured against the exact results.
+
+NTRACKS = 100
+NSTEPS  = 2000
+
+DST = ARGV[0] || "EPSG:32654"
+
+srand(1)
+
+ids  = []
+lons = []
+lats = []
+NTRACKS.times do |k|
+  lon = 139.0 + rand
+  lat = 35.0 + rand
+  heading = rand * 2 * Math::PI
+  NSTEPS.times do
+    heading += (rand - 0.5) * 0.2
+    lon += 15.0 * Math.sin(heading) / (111320.0 * Math.cos(lat * Math::PI / 180))
+    lat += 15.0 * Math.cos(heading) / 110540.0
+    ids << k; lons << lon; lats << lat
+  end
+end
+
+# interleave the tracks as a feed does
+order = (0...ids.size).sort_by { |i| [i % NSTEPS, i / NSTEPS] }
+ids  = order.map { |i| ids[i] }
+lons = order.map { |i| lons[i] }
+lats = order.map { |i| lats[i] }
+
+pj = PROJ.new(DST)     ### source CRS set to "+proj=latlong" implicitly
+n  = ids.size
+
+t0 = Time.now
+exact = Array.new(n) { |i| pj.forward(lons[i], lats[i]) }
+t_exact = Time.now - t0
+
+t0 = Time.now
+bx, by = pj.forward_batch(lons, lats)
+t_batch = Time.now - t0
+
+printf("%d points (%d tracks) into %s\n", n, NTRACKS, DST)
+printf("%-28s %10s %12s %10s\n", "", "time(s)", "max err(m)", "exact(%)")
+printf("%-28s %10.3f %12s %10s\n", "PROJ#forward", t_exact, "-", "100.0")
+printf("%-28s %10.3f %12s %10s\n", "PROJ#forward_batch", t_batch, "-", "100.0")
+
+[1, 2].each do |order|
+  [0.001, 0.01, 0.1].each do |max_error|
+    tracker = PROJ::Tracker.new(pj, max_error: max_error, order: order)
+    t0 = Time.now
+    approx = Array.new(n) { |i| tracker.transform(ids[i], lons[i], lats[i]) }
+    t = Time.now - t0
+    err = 0.0
+    n.times do |i|
+      d = Math.hypot(approx[i][0] - exact[i][0], approx[i][1] - exact[i][1])
+      err = d if d > err
+    end
+    stats = tracker.stats
+    printf("%-28s %10.3f %12.6f %10.1f\n",
+           "Tracker#transform o=#{order} e=#{max_error}", t, err,
+           100.0 * stats[:exact] / n)
+
+    tracker = PROJ::Tracker.new(pj, max_error: max_error, order: order)
+    t0 = Time.now
+    tracker.transform_batch(ids, lons, lats)
+    t = Time.now - t0
+    printf("%-28s %10.3f %12s %10s\n", "Tracker#transform_batch", t, "", "")
+  end
+end
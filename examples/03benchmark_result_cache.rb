@@ -0,0 +1,41 @@
+require "simple-proj"
+
+#########################################
+# Result cache for repeated coordinates
+#########################################
+#
+# NREADINGS readings from NSTATIONS fixed stations (the same coordinates
+# repeated over and over) are transformed with and without the result
+# cache, by PROJ#forward one by one and by PROJ#forward_batch.
+
+NSTATIONS = 1000
+NREADINGS = 500_000
+
+DST = ARGV[0] || "EPSG:6677"
+
+srand(1)
+
+stations = Array.new(NSTATIONS) { [139.0 + rand, 35.0 + rand] }
+readings = Array.new(NREADINGS) { stations[rand(NSTATIONS)] }
+lons = readings.map(&:first)
+lats = readings.map(&:last)
+
+def measure
+  t0 = Time.now
+  yield
+  Time.now - t0
+end
+
+printf("%d readings from %d stations into %s\n", NREADINGS, NSTATIONS, DST)
+printf("%-22s %12s %12s %10s\n", "", "forward(s)", "batch(s)", "hit rate")
+
+[nil, 256, 4096].each do |capacity|
+  pj = PROJ.new(DST)
+  pj.enable_result_cache(capacity) if capacity
+  t_scalar = measure { readings.each { |lon, lat| pj.forward(lon, lat) } }
+  t_batch  = measure { pj.forward_batch(lons, lats) }
+  stats = pj.result_cache_stats
+  printf("%-22s %12.3f %12.3f %10s\n",
+         capacity ? "cache (#{capacity})" : "no cache", t_scalar, t_batch,
+         stats ? format("%.3f", stats[:hit_rate]) : "-")
+end
@@ -0,0 +1,39 @@
+require "simple-proj"
+
+#########################################
+# Skipping points outside of the area of use
+#########################################
+#
+# NPOINTS random points over the world are transformed into a UTM zone.
+# Most of them are outside of the area of use of the zone, which are
+# skipped up front by the mask.
+
+NPOINTS = 1_000_000
+
+DST = ARGV[0] || "EPSG:32654"
+
+srand(1)
+
+lons = Array.new(NPOINTS) { rand * 360.0 - 180.0 }
+lats = Array.new(NPOINTS) { rand * 180.0 - 90.0 }
+lons = lons.pack("d*")
+lats = lats.pack("d*")
+
+pj = PROJ.new(DST)
+
+def measure
+  t0 = Time.now
+  yield
+  Time.now - t0
+end
+
+mask = nil
+t_mask = measure { mask = pj.within_area_of_use(lons, lats) }
+inside = mask.count("\x01")
+
+printf("%d points into %s (%.1f%% inside of %s)\n", NPOINTS, DST,
+       100.0 * inside / NPOINTS, pj.area_of_use[0,4].inspect)
+printf("%-36s %10.3f\n", "within_area_of_use", t_mask)
+printf("%-36s %10.3f\n", "forward_batch", measure { pj.forward_batch(lons, lats) })
+printf("%-36s %10.3f\n", "forward_batch(mask: mask)", measure { pj.forward_batch(lons, lats, mask: mask) })
+printf("%-36s %10.3f\n", "forward_batch(mask: :area_of_use)", measure { pj.forward_batch(lons, lats, mask: :area_of_use) })
@@ -0,0 +1,78 @@
+require "simple-proj"
+
+#########################################
+# Latency of small requests mixed with large ones
+#########################################
+#
+# A client thread sends LARGE-point requests in a loop while NCLIENTS
+# threads send SMALL-point requests every INTERVAL seconds. The latencies
+# of the small requests (from the scheduled time, so that the waits for
+# the GVL are counted) are compared between #forward_batch in the client
+# threads and #forward_async on the worker pool.
+
+SMALL    = 100
+LARGE    = 1_000_000
+NCLIENTS = 4
+NSMALL   = 200      # requests per client
+INTERVAL = 0.005
+
+DST = ARGV[0] || "EPSG:32654"
+PROJ.configure_async(threads: (ARGV[1] || 4).to_i)
+
+srand(1)
+
+def points (n)
+  [ Array.new(n) { 138.0 + rand * 6.0 }.pack("d*"),
+    Array.new(n) { 30.0 + rand * 10.0 }.pack("d*") ]
+end
+
+small = points(SMALL)
+large = points(LARGE)
+
+def now
+  Process.clock_gettime(Process::CLOCK_MONOTONIC)
+end
+
+def run (pj, small, large)
+  lat = []
+  nlarge = 0
+  lock = Mutex.new
+  stop = false
+  loader = Thread.new {
+    until stop
+      yield pj, large
+      nlarge += 1
+    end
+  }
+  t0 = now
+  clients = NCLIENTS.times.map { |c|
+    Thread.new {
+      NSMALL.times { |k|
+        t = t0 + (k + c.to_f / NCLIENTS) * INTERVAL
+        sleep(t - now) if t > now
+        yield pj, small
+        lock.synchronize { lat << now - t }
+      }
+    }
+  }
+  clients.each(&:join)
+  elapsed = now - t0
+  stop = true
+  loader.join
+  lat.sort!
+  [ lat[lat.size/2], lat[lat.size*99/100], lat.last, nlarge / elapsed ]
+end
+
+pj = PROJ.new(DST)
+
+printf("%d x %d small (%d points) with large (%d points) requests, %d workers\n",
+       NCLIENTS, NSMALL, SMALL, LARGE, PROJ.async_stats[:max_threads])
+printf("%-14s %10s %10s %10s %10s\n", "", "p50 [ms]", "p99 [ms]", "max [ms]", "large/s")
+{
+  "forward_batch" => ->(pj, (x, y)) { pj.forward_batch(x, y) },
+  "forward_async" => ->(pj, (x, y)) { pj.forward_async(x, y).value },
+}.each do |name, func|
+  p50, p99, max, rate = run(pj, small, large, &func)
+  printf("%-14s %10.3f %10.3f %10.3f %10.2f\n", name, p50*1e3, p99*1e3, max*1e3, rate)
+end
+p PROJ.async_stats
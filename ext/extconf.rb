@@ -6,6 +6,8 @@ dir_config("proj", possible_includes, possible_libs)
 
 if have_header("proj.h") and have_library("proj")
   have_carray()
+  have_header("ruby/memory_view.h")
+  have_header("pthread.h")
   create_makefile("simple_proj_ext")
 end
 
@@ -1,16 +1,24 @@
 #include "ruby.h"
 #include "rb_proj.h"
 
+#include <sys/stat.h>
+
+/* estimated size of a PJ object without grids */
+#define RB_PROJ_PJ_SIZE 16384
+
+void mark_proj(void *ap);
 void free_proj(void *ap);
+size_t memsize_proj(const void *ap);
+void compact_proj(void *ap);
 
 const rb_data_type_t proj_data_type = {
     .parent = NULL,
     .wrap_struct_name = "Proj",
     .function = {
-        .dmark = NULL, 
+        .dmark = mark_proj, 
         .dfree = free_proj,
-        .dsize = NULL,
-        .dcompact = NULL
+        .dsize = memsize_proj,
+        .dcompact = compact_proj
     },
     .flags = RUBY_TYPED_FREE_IMMEDIATELY,
 };
@@ -22,6 +30,9 @@ VALUE rb_mCommon;
 ID id_forward;
 ID id_inverse;
 
+/* number of live PJ objects held by PROJ and PROJ::CRS objects */
+static long rb_proj_live_count = 0;
+
 static VALUE
 rb_proj_info (VALUE klass)
 {
@@ -41,21 +52,163 @@ rb_proj_info (VALUE klass)
   return vout;
 }
 
+void
+mark_proj (void *ap)
+{
+  Proj *proj = ap;
+  rb_gc_mark_movable(proj->lazy_defs);
+  rb_gc_mark_movable(proj->lazy_lock);
+}
+
+void
+compact_proj (void *ap)
+{
+  Proj *proj = ap;
+  proj->lazy_defs = rb_gc_location(proj->lazy_defs);
+  proj->lazy_lock = rb_gc_location(proj->lazy_lock);
+}
+
 void 
 free_proj (void *ap)
 {
   Proj *proj = ap;
+  rb_proj_set_ref(proj, NULL);
+  if ( proj->memo ) {
+    rb_proj_memo_free(proj->memo);
+  }
+  free(proj);
+}
+
+size_t
+memsize_proj (const void *ap)
+{
+  const Proj *proj = ap;
+  return sizeof(Proj) + proj->memsize +
+         ( proj->memo ? rb_proj_memo_memsize(proj->memo) : 0 );
+}
+
+/*
+Estimates the memory size of PJ object. PROJ does not report it, so the sizes
+of the grid files used by the operation are added to a fixed size.
+An object from proj_create_crs_to_crs() with several candidate operations
+has no type and is charged the fixed size only: PROJ gives no access to the
+candidates, and listing them again by proj_create_operations() costs as much
+as the construction itself (e.g. ~170 ms for EPSG:4267 to EPSG:4269).
+*/
+static size_t
+rb_proj_estimate_size (PJ *ref)
+{
+  PJ_LOG_LEVEL level;
+  PJ_TYPE type;
+  const char *full_name;
+  struct stat st;
+  size_t size = RB_PROJ_PJ_SIZE;
+  int i, count, available;
+
+  type = proj_get_type(ref);
+  if ( type != PJ_TYPE_CONVERSION &&
+       type != PJ_TYPE_TRANSFORMATION &&
+       type != PJ_TYPE_CONCATENATED_OPERATION &&
+       type != PJ_TYPE_OTHER_COORDINATE_OPERATION ) {
+    return size;
+  }
+
+  level = proj_log_level(PJ_DEFAULT_CTX, PJ_LOG_TELL);
+  proj_log_level(PJ_DEFAULT_CTX, PJ_LOG_NONE);
+  count = proj_coordoperation_get_grid_used_count(PJ_DEFAULT_CTX, ref);
+  for (i=0; i<count; i++) {
+    full_name = NULL;
+    available = 0;
+    if ( proj_coordoperation_get_grid_used(PJ_DEFAULT_CTX, ref, i, NULL, &full_name, 
+                                           NULL, NULL, NULL, NULL, &available) &&
+         available && full_name && full_name[0] && stat(full_name, &st) == 0 ) {
+      size += (size_t) st.st_size;
+    }
+  }
+  proj_log_level(PJ_DEFAULT_CTX, level);
+
+  return size;
+}
+
+/*
+Replaces PJ object held by Proj structure (the old one is destroyed).
+The estimated memory size is reported to GC. The cached results and the copy
+for async workers are dropped.
+*/
+void
+rb_proj_set_ref (Proj *proj, PJ *ref)
+{
+  if ( proj->memo ) {
+    rb_proj_memo_clear(proj->memo);
+  }
+  if ( proj->async_src ) {
+    rb_proj_async_src_release(proj->async_src);
+    proj->async_src = NULL;
+  }
   if ( proj->ref ) {
     proj_destroy(proj->ref);
+    rb_gc_adjust_memory_usage(-(ssize_t) proj->memsize);
+    rb_proj_live_count--;
+  }
+  proj->ref = ref;
+  proj->memsize = 0;
+  proj->area_state = 0;
+  if ( ref ) {
+    proj->memsize = rb_proj_estimate_size(ref);
+    rb_gc_adjust_memory_usage((ssize_t) proj->memsize);
+    rb_proj_live_count++;
   }
-  free(proj);
 }
 
 static VALUE
 rb_proj_s_allocate (VALUE klass)
 {
+  volatile VALUE obj;
   Proj *proj;
-  return TypedData_Make_Struct(klass, Proj, &proj_data_type, proj);
+  obj = TypedData_Make_Struct(klass, Proj, &proj_data_type, proj);
+  proj->lazy_defs = Qnil;
+  proj->lazy_lock = Qnil;
+  return obj;
+}
+
+static VALUE
+rb_proj_construct_lazy (VALUE self)
+{
+  Proj *proj;
+  volatile VALUE vdefs;
+
+  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+
+  /* another thread may have constructed it while waiting for the lock */
+  if ( ! NIL_P(proj->lazy_defs) ) {
+    vdefs = proj->lazy_defs;
+    rb_funcallv(self, rb_intern("initialize"), 
+                (int) RARRAY_LEN(vdefs), RARRAY_CONST_PTR(vdefs));
+  }
+
+  return Qnil;
+}
+
+/*
+Returns Proj structure of the object. A lazily constructed object is 
+constructed here at the first use (an error of the construction raises here).
+*/
+Proj *
+rb_proj_get_struct (VALUE obj)
+{
+  Proj *proj;
+
+  TypedData_Get_Struct(obj, Proj, &proj_data_type, proj);
+
+  if ( ! NIL_P(proj->lazy_defs) ) {
+    rb_mutex_synchronize(proj->lazy_lock, rb_proj_construct_lazy, obj);
+  }
+
+  if ( ! proj->ref ) {
+    rb_raise(rb_eRuntimeError, "%s object is closed", rb_obj_classname(obj));
+  }
+
+  return proj;
 }
 
 /*
@@ -89,9 +242,14 @@ following two cases are possible.
    used as the source CRS definition.
  * a PROJ::CRS object
 
-@overload initialize(def1, def2=nil)
+If `lazy` is true, only the types of the arguments are checked and the 
+construction is deferred until the first use of the object (transformation
+or metadata methods). Errors of the construction are raised at the first use.
+
+@overload initialize(def1, def2=nil, lazy: false)
   @param def1 [String] proj-string or other CRS definition (see above description).
   @param def2 [String, nil] proj-string or other CRS definition (see above description).
+  @param lazy [Boolean] defers the construction until the first use.
 
 @example
   # Transformation from EPSG:4326 to EPSG:3857
@@ -109,44 +267,114 @@ following two cases are possible.
   pj = PROJ.new("EPSG:4326", epsg_3857)
   pj = PROJ.new(epsg_3857, "EPSG:4326")
 
+  # Lazy construction
+  pj = PROJ.new("EPSG:4326", "EPSG:3857", lazy: true)
+
+*/
+
+/*
+Returns 2 if the source CRS of the operation is geographic, or 0.
+*/
+static int
+proj_src_latlong (PJ_CONTEXT *ctx, PJ *ref)
+{
+  PJ *src;
+  PJ_TYPE type;
+  int latlong = 0;
+
+  if ( ! ref ) {
+    return 0;
+  }
+
+  src = proj_get_source_crs(ctx, ref);
+  if ( src ) {
+    type = proj_get_type(src);
+    if ( type == PJ_TYPE_GEOGRAPHIC_2D_CRS ||
+         type == PJ_TYPE_GEOGRAPHIC_3D_CRS ) {
+      latlong = 2;
+    }
+    proj_destroy(src);
+  }
+
+  return latlong;
+}
+
+/*
+Creates the PJ object from one or two definition strings in the context as
+#initialize does, and sets `is_src_latlong`. Returns NULL on failure (the
+error is given by proj_context_errno(ctx)). This doesn't touch Ruby objects,
+so it can be called without GVL.
 */
+PJ *
+rb_proj_create_ref (PJ_CONTEXT *ctx, const char *def1, const char *def2,
+                    int *is_src_latlong)
+{
+  PJ *ref;
+
+  if ( def2 ) {
+    ref = proj_create_crs_to_crs(ctx, def1, def2, NULL);
+    *is_src_latlong = proj_src_latlong(ctx, ref);
+    return ref;
+  }
+
+  ref = proj_create(ctx, def1);
+  if ( proj_is_crs(ref) ) {
+    proj_destroy(ref);
+    ref = proj_create_crs_to_crs(ctx, "+proj=latlong +type=crs", def1, NULL);
+    *is_src_latlong = 2;
+  }
+  else {
+    *is_src_latlong = 1;
+  }
+
+  return ref;
+}
 
 static VALUE
 rb_proj_initialize (int argc, VALUE *argv, VALUE self)
 {
-  volatile VALUE vdef1, vdef2;
+  volatile VALUE vdef1, vdef2, vopts;
+  ID kw_ids[1];
+  VALUE kw_vals[1];
   Proj *proj, *crs;
-  PJ *ref, *src;
-  PJ_TYPE type;
+  PJ *ref;
   int errno;
 
-  rb_scan_args(argc, argv, "11", (VALUE *)&vdef1, (VALUE *)&vdef2);
+  rb_scan_args(argc, argv, "11:", (VALUE *)&vdef1, (VALUE *)&vdef2, (VALUE *)&vopts);
 
   TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
 
+  kw_ids[0] = rb_intern("lazy");
+  rb_get_kwargs(vopts, kw_ids, 0, 1, kw_vals);
+
+  if ( kw_vals[0] != Qundef && RTEST(kw_vals[0]) ) {
+    if ( ! rb_obj_is_kind_of(vdef1, rb_cCrs) ) {
+      StringValueCStr(vdef1);
+    }
+    if ( ! NIL_P(vdef2) && ! rb_obj_is_kind_of(vdef2, rb_cCrs) ) {
+      StringValueCStr(vdef2);
+    }
+    RB_OBJ_WRITE(self, &proj->lazy_lock, rb_mutex_new());
+    RB_OBJ_WRITE(self, &proj->lazy_defs, 
+                 rb_ary_freeze(NIL_P(vdef2) ? rb_ary_new3(1, vdef1) : rb_ary_new3(2, vdef1, vdef2)));
+    return Qnil;
+  }
+
   if ( NIL_P(vdef2) ) {
     if ( rb_obj_is_kind_of(vdef1, rb_cCrs) ) {
       PJ *latlong;
-      TypedData_Get_Struct(vdef1, Proj, &proj_data_type, crs);
+      crs = rb_proj_get_struct(vdef1);
       latlong = proj_create(PJ_DEFAULT_CTX, "+proj=latlong +type=crs");
       ref = proj_create_crs_to_crs_from_pj(PJ_DEFAULT_CTX, latlong, crs->ref, NULL, NULL);
       proj_destroy(latlong);
-      proj->ref = ref;
+      rb_proj_set_ref(proj, ref);
       proj->is_src_latlong = 2;
     }
     else {
       Check_Type(vdef1, T_STRING);
-      ref = proj_create(PJ_DEFAULT_CTX, StringValuePtr(vdef1));
-      if ( proj_is_crs(ref) ) {
-        proj_destroy(ref);
-        ref = proj_create_crs_to_crs(PJ_DEFAULT_CTX, "+proj=latlong +type=crs", StringValuePtr(vdef1), NULL);
-        proj->ref = ref;
-        proj->is_src_latlong = 2;
-      }
-      else {
-        proj->ref = ref;
-        proj->is_src_latlong = 1;
-      }
+      ref = rb_proj_create_ref(PJ_DEFAULT_CTX, StringValuePtr(vdef1), NULL,
+                               &proj->is_src_latlong);
+      rb_proj_set_ref(proj, ref);
     }
   }
   else {
@@ -157,21 +385,24 @@ rb_proj_initialize (int argc, VALUE *argv, VALUE self)
       PJ *src_pj = NULL, *dst_pj = NULL;
       int src_tmp = 0, dst_tmp = 0;
 
+      /* checks both arguments before creating the temporary objects */
       if ( def1_is_crs_obj ) {
-        TypedData_Get_Struct(vdef1, Proj, &proj_data_type, crs);
-        src_pj = crs->ref;
+        src_pj = rb_proj_get_struct(vdef1)->ref;
       }
       else {
         Check_Type(vdef1, T_STRING);
-        src_pj = proj_create(PJ_DEFAULT_CTX, StringValuePtr(vdef1));
-        src_tmp = 1;
       }
       if ( def2_is_crs_obj ) {
-        TypedData_Get_Struct(vdef2, Proj, &proj_data_type, crs);
-        dst_pj = crs->ref;
+        dst_pj = rb_proj_get_struct(vdef2)->ref;
       }
       else {
         Check_Type(vdef2, T_STRING);
+      }
+      if ( ! def1_is_crs_obj ) {
+        src_pj = proj_create(PJ_DEFAULT_CTX, StringValuePtr(vdef1));
+        src_tmp = 1;
+      }
+      if ( ! def2_is_crs_obj ) {
         dst_pj = proj_create(PJ_DEFAULT_CTX, StringValuePtr(vdef2));
         dst_tmp = 1;
       }
@@ -185,28 +416,17 @@ rb_proj_initialize (int argc, VALUE *argv, VALUE self)
       ref = proj_create_crs_to_crs(PJ_DEFAULT_CTX, StringValuePtr(vdef1), StringValuePtr(vdef2), NULL);
     }
 
-    proj->ref = ref;
-    src = proj_get_source_crs(PJ_DEFAULT_CTX, ref);
-    if ( src ) {
-      type = proj_get_type(src);
-      if ( type == PJ_TYPE_GEOGRAPHIC_2D_CRS ||
-           type == PJ_TYPE_GEOGRAPHIC_3D_CRS ) {
-        proj->is_src_latlong = 2;
-      }
-      else {
-        proj->is_src_latlong = 0;
-      }
-      proj_destroy(src);
-    }
-    else {
-      proj->is_src_latlong = 0;
-    }
+    rb_proj_set_ref(proj, ref);
+    proj->is_src_latlong = proj_src_latlong(PJ_DEFAULT_CTX, ref);
   }
   
   if ( ! ref ) {
     errno = proj_context_errno(PJ_DEFAULT_CTX);
     rb_raise(rb_eRuntimeError, "%s", proj_errno_string(errno));
   }
+
+  rb_proj_setup_dispatch(proj);
+  proj->lazy_defs = Qnil;
   
   return Qnil;
 }
@@ -225,7 +445,7 @@ rb_proj_normalize_for_visualization (VALUE self)
   PJ *ref, *orig;
   int errno;
 
-  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+  proj = rb_proj_get_struct(self);
 
   orig = proj->ref;
 
@@ -235,9 +455,8 @@ rb_proj_normalize_for_visualization (VALUE self)
     rb_raise(rb_eRuntimeError, "%s", proj_errno_string(errno));
   }
 
-  proj->ref = ref;
-
-  proj_destroy(orig);
+  rb_proj_set_ref(proj, ref);
+  rb_proj_setup_dispatch(proj);
     
   return self;  
 }
@@ -253,7 +472,7 @@ rb_proj_source_crs (VALUE self)
   Proj *proj;
   PJ *crs;
 
-  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+  proj = rb_proj_get_struct(self);
 
   crs = proj_get_source_crs(PJ_DEFAULT_CTX, proj->ref);
 
@@ -275,7 +494,7 @@ rb_proj_target_crs (VALUE self)
   Proj *proj;
   PJ *crs;
 
-  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+  proj = rb_proj_get_struct(self);
   
   crs = proj_get_target_crs(PJ_DEFAULT_CTX, proj->ref);
 
@@ -297,7 +516,7 @@ rb_proj_angular_input (VALUE self, VALUE direction)
 {
   Proj *proj;
 
-  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+  proj = rb_proj_get_struct(self);
   
   if ( rb_to_id(direction) == id_forward ) {
     return proj_angular_input(proj->ref, PJ_FWD) == 1 ? Qtrue : Qfalse;
@@ -321,7 +540,7 @@ rb_proj_angular_output (VALUE self, VALUE direction)
 {
   Proj *proj;
 
-  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+  proj = rb_proj_get_struct(self);
   
   if ( rb_to_id(direction) == id_forward ) {
     return proj_angular_output(proj->ref, PJ_FWD) == 1 ? Qtrue : Qfalse;
@@ -341,7 +560,7 @@ rb_proj_pj_info (VALUE self)
   Proj *proj;
   PJ_PROJ_INFO info;
 
-  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+  proj = rb_proj_get_struct(self);
 
   info = proj_pj_info(proj->ref);
 
@@ -355,6 +574,68 @@ rb_proj_pj_info (VALUE self)
   return vout;
 }
 
+/*
+Returns the resolved operation as a proj-string pipeline with the kind of
+source coordinates, or nil if the operation can not be exported as a single
+pipeline (e.g. an operation with several candidate operations).
+
+@return [Array, nil] [pipeline, is_src_latlong]
+*/
+static VALUE
+rb_proj_get_pipeline (VALUE self)
+{
+  Proj *proj;
+  PJ_LOG_LEVEL level;
+  const char *string;
+
+  proj = rb_proj_get_struct(self);
+
+  level = proj_log_level(PJ_DEFAULT_CTX, PJ_LOG_TELL);
+  proj_log_level(PJ_DEFAULT_CTX, PJ_LOG_NONE);
+  string = proj_as_proj_string(PJ_DEFAULT_CTX, proj->ref, PJ_PROJ_5, NULL);
+  proj_log_level(PJ_DEFAULT_CTX, level);
+
+  if ( ! string ) {
+    return Qnil;
+  }
+
+  return rb_ary_new3(2, rb_str_new2(string), INT2NUM(proj->is_src_latlong));
+}
+
+/*
+Initializes the object with a proj-string pipeline returned by #_pipeline.
+*/
+static VALUE
+rb_proj_initialize_pipeline (VALUE self, VALUE vpipeline, VALUE vlatlong)
+{
+  Proj *proj;
+  PJ *ref;
+  int errno;
+
+  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+
+  Check_Type(vpipeline, T_STRING);
+  ref = proj_create(PJ_DEFAULT_CTX, StringValueCStr(vpipeline));
+  if ( ! ref ) {
+    errno = proj_context_errno(PJ_DEFAULT_CTX);
+    rb_raise(rb_eRuntimeError, "%s", proj_errno_string(errno));
+  }
+
+  rb_proj_set_ref(proj, ref);
+  proj->is_src_latlong = NUM2INT(vlatlong);
+  rb_proj_setup_dispatch(proj);
+  proj->lazy_defs = Qnil;
+
+  return Qnil;
+}
+
+static VALUE
+rb_proj_s_database_path (VALUE klass)
+{
+  const char *path = proj_context_get_database_path(PJ_DEFAULT_CTX);
+  return ( path ) ? rb_str_new2(path) : Qnil;
+}
+
 
 static VALUE
 rb_proj_factors (VALUE self, VALUE vlon, VALUE vlat)
@@ -363,7 +644,7 @@ rb_proj_factors (VALUE self, VALUE vlon, VALUE vlat)
   PJ_COORD pos;
   PJ_FACTORS factors;
   
-  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+  proj = rb_proj_get_struct(self);
 
   pos.lp.lam = proj_torad(NUM2DBL(vlon));
   pos.lp.phi = proj_torad(NUM2DBL(vlat));
@@ -375,85 +656,253 @@ rb_proj_factors (VALUE self, VALUE vlon, VALUE vlat)
 
 
 /*
-Transforms coordinates forwardly from (lat1, lon1, z1) to (x1, y2, z2).
-The order of coordinates arguments should be longitude, latitude, and height.
-The input longitude and latitude should be in units 'degrees'.
-If the returned coordinates are angles, they are converted in units `degrees`.
+Specialized scalar transformers.
 
-@overload forward(lon1, lat1, z1 = nil)
-  @param lon1 [Numeric] longitude in degrees.
-  @param lat1 [Numeric] latitude in degrees.
-  @param z1 [Numeric, nil] vertical coordinate.
+Each PROJ object holds a table of these functions resolved by
+rb_proj_setup_dispatch() from proj_angular_input() and proj_angular_output(),
+so the per-call path of #forward, #inverse etc. doesn't need to walk the
+pipeline again. They return non-zero if proj_trans() fails.
+*/
 
-@return x2, y2[, z2]
+#define DEFINE_PROJ_TRANS_FUNC(name, dir, conv_in, conv_out)            \
+static int                                                              \
+name (PJ *ref, const double *in, double *out)                           \
+{                                                                       \
+  PJ_COORD c_in, c_out;                                                 \
+  c_in.xyzt.x = conv_in(in[0]);                                         \
+  c_in.xyzt.y = conv_in(in[1]);                                         \
+  c_in.xyzt.z = in[2];                                                  \
+  c_in.xyzt.t = 0.0;                                                    \
+  c_out = proj_trans(ref, dir, c_in);                                   \
+  if ( c_out.xyz.x == HUGE_VAL ) {                                      \
+    return 1;                                                           \
+  }                                                                     \
+  out[0] = conv_out(c_out.xyz.x);                                       \
+  out[1] = conv_out(c_out.xyz.y);                                       \
+  out[2] = c_out.xyz.z;                                                 \
+  return 0;                                                             \
+}
 
-@example
-  x2, y2 = pj.forward(lon1, lat1)
-  x2, y2, z2 = pj.forward(lon1, lat1, z1)
+#define PROJ_CONV_NONE(v) (v)
+
+DEFINE_PROJ_TRANS_FUNC(proj_trans_fwd,             PJ_FWD, PROJ_CONV_NONE, PROJ_CONV_NONE)
+DEFINE_PROJ_TRANS_FUNC(proj_trans_fwd_rad,         PJ_FWD, proj_torad,     PROJ_CONV_NONE)
+DEFINE_PROJ_TRANS_FUNC(proj_trans_fwd_deg,         PJ_FWD, PROJ_CONV_NONE, proj_todeg)
+DEFINE_PROJ_TRANS_FUNC(proj_trans_fwd_rad_deg,     PJ_FWD, proj_torad,     proj_todeg)
+DEFINE_PROJ_TRANS_FUNC(proj_trans_inv,             PJ_INV, PROJ_CONV_NONE, PROJ_CONV_NONE)
+DEFINE_PROJ_TRANS_FUNC(proj_trans_inv_rad,         PJ_INV, proj_torad,     PROJ_CONV_NONE)
+DEFINE_PROJ_TRANS_FUNC(proj_trans_inv_deg,         PJ_INV, PROJ_CONV_NONE, proj_todeg)
+DEFINE_PROJ_TRANS_FUNC(proj_trans_inv_rad_deg,     PJ_INV, proj_torad,     proj_todeg)
+
+static rb_proj_trans_func
+proj_trans_select (PJ_DIRECTION direction, int torad, int todeg)
+{
+  if ( direction == PJ_FWD ) {
+    if ( torad ) {
+      return todeg ? proj_trans_fwd_rad_deg : proj_trans_fwd_rad;
+    }
+    else {
+      return todeg ? proj_trans_fwd_deg : proj_trans_fwd;
+    }
+  }
+  else {
+    if ( torad ) {
+      return todeg ? proj_trans_inv_rad_deg : proj_trans_inv_rad;
+    }
+    else {
+      return todeg ? proj_trans_inv_deg : proj_trans_inv;
+    }
+  }
+}
 
+/*
+Returns the tag of the scalar transformer for the result cache (1..8).
 */
-static VALUE
-rb_proj_forward (int argc, VALUE *argv, VALUE self)
+static unsigned int
+proj_trans_tag (rb_proj_trans_func func)
 {
-  volatile VALUE vlon, vlat, vz;
-  Proj *proj;
-  PJ_COORD data_in, data_out;
-  int errno;
+  static const rb_proj_trans_func funcs[8] = {
+    proj_trans_fwd, proj_trans_fwd_rad, proj_trans_fwd_deg, proj_trans_fwd_rad_deg,
+    proj_trans_inv, proj_trans_inv_rad, proj_trans_inv_deg, proj_trans_inv_rad_deg
+  };
+  unsigned int i;
+
+  for (i=0; i<8; i++) {
+    if ( func == funcs[i] ) {
+      break;
+    }
+  }
 
-  rb_scan_args(argc, argv, "21", (VALUE*) &vlon, (VALUE*) &vlat, (VALUE*) &vz);
+  return i + 1;
+}
 
-  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+/*
+Calls the scalar transformer through the result cache if enabled.
+Returns non-zero and sets `err` if the transformation fails.
+*/
+static int
+proj_trans_cached (Proj *proj, rb_proj_trans_func func,
+                   const double *in, double *out, int *err)
+{
+  unsigned int tag;
+
+  if ( ! proj->memo ) {
+    if ( func(proj->ref, in, out) ) {
+      *err = proj_errno(proj->ref);
+      return 1;
+    }
+    return 0;
+  }
+
+  tag = proj_trans_tag(func);
+  if ( rb_proj_memo_lookup(proj->memo, tag, in, out, err) ) {
+    return ( *err != -1 );
+  }
 
-  if ( ! proj->is_src_latlong ) {
-    rb_raise(rb_eRuntimeError, "requires latlong src crs. use #transform_forward instead of #forward.");
+  if ( func(proj->ref, in, out) ) {
+    *err = proj_errno(proj->ref);
+    out[0] = out[1] = out[2] = HUGE_VAL;
+    rb_proj_memo_store(proj->memo, tag, in, out, *err);
+    return 1;
   }
+  rb_proj_memo_store(proj->memo, tag, in, out, -1);
 
-  if ( proj_angular_input(proj->ref, PJ_FWD) == 1 ) {
-    data_in.lpz.lam = proj_torad(NUM2DBL(vlon));
-    data_in.lpz.phi = proj_torad(NUM2DBL(vlat));
-    data_in.lpz.z   = NIL_P(vz) ? 0.0 : NUM2DBL(vz);
+  return 0;
+}
+
+/*
+Resolves the scalar transformers of the object.
+This should be called whenever proj->ref is replaced.
+*/
+void
+rb_proj_setup_dispatch (Proj *proj)
+{
+  PJ *ref = proj->ref;
+  int in_fwd, out_fwd, in_inv, out_inv;
+
+  proj->transform_forward = proj_trans_fwd;
+  proj->transform_inverse = proj_trans_inv;
+
+  if ( ! ref || ! proj->is_src_latlong ) {
+    proj->forward      = NULL;
+    proj->forward_bang = NULL;
+    proj->inverse      = NULL;
+    proj->inverse_bang = NULL;
+    return;
+  }
+
+  in_fwd  = ( proj_angular_input(ref, PJ_FWD) == 1 );
+  out_fwd = ( proj_angular_output(ref, PJ_FWD) == 1 );
+  in_inv  = ( proj_angular_input(ref, PJ_INV) == 1 );
+  out_inv = ( proj_angular_output(ref, PJ_INV) == 1 );
+
+  proj->forward      = proj_trans_select(PJ_FWD, in_fwd, out_fwd);
+  proj->forward_bang = proj_trans_select(PJ_FWD, in_fwd, 0);
+  proj->inverse      = proj_trans_select(PJ_INV, in_inv, out_inv);
+  proj->inverse_bang = proj_trans_select(PJ_INV, 0, out_inv);
+}
+
+/*
+Common driver of the scalar transformation methods.
+The arguments are (x, y, z = nil) or (out, x, y, z = nil) if `into` is set.
+The result is yielded to the block if given, stored into `out`,
+or returned as a new Array.
+*/
+static VALUE
+rb_proj_scalar_i (int argc, VALUE *argv, Proj *proj,
+                  rb_proj_trans_func func, int into)
+{
+  VALUE vout = Qnil;
+  double in[3], out[3];
+  int has_z, errno;
+
+  if ( into ) {
+    rb_check_arity(argc, 3, 4);
+    vout = argv[0];
+    Check_Type(vout, T_ARRAY);
+    argc--;
+    argv++;
   }
   else {
-    data_in.xyz.x = NUM2DBL(vlon);
-    data_in.xyz.y = NUM2DBL(vlat);
-    data_in.xyz.z = NIL_P(vz) ? 0.0 : NUM2DBL(vz);    
+    rb_check_arity(argc, 2, 3);
   }
 
-  data_out = proj_trans(proj->ref, PJ_FWD, data_in);
+  has_z = ( argc == 3 && ! NIL_P(argv[2]) );
 
-  if ( data_out.xyz.x == HUGE_VAL ) {
-    errno = proj_context_errno(PJ_DEFAULT_CTX);
+  in[0] = NUM2DBL(argv[0]);
+  in[1] = NUM2DBL(argv[1]);
+  in[2] = has_z ? NUM2DBL(argv[2]) : 0.0;
+
+  if ( proj_trans_cached(proj, func, in, out, &errno) ) {
     rb_raise(rb_eRuntimeError, "%s", proj_errno_string(errno));
   }
 
-  if (  proj_angular_output(proj->ref, PJ_FWD) == 1 ) {    
-    if ( NIL_P(vz) ) {
-      return rb_assoc_new(rb_float_new(proj_todeg(data_out.lpz.lam)), 
-                          rb_float_new(proj_todeg(data_out.lpz.phi)));
-    } else {
-      return rb_ary_new3(3, rb_float_new(proj_todeg(data_out.lpz.lam)), 
-                            rb_float_new(proj_todeg(data_out.lpz.phi)),
-                            rb_float_new(data_out.lpz.z));
+  if ( into ) {
+    rb_ary_store(vout, 0, rb_float_new(out[0]));
+    rb_ary_store(vout, 1, rb_float_new(out[1]));
+    if ( has_z ) {
+      rb_ary_store(vout, 2, rb_float_new(out[2]));
+    }
+    rb_ary_resize(vout, has_z ? 3 : 2);
+    return vout;
+  }
+  else if ( rb_block_given_p() ) {
+    if ( has_z ) {
+      return rb_yield_values(3, rb_float_new(out[0]),
+                                rb_float_new(out[1]),
+                                rb_float_new(out[2]));
+    }
+    else {
+      return rb_yield_values(2, rb_float_new(out[0]),
+                                rb_float_new(out[1]));
     }
   }
   else {
-    if ( NIL_P(vz) ) {
-      return rb_assoc_new(rb_float_new(data_out.xyz.x), 
-                          rb_float_new(data_out.xyz.y));    
-    } else {
-      return rb_ary_new3(3, rb_float_new(data_out.xyz.x), 
-                            rb_float_new(data_out.xyz.y),
-                            rb_float_new(data_out.xyz.z));        
+    if ( has_z ) {
+      return rb_ary_new3(3, rb_float_new(out[0]),
+                            rb_float_new(out[1]),
+                            rb_float_new(out[2]));
+    }
+    else {
+      return rb_assoc_new(rb_float_new(out[0]),
+                          rb_float_new(out[1]));
     }
   }
-  
+}
+
+static Proj *
+rb_proj_get_latlong (VALUE self, rb_proj_trans_func *func, int which)
+{
+  Proj *proj;
+
+  proj = rb_proj_get_struct(self);
+
+  switch ( which ) {
+  case 0: *func = proj->forward;      break;
+  case 1: *func = proj->forward_bang; break;
+  case 2: *func = proj->inverse;      break;
+  default: *func = proj->inverse_bang; break;
+  }
+
+  if ( ! *func ) {
+    if ( which < 2 ) {
+      rb_raise(rb_eRuntimeError, "requires latlong src crs. use #transform_forward instead of #forward.");
+    }
+    else {
+      rb_raise(rb_eRuntimeError, "requires latlong src crs. use #transform_inverse instead of #inverse.");
+    }
+  }
+
+  return proj;
 }
 
 /*
 Transforms coordinates forwardly from (lat1, lon1, z1) to (x1, y2, z2).
 The order of coordinates arguments should be longitude, latitude, and height.
 The input longitude and latitude should be in units 'degrees'.
-If the returned coordinates are angles, they are treated as in units `radians`.
+If the returned coordinates are angles, they are converted in units `degrees`.
+If a block is given, the coordinates are yielded to the block instead of
+being returned as a new Array.
 
 @overload forward(lon1, lat1, z1 = nil)
   @param lon1 [Numeric] longitude in degrees.
@@ -465,51 +914,68 @@ If the returned coordinates are angles, they are treated as in units `radians`.
 @example
   x2, y2 = pj.forward(lon1, lat1)
   x2, y2, z2 = pj.forward(lon1, lat1, z1)
+  pj.forward(lon1, lat1) { |x2, y2| ... }
 
 */
 static VALUE
-rb_proj_forward_bang (int argc, VALUE *argv, VALUE self)
+rb_proj_forward (int argc, VALUE *argv, VALUE self)
 {
-  volatile VALUE vlon, vlat, vz;
-  Proj *proj;
-  PJ_COORD data_in, data_out;
-  int errno;
+  rb_proj_trans_func func;
+  Proj *proj = rb_proj_get_latlong(self, &func, 0);
+  return rb_proj_scalar_i(argc, argv, proj, func, 0);
+}
 
-  rb_scan_args(argc, argv, "21", (VALUE*) &vlon, (VALUE*) &vlat, (VALUE*) &vz);
+/*
+A variant of #forward which stores the result into the given Array
+instead of allocating a new one. The Array is resized to the number of
+the output coordinates (2 without z1, 3 with z1).
 
-  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+@overload forward_into(out, lon1, lat1, z1 = nil)
+  @param out [Array] output array
+  @param lon1 [Numeric] longitude in degrees.
+  @param lat1 [Numeric] latitude in degrees.
+  @param z1 [Numeric, nil] vertical coordinate.
 
-  if ( ! proj->is_src_latlong ) {
-    rb_raise(rb_eRuntimeError, "requires latlong src crs. use #transform_forward instead of #forward.");
-  }
+@return [Array] out
 
-  if ( proj_angular_input(proj->ref, PJ_FWD) == 1 ) {
-    data_in.lpz.lam = proj_torad(NUM2DBL(vlon));
-    data_in.lpz.phi = proj_torad(NUM2DBL(vlat));
-    data_in.lpz.z   = NIL_P(vz) ? 0.0 : NUM2DBL(vz);
-  }
-  else {
-    data_in.xyz.x = NUM2DBL(vlon);
-    data_in.xyz.y = NUM2DBL(vlat);
-    data_in.xyz.z = NIL_P(vz) ? 0.0 : NUM2DBL(vz);    
-  }
+@example
+  out = []
+  pj.forward_into(out, lon1, lat1)
+*/
+static VALUE
+rb_proj_forward_into (int argc, VALUE *argv, VALUE self)
+{
+  rb_proj_trans_func func;
+  Proj *proj = rb_proj_get_latlong(self, &func, 0);
+  return rb_proj_scalar_i(argc, argv, proj, func, 1);
+}
 
-  data_out = proj_trans(proj->ref, PJ_FWD, data_in);
+/*
+Transforms coordinates forwardly from (lat1, lon1, z1) to (x1, y2, z2).
+The order of coordinates arguments should be longitude, latitude, and height.
+The input longitude and latitude should be in units 'degrees'.
+If the returned coordinates are angles, they are treated as in units `radians`.
+If a block is given, the coordinates are yielded to the block instead of
+being returned as a new Array.
 
-  if ( data_out.xyz.x == HUGE_VAL ) {
-    errno = proj_context_errno(PJ_DEFAULT_CTX);
-    rb_raise(rb_eRuntimeError, "%s", proj_errno_string(errno));
-  }
+@overload forward(lon1, lat1, z1 = nil)
+  @param lon1 [Numeric] longitude in degrees.
+  @param lat1 [Numeric] latitude in degrees.
+  @param z1 [Numeric, nil] vertical coordinate.
 
-  if ( NIL_P(vz) ) {
-    return rb_assoc_new(rb_float_new(data_out.xyz.x), 
-                        rb_float_new(data_out.xyz.y));    
-  } else {
-    return rb_ary_new3(3, rb_float_new(data_out.xyz.x), 
-                          rb_float_new(data_out.xyz.y),
-                          rb_float_new(data_out.xyz.z));        
-  }
-  
+@return x2, y2[, z2]
+
+@example
+  x2, y2 = pj.forward(lon1, lat1)
+  x2, y2, z2 = pj.forward(lon1, lat1, z1)
+
+*/
+static VALUE
+rb_proj_forward_bang (int argc, VALUE *argv, VALUE self)
+{
+  rb_proj_trans_func func;
+  Proj *proj = rb_proj_get_latlong(self, &func, 1);
+  return rb_proj_scalar_i(argc, argv, proj, func, 0);
 }
 
 /*
@@ -517,9 +983,11 @@ Transforms coordinates inversely from (x1, y1, z1) to (lon2, lat2, z2).
 The order of output coordinates is longitude, latitude and height.
 If the input coordinates are angles, they are treated as being in units `degrees`.
 The returned longitude and latitude are in units 'degrees'.
+If a block is given, the coordinates are yielded to the block instead of
+being returned as a new Array.
 
 @overload inverse(x1, y1, z1 = nil)
-  @param x1 [Numeric] 
+  @param x1 [Numeric]
   @param y1 [Numeric]
   @param z1 [Numeric, nil]
 
@@ -528,62 +996,36 @@ The returned longitude and latitude are in units 'degrees'.
 @example
   lon2, lat2 = pj.inverse(x1, y1)
   lon2, lat2, z2 = pj.inverse(x1, y1, z1)
+  pj.inverse(x1, y1) { |lon2, lat2| ... }
 
 */
 static VALUE
 rb_proj_inverse (int argc, VALUE *argv, VALUE self)
 {
-  volatile VALUE vx, vy, vz;
-  Proj *proj;
-  PJ_COORD data_in, data_out;
-  int errno;
-
-  rb_scan_args(argc, argv, "21", (VALUE *)&vx, (VALUE *)&vy, (VALUE *)&vz);
-
-  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
-
-  if ( ! proj->is_src_latlong ) {
-    rb_raise(rb_eRuntimeError, "requires latlong src crs. use #transform_inverse instead of #inverse.");
-  }
-
-  if ( proj_angular_input(proj->ref, PJ_INV) == 1 ) {
-    data_in.lpz.lam = proj_torad(NUM2DBL(vx));
-    data_in.lpz.phi = proj_torad(NUM2DBL(vy));
-    data_in.lpz.z   = NIL_P(vz) ? 0.0 : NUM2DBL(vz);
-  }
-  else {
-    data_in.xyz.x = NUM2DBL(vx);
-    data_in.xyz.y = NUM2DBL(vy);
-    data_in.xyz.z = NIL_P(vz) ? 0.0 : NUM2DBL(vz);
-  }
+  rb_proj_trans_func func;
+  Proj *proj = rb_proj_get_latlong(self, &func, 2);
+  return rb_proj_scalar_i(argc, argv, proj, func, 0);
+}
 
-  data_out = proj_trans(proj->ref, PJ_INV, data_in);
+/*
+A variant of #inverse which stores the result into the given Array
+instead of allocating a new one. The Array is resized to the number of
+the output coordinates (2 without z1, 3 with z1).
 
-  if ( data_out.lpz.lam == HUGE_VAL ) {
-    errno = proj_errno(proj->ref);
-    rb_raise(rb_eRuntimeError, "%s", proj_errno_string(errno));
-  }
+@overload inverse_into(out, x1, y1, z1 = nil)
+  @param out [Array] output array
+  @param x1 [Numeric]
+  @param y1 [Numeric]
+  @param z1 [Numeric, nil]
 
-  if (  proj_angular_output(proj->ref, PJ_INV) == 1 ) {    
-    if ( NIL_P(vz) ) {
-      return rb_assoc_new(rb_float_new(proj_todeg(data_out.lpz.lam)), 
-                          rb_float_new(proj_todeg(data_out.lpz.phi)));
-    } else {
-      return rb_ary_new3(3, rb_float_new(proj_todeg(data_out.lpz.lam)), 
-                            rb_float_new(proj_todeg(data_out.lpz.phi)),
-                            rb_float_new(data_out.lpz.z));
-    }
-  }
-  else {
-    if ( NIL_P(vz) ) {
-      return rb_assoc_new(rb_float_new(data_out.xyz.x), 
-                          rb_float_new(data_out.xyz.y));
-    } else {
-      return rb_ary_new3(3, rb_float_new(data_out.xyz.x), 
-                            rb_float_new(data_out.xyz.y),
-                            rb_float_new(data_out.xyz.z));
-    }    
-  }
+@return [Array] out
+*/
+static VALUE
+rb_proj_inverse_into (int argc, VALUE *argv, VALUE self)
+{
+  rb_proj_trans_func func;
+  Proj *proj = rb_proj_get_latlong(self, &func, 2);
+  return rb_proj_scalar_i(argc, argv, proj, func, 1);
 }
 
 /*
@@ -591,9 +1033,11 @@ Transforms coordinates inversely from (x1, y1, z1) to (lon2, lat2, z2).
 The order of output coordinates is longitude, latitude and height.
 If the input coordinates are angles, they are treated as being in units `radians`.
 The returned longitude and latitude are in units 'degrees'.
+If a block is given, the coordinates are yielded to the block instead of
+being returned as a new Array.
 
 @overload inverse(x1, y1, z1 = nil)
-  @param x1 [Numeric] 
+  @param x1 [Numeric]
   @param y1 [Numeric]
   @param z1 [Numeric, nil]
 
@@ -607,92 +1051,16 @@ The returned longitude and latitude are in units 'degrees'.
 static VALUE
 rb_proj_inverse_bang (int argc, VALUE *argv, VALUE self)
 {
-  volatile VALUE vx, vy, vz;
-  Proj *proj;
-  PJ_COORD data_in, data_out;
-  int errno;
-
-  rb_scan_args(argc, argv, "21", (VALUE *)&vx, (VALUE *)&vy, (VALUE *)&vz);
-
-  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
-
-  if ( ! proj->is_src_latlong ) {
-    rb_raise(rb_eRuntimeError, "requires latlong src crs. use #transform_inverse instead of #inverse.");
-  }
-
-  data_in.xyz.x = NUM2DBL(vx);
-  data_in.xyz.y = NUM2DBL(vy);
-  data_in.xyz.z = NIL_P(vz) ? 0.0 : NUM2DBL(vz);
-
-  data_out = proj_trans(proj->ref, PJ_INV, data_in);
-
-  if ( data_out.lpz.lam == HUGE_VAL ) {
-    errno = proj_errno(proj->ref);
-    rb_raise(rb_eRuntimeError, "%s", proj_errno_string(errno));
-  }
-
-  if (  proj_angular_output(proj->ref, PJ_INV) == 1 ) {    
-    if ( NIL_P(vz) ) {
-      return rb_assoc_new(rb_float_new(proj_todeg(data_out.lpz.lam)), 
-                          rb_float_new(proj_todeg(data_out.lpz.phi)));
-    } else {
-      return rb_ary_new3(3, rb_float_new(proj_todeg(data_out.lpz.lam)), 
-                            rb_float_new(proj_todeg(data_out.lpz.phi)),
-                            rb_float_new(data_out.lpz.z));
-    }
-  }
-  else {
-    if ( NIL_P(vz) ) {
-      return rb_assoc_new(rb_float_new(data_out.xyz.x), 
-                          rb_float_new(data_out.xyz.y));
-    } else {
-      return rb_ary_new3(3, rb_float_new(data_out.xyz.x), 
-                            rb_float_new(data_out.xyz.y),
-                            rb_float_new(data_out.xyz.z));
-    }    
-  }
-}
-
-static VALUE
-rb_proj_transform_i (int argc, VALUE *argv, VALUE self, PJ_DIRECTION direction)
-{
-  VALUE vx, vy, vz;
-  Proj *trans;
-  PJ_COORD c_in, c_out;
-  int errno;
-
-  rb_scan_args(argc, argv, "21", (VALUE*)&vx, (VALUE*)&vy, (VALUE*)&vz);
-
-  TypedData_Get_Struct(self, Proj, &proj_data_type, trans);
-
-  c_in.xyz.x = NUM2DBL(vx);
-  c_in.xyz.y = NUM2DBL(vy);
-  c_in.xyz.z = NIL_P(vz) ? 0.0 : NUM2DBL(vz);      
-
-  c_out = proj_trans(trans->ref, direction, c_in);
-
-  if ( c_out.xyz.x == HUGE_VAL ) {
-    errno = proj_errno(trans->ref);
-    rb_raise(rb_eRuntimeError, "%s", proj_errno_string(errno));
-  }
-  
-  if ( NIL_P(vz) ) {
-    return rb_ary_new3(2, 
-    	     rb_float_new(c_out.xyz.x),
-	         rb_float_new(c_out.xyz.y));      
-  }
-  else {
-    return rb_ary_new3(3, 
-    	     rb_float_new(c_out.xyz.x),
-	         rb_float_new(c_out.xyz.y),
-	         rb_float_new(c_out.xyz.z));
-  }      
-  
+  rb_proj_trans_func func;
+  Proj *proj = rb_proj_get_latlong(self, &func, 3);
+  return rb_proj_scalar_i(argc, argv, proj, func, 0);
 }
 
 /*
 Transforms coordinates forwardly from (x1, y1, z1) to (x1, y2, z2).
 The order of coordinates arguments are according to source and target CRSs.
+If a block is given, the coordinates are yielded to the block instead of
+being returned as a new Array.
 
 @overload transform_forward(x1, y1, z1 = nil)
   @param x1 [Numeric]
@@ -704,17 +1072,43 @@ The order of coordinates arguments are according to source and target CRSs.
 @example
   x2, y2 = pj.transform(x1, y1)
   x2, y2, z2 = pj.transform(x1, y1, z1)
+  pj.transform(x1, y1) { |x2, y2| ... }
 
 */
 static VALUE
 rb_proj_transform_forward (int argc, VALUE *argv, VALUE self)
 {
-  return rb_proj_transform_i(argc, argv, self, PJ_FWD);
+  Proj *proj;
+  proj = rb_proj_get_struct(self);
+  return rb_proj_scalar_i(argc, argv, proj, proj->transform_forward, 0);
+}
+
+/*
+A variant of #transform which stores the result into the given Array
+instead of allocating a new one. The Array is resized to the number of
+the output coordinates (2 without z1, 3 with z1).
+
+@overload transform_into(out, x1, y1, z1 = nil)
+  @param out [Array] output array
+  @param x1 [Numeric]
+  @param y1 [Numeric]
+  @param z1 [Numeric, nil]
+
+@return [Array] out
+*/
+static VALUE
+rb_proj_transform_forward_into (int argc, VALUE *argv, VALUE self)
+{
+  Proj *proj;
+  proj = rb_proj_get_struct(self);
+  return rb_proj_scalar_i(argc, argv, proj, proj->transform_forward, 1);
 }
 
 /*
 Transforms coordinates inversely from (x1, y1, z1) to (x1, y2, z2).
 The order of coordinates arguments are according to source and target CRSs.
+If a block is given, the coordinates are yielded to the block instead of
+being returned as a new Array.
 
 @overload transform_inverse(x1, y1, z1 = nil)
   @param x1 [Numeric]
@@ -730,7 +1124,30 @@ The order of coordinates arguments are according to source and target CRSs.
 static VALUE
 rb_proj_transform_inverse (int argc, VALUE *argv, VALUE self)
 {
-  return rb_proj_transform_i(argc, argv, self, PJ_INV);
+  Proj *proj;
+  proj = rb_proj_get_struct(self);
+  return rb_proj_scalar_i(argc, argv, proj, proj->transform_inverse, 0);
+}
+
+/*
+A variant of #transform_inverse which stores the result into the given Array
+instead of allocating a new one. The Array is resized to the number of
+the output coordinates (2 without z1, 3 with z1).
+
+@overload transform_inverse_into(out, x1, y1, z1 = nil)
+  @param out [Array] output array
+  @param x1 [Numeric]
+  @param y1 [Numeric]
+  @param z1 [Numeric, nil]
+
+@return [Array] out
+*/
+static VALUE
+rb_proj_transform_inverse_into (int argc, VALUE *argv, VALUE self)
+{
+  Proj *proj;
+  proj = rb_proj_get_struct(self);
+  return rb_proj_scalar_i(argc, argv, proj, proj->transform_inverse, 1);
 }
 
 /*
@@ -774,9 +1191,10 @@ rb_crs_initialize (VALUE self, VALUE vdef1)
   }
 
   if ( proj_is_crs(ref) ) {
-    proj->ref = ref;
+    rb_proj_set_ref(proj, ref);
   }
   else {
+    proj_destroy(ref);
     rb_raise(rb_eRuntimeError, "should be crs definition");
   }
     
@@ -792,7 +1210,7 @@ rb_crs_new (PJ *ref)
   vcrs = rb_proj_s_allocate(rb_cCrs);
   TypedData_Get_Struct(vcrs, Proj, &proj_data_type, proj);
   
-  proj->ref = ref;
+  rb_proj_set_ref(proj, ref);
   
   return vcrs;
 }
@@ -806,8 +1224,13 @@ rb_proj_initialize_copy (VALUE self, VALUE obj)
   TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
 
   if ( rb_obj_is_kind_of(obj, rb_cProj) || rb_obj_is_kind_of(obj, rb_cCrs) ) {
-    TypedData_Get_Struct(obj, Proj, &proj_data_type, other);
-    proj->ref = proj_clone(PJ_DEFAULT_CTX, other->ref);    
+    other = rb_proj_get_struct(obj);
+    rb_proj_set_ref(proj, proj_clone(PJ_DEFAULT_CTX, other->ref));    
+    proj->is_src_latlong = other->is_src_latlong;
+    proj->area_state     = other->area_state;
+    proj->area_lat_first = other->area_lat_first;
+    proj->area           = other->area;
+    rb_proj_setup_dispatch(proj);
   }
   else {
     rb_raise(rb_eArgError, "invalid class of argument object");
@@ -816,6 +1239,52 @@ rb_proj_initialize_copy (VALUE self, VALUE obj)
   return self;
 }
 
+/*
+Releases PJ object held by the object. 
+The object can not be used after closed.
+
+@return [nil]
+*/
+static VALUE
+rb_proj_close (VALUE self)
+{
+  Proj *proj;
+
+  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+
+  proj->lazy_defs = Qnil;
+  rb_proj_set_ref(proj, NULL);
+
+  return Qnil;
+}
+
+/*
+Checks if the object is closed.
+
+@return [Boolean]
+*/
+static VALUE
+rb_proj_closed_p (VALUE self)
+{
+  Proj *proj;
+
+  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+
+  return ( ! proj->ref && NIL_P(proj->lazy_defs) ) ? Qtrue : Qfalse;
+}
+
+/*
+Returns the number of live PJ objects held by PROJ and PROJ::CRS objects
+in the process.
+
+@return [Integer]
+*/
+static VALUE
+rb_proj_s_live_handles (VALUE klass)
+{
+  return LONG2NUM(rb_proj_live_count);
+}
+
 /*
 Gets the name of the object.
 
@@ -826,7 +1295,7 @@ rb_proj_get_name (VALUE self)
 {
   Proj *proj;
 
-  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+  proj = rb_proj_get_struct(self);
 
   return rb_str_new2(proj_get_name(proj->ref));  
 }
@@ -849,7 +1318,7 @@ rb_proj_get_id_auth_name (int argc, VALUE *argv, VALUE self)
 
   rb_scan_args(argc, argv, "01", (VALUE *)&vidx);
 
-  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+  proj = rb_proj_get_struct(self);
 
   if ( NIL_P(vidx) ) {
     string = proj_get_id_auth_name(proj->ref, 0);
@@ -879,7 +1348,7 @@ rb_proj_get_id_code (int argc, VALUE *argv, VALUE self)
 
   rb_scan_args(argc, argv, "01", (VALUE *)&vidx);
 
-  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+  proj = rb_proj_get_struct(self);
 
   if ( NIL_P(vidx) ) {
     string = proj_get_id_code(proj->ref, 0);    
@@ -904,7 +1373,7 @@ rb_proj_as_proj_string (VALUE self)
 {
   Proj *proj;
   const char *string;
-  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+  proj = rb_proj_get_struct(self);
 
   string = proj_as_proj_string(PJ_DEFAULT_CTX, proj->ref, PJ_PROJ_5, NULL);
   if ( ! string ) {
@@ -932,7 +1401,7 @@ rb_proj_as_projjson (int argc, VALUE *argv, VALUE self)
   const char *json = NULL;
   int i;
 
-  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+  proj = rb_proj_get_struct(self);
 
   if ( argc == 0 ) {
     json = proj_as_projjson(PJ_DEFAULT_CTX, proj->ref, NULL);		
@@ -971,7 +1440,7 @@ rb_proj_ellipsoid_get_parameters (VALUE self)
   double a, b, invf;
   int computed;
 
-  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+  proj = rb_proj_get_struct(self);
 
   ellps = proj_get_ellipsoid(PJ_DEFAULT_CTX, proj->ref);
   proj_ellipsoid_get_parameters(PJ_DEFAULT_CTX, ellps, &a, &b, &computed, &invf);
@@ -996,7 +1465,7 @@ rb_proj_as_wkt (int argc, VALUE *argv, VALUE self)
 
   rb_scan_args(argc, argv, "01", (VALUE *)&vidx);
 
-  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+  proj = rb_proj_get_struct(self);
 
   if ( NIL_P(vidx) ) {
     wkt = proj_as_wkt(PJ_DEFAULT_CTX, proj->ref, PJ_WKT2_2018, NULL);    
@@ -1028,6 +1497,8 @@ Init_simple_proj_ext ()
   rb_include_module(rb_cCrs,  rb_mCommon);
 
   rb_define_singleton_method(rb_cProj, "_info", rb_proj_info, 0);
+  rb_define_singleton_method(rb_cProj, "_database_path", rb_proj_s_database_path, 0);
+  rb_define_singleton_method(rb_cProj, "live_handles", rb_proj_s_live_handles, 0);
 
   rb_define_alloc_func(rb_cProj, rb_proj_s_allocate);
   rb_define_method(rb_cProj, "initialize", rb_proj_initialize, -1);
@@ -1038,18 +1509,26 @@ Init_simple_proj_ext ()
   rb_define_method(rb_cProj, "normalize_for_visualization", rb_proj_normalize_for_visualization, 0);
   rb_define_method(rb_cProj, "forward", rb_proj_forward, -1);
   rb_define_method(rb_cProj, "forward!", rb_proj_forward_bang, -1);
+  rb_define_method(rb_cProj, "forward_into", rb_proj_forward_into, -1);
   rb_define_method(rb_cProj, "inverse", rb_proj_inverse, -1);
   rb_define_method(rb_cProj, "inverse!", rb_proj_inverse_bang, -1);
+  rb_define_method(rb_cProj, "inverse_into", rb_proj_inverse_into, -1);
   rb_define_method(rb_cProj, "transform", rb_proj_transform_forward, -1);
+  rb_define_method(rb_cProj, "transform_into", rb_proj_transform_forward_into, -1);
   rb_define_method(rb_cProj, "transform_inverse", rb_proj_transform_inverse, -1);
+  rb_define_method(rb_cProj, "transform_inverse_into", rb_proj_transform_inverse_into, -1);
   rb_define_private_method(rb_cProj, "_pj_info", rb_proj_pj_info, 0);
   rb_define_private_method(rb_cProj, "_factors", rb_proj_factors, 2);
+  rb_define_private_method(rb_cProj, "_pipeline", rb_proj_get_pipeline, 0);
+  rb_define_private_method(rb_cProj, "_initialize_pipeline", rb_proj_initialize_pipeline, 2);
   
   rb_define_alloc_func(rb_cCrs, rb_proj_s_allocate);
   rb_define_method(rb_cCrs, "initialize", rb_crs_initialize, 1);
   rb_define_method(rb_cCrs, "normalize_for_visualization", rb_proj_normalize_for_visualization, 0);
 
   rb_define_method(rb_mCommon, "initialize_copy", rb_proj_initialize_copy, 1);
+  rb_define_method(rb_mCommon, "close", rb_proj_close, 0);
+  rb_define_method(rb_mCommon, "closed?", rb_proj_closed_p, 0);
   rb_define_method(rb_mCommon, "name", rb_proj_get_name, 0);
   rb_define_method(rb_mCommon, "id_auth_name", rb_proj_get_id_auth_name, -1);
   rb_define_method(rb_mCommon, "id_code", rb_proj_get_id_code, -1);
@@ -1070,4 +1549,20 @@ Init_simple_proj_ext ()
 #endif
   rb_define_const(rb_cProj, "WKT1_GDAL", INT2NUM(PJ_WKT1_GDAL));
   rb_define_const(rb_cProj, "WKT1_ESRI", INT2NUM(PJ_WKT1_ESRI));
+
+  Init_simple_proj_buffer();
+  Init_simple_proj_batch();
+  Init_simple_proj_grid();
+  Init_simple_proj_warp();
+  Init_simple_proj_tile();
+  Init_simple_proj_geojson();
+  Init_simple_proj_wkb();
+  Init_simple_proj_line();
+  Init_simple_proj_context();
+  Init_simple_proj_database();
+  Init_simple_proj_utm();
+  Init_simple_proj_track();
+  Init_simple_proj_memo();
+  Init_simple_proj_area();
+  Init_simple_proj_async();
 }
\ No newline at end of file
@@ -3,18 +3,184 @@
 
 #include <proj.h>
 
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+#include "ruby/memory_view.h"
+#endif
+
+typedef int (*rb_proj_trans_func)(PJ *ref, const double *in, double *out);
+
+/* result cache of PROJ object (rb_proj_memo.c) */
+typedef struct rb_proj_memo rb_proj_memo;
+
+/* tags of result cache for batch methods (scalar methods use 1..8) */
+#define RB_PROJ_MEMO_TAG_BATCH_FWD 9
+#define RB_PROJ_MEMO_TAG_BATCH_INV 10
+
+/* template of PJ object for async workers (rb_proj_async.c) */
+typedef struct rb_proj_async_src rb_proj_async_src;
+
+/* area of use in degrees (west > east if crossing the antimeridian) */
+typedef struct {
+  double west, south, east, north;
+} rb_proj_area;
+
 typedef struct {
   PJ *ref;
   int is_src_latlong;
+  rb_proj_trans_func forward;
+  rb_proj_trans_func forward_bang;
+  rb_proj_trans_func inverse;
+  rb_proj_trans_func inverse_bang;
+  rb_proj_trans_func transform_forward;
+  rb_proj_trans_func transform_inverse;
+  VALUE lazy_defs;   /* definitions of lazily constructed object (or nil) */
+  VALUE lazy_lock;   /* Mutex serializing the construction */
+  size_t memsize;    /* estimated memory size of ref */
+  rb_proj_memo *memo;  /* result cache (or NULL) */
+  rb_proj_async_src *async_src;  /* copy of ref for async workers (or NULL) */
+  /* area of use restored with the pipeline (area_state: 0 none, 1 unknown,
+     2 known), since a bare pipeline has neither area nor source CRS */
+  int area_state;
+  int area_lat_first;
+  rb_proj_area area;
 } Proj;
 
+enum {
+  RB_PROJ_BUFFER_NONE = 0,
+  RB_PROJ_BUFFER_STRING,
+  RB_PROJ_BUFFER_COPY,
+  RB_PROJ_BUFFER_VIEW,
+  RB_PROJ_BUFFER_ALIGNED
+};
+
+typedef struct {
+  VALUE obj;
+  double *ptr;
+  long len;
+  int kind;
+  int ndim;
+  long shape[2];
+  int locked;           /* String locked by rb_proj_buffer_lock */
+  VALUE copy;           /* aligned copy of a misaligned String (ALIGNED) */
+  long copy_size;       /* bytes of the copy */
+  int writeback;        /* copy is written back to obj on release */
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+  rb_memory_view_t view;
+#endif
+} rb_proj_buffer;
+
+/* element types of PROJ::Buffer */
+enum {
+  RB_PROJ_TYPE_FLOAT64 = 0,
+  RB_PROJ_TYPE_FLOAT32,
+  RB_PROJ_TYPE_INT32,
+  RB_PROJ_TYPE_INT16
+};
+
+/* coordinate buffer with element type, value = raw * scale + offset */
+typedef struct {
+  VALUE obj;
+  char *ptr;
+  long len;
+  int type;
+  double scale, offset;
+  rb_proj_buffer buf;   /* used for plain double buffers */
+  int is_view;
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+  rb_memory_view_t view;
+#endif
+} rb_proj_typed_buffer;
+
+typedef struct {
+  long r0, r1, c0, c1;
+} rb_proj_grid_block;
+
+typedef struct {
+  PJ *ref;
+  PJ_DIRECTION direction;
+  /* input point at (r, c) is (x0 + c*xc + r*xr, y0 + c*yc + r*yr) */
+  double x0, y0;
+  double xc, xr, yc, yr;
+  long nrow, ncol;
+  double max_error;
+  double *x, *y;
+  /* work area */
+  unsigned char *state;
+  long *pend;
+  double *px, *py;
+  long npend, cpend;
+  rb_proj_grid_block *blocks, *next;
+  long nblocks, nnext, cblocks, cnext;
+} rb_proj_grid;
+
 extern PJ* PJ_DEFAULT_LONGLAT;
 
 extern const rb_data_type_t proj_data_type;
 
 extern VALUE rb_cProj;
 extern VALUE rb_cCrs;
+extern VALUE rb_mCommon;
+extern VALUE rb_cProjBuffer;
+
+extern ID id_forward;
+extern ID id_inverse;
 
 VALUE rb_crs_new(PJ *);
+Proj *rb_proj_get_struct(VALUE);
+void  rb_proj_set_ref(Proj *, PJ *);
+void  rb_proj_setup_dispatch(Proj *);
+PJ   *rb_proj_create_ref(PJ_CONTEXT *, const char *def1, const char *def2,
+                         int *is_src_latlong);
+
+void  rb_proj_buffer_get(VALUE, rb_proj_buffer *, int writable);
+void  rb_proj_buffer_release(rb_proj_buffer *);
+void  rb_proj_buffer_lock(rb_proj_buffer *);
+void  rb_proj_buffer_get_pair(VALUE, VALUE, rb_proj_buffer *, rb_proj_buffer *);
+VALUE rb_proj_buffer_new(long len, double **ptr);
+long  rb_proj_shape_size(long nrow, long ncol);
+
+int   rb_proj_typed_buffer_type(VALUE);
+void  rb_proj_typed_buffer_get(VALUE, rb_proj_typed_buffer *, int writable);
+void  rb_proj_typed_buffer_release(rb_proj_typed_buffer *);
+void  rb_proj_typed_buffer_read(const rb_proj_typed_buffer *, long start, long n,
+                                double factor, double *dst);
+void  rb_proj_typed_buffer_write(rb_proj_typed_buffer *, long start, long n,
+                                 double factor, const double *src);
+VALUE rb_proj_typed_buffer_new(int type, double scale, double offset, long len);
+
+int   rb_proj_memo_lookup(rb_proj_memo *, unsigned int tag, const double *in,
+                          double *out, int *err);
+void  rb_proj_memo_store(rb_proj_memo *, unsigned int tag, const double *in,
+                         const double *out, int err);
+void  rb_proj_memo_clear(rb_proj_memo *);
+void  rb_proj_memo_free(rb_proj_memo *);
+size_t rb_proj_memo_memsize(const rb_proj_memo *);
+
+int   rb_proj_area_get(Proj *, rb_proj_area *, const char **name);
+int   rb_proj_area_lat_first(Proj *);
+void  rb_proj_area_mask(const rb_proj_area *, double unit,
+                        const double *lon, const double *lat, long n,
+                        unsigned char *mask);
+
+void  rb_proj_async_src_release(rb_proj_async_src *);
+
+int   rb_proj_grid_run(rb_proj_grid *);
+void  rb_proj_grid_free(rb_proj_grid *);
+
+void  Init_simple_proj_buffer(void);
+void  Init_simple_proj_batch(void);
+void  Init_simple_proj_grid(void);
+void  Init_simple_proj_warp(void);
+void  Init_simple_proj_tile(void);
+void  Init_simple_proj_geojson(void);
+void  Init_simple_proj_wkb(void);
+void  Init_simple_proj_line(void);
+void  Init_simple_proj_context(void);
+void  Init_simple_proj_database(void);
+void  Init_simple_proj_utm(void);
+void  Init_simple_proj_track(void);
+void  Init_simple_proj_memo(void);
+void  Init_simple_proj_area(void);
+void  Init_simple_proj_async(void);
 
 #endif
\ No newline at end of file
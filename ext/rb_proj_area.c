@@ -0,0 +1,328 @@
+#include "ruby.h"
+#include "rb_proj.h"
+
+#include <math.h>
+#include <string.h>
+
+/*
+Area of use and vectorized test of points against it.
+
+The area of use of an operation is not always available from the operation
+itself (e.g. built from several candidate operations), and may be wider than
+that of the target CRS (e.g. from "+proj=latlong"). The smallest one of the
+areas of the operation, the source CRS and the target CRS is used, which
+approximates their intersection. Areas crossing the antimeridian have
+west > east.
+*/
+
+#define AREA_UNKNOWN -1000.0
+
+static int
+area_of (PJ *obj, rb_proj_area *area, const char **name)
+{
+  double w, s, e, n;
+  const char *nm = NULL;
+
+  if ( ! proj_get_area_of_use(PJ_DEFAULT_CTX, obj, &w, &s, &e, &n, &nm) ) {
+    return 0;
+  }
+  if ( w == AREA_UNKNOWN || s == AREA_UNKNOWN || e == AREA_UNKNOWN || n == AREA_UNKNOWN ) {
+    return 0;
+  }
+
+  area->west  = w;
+  area->south = s;
+  area->east  = e;
+  area->north = n;
+  if ( name ) {
+    *name = nm;
+  }
+
+  return 1;
+}
+
+static double
+area_size (const rb_proj_area *area)
+{
+  double width = area->east - area->west;
+  if ( width < 0.0 ) {
+    width += 360.0;
+  }
+  return width * (area->north - area->south);
+}
+
+static int
+area_get_ref (PJ *ref, rb_proj_area *area, const char **name)
+{
+  PJ_LOG_LEVEL level;
+  PJ *crs;
+  rb_proj_area other;
+  int ok, k;
+
+  if ( name ) {
+    *name = NULL;
+  }
+
+  ok = area_of(ref, area, name);
+
+  if ( ! proj_is_crs(ref) ) {
+    level = proj_log_level(PJ_DEFAULT_CTX, PJ_LOG_TELL);
+    proj_log_level(PJ_DEFAULT_CTX, PJ_LOG_NONE);
+    for (k=0; k<2; k++) {
+      crs = ( k == 0 ) ? proj_get_source_crs(PJ_DEFAULT_CTX, ref)
+                       : proj_get_target_crs(PJ_DEFAULT_CTX, ref);
+      if ( ! crs ) {
+        continue;
+      }
+      if ( area_of(crs, &other, NULL) && ( ! ok || area_size(&other) < area_size(area) ) ) {
+        *area = other;
+        if ( name ) {
+          *name = NULL;
+        }
+        ok = 1;
+      }
+      proj_destroy(crs);
+    }
+    proj_log_level(PJ_DEFAULT_CTX, level);
+  }
+
+  return ok;
+}
+
+static int
+area_lat_first_ref (PJ *ref)
+{
+  PJ_LOG_LEVEL level;
+  PJ *crs, *next, *cs;
+  PJ_TYPE type;
+  const char *dir = NULL;
+  int lat_first = 0;
+
+  level = proj_log_level(PJ_DEFAULT_CTX, PJ_LOG_TELL);
+  proj_log_level(PJ_DEFAULT_CTX, PJ_LOG_NONE);
+
+  crs = proj_get_source_crs(PJ_DEFAULT_CTX, ref);
+  while ( crs ) {
+    type = proj_get_type(crs);
+    if ( type == PJ_TYPE_BOUND_CRS ) {
+      next = proj_get_source_crs(PJ_DEFAULT_CTX, crs);
+    }
+    else if ( type == PJ_TYPE_COMPOUND_CRS ) {
+      next = proj_crs_get_sub_crs(PJ_DEFAULT_CTX, crs, 0);
+    }
+    else {
+      break;
+    }
+    proj_destroy(crs);
+    crs = next;
+  }
+
+  if ( crs ) {
+    cs = proj_crs_get_coordinate_system(PJ_DEFAULT_CTX, crs);
+    if ( cs ) {
+      if ( proj_cs_get_axis_info(PJ_DEFAULT_CTX, cs, 0, NULL, NULL, &dir,
+                                 NULL, NULL, NULL, NULL) && dir ) {
+        lat_first = ( strcmp(dir, "north") == 0 || strcmp(dir, "south") == 0 );
+      }
+      proj_destroy(cs);
+    }
+    proj_destroy(crs);
+  }
+
+  proj_log_level(PJ_DEFAULT_CTX, level);
+
+  return lat_first;
+}
+
+/*
+Gets the area of use of the object (degrees). Returns 0 if unknown.
+The name is valid while the object lives (NULL if taken from the CRS or
+restored with the pipeline).
+*/
+int
+rb_proj_area_get (Proj *proj, rb_proj_area *area, const char **name)
+{
+  if ( proj->area_state ) {
+    if ( name ) {
+      *name = NULL;
+    }
+    *area = proj->area;
+    return ( proj->area_state == 2 );
+  }
+  return area_get_ref(proj->ref, area, name);
+}
+
+/*
+Returns 1 if the first axis of the source CRS of the operation is the
+latitude (e.g. EPSG:4326), or 0 if not or unknown.
+*/
+int
+rb_proj_area_lat_first (Proj *proj)
+{
+  if ( proj->area_state ) {
+    return proj->area_lat_first;
+  }
+  return area_lat_first_ref(proj->ref);
+}
+
+/*
+Sets mask[i] to 1 if (lon[i], lat[i]) is inside of the area, or 0 if not.
+The coordinates are in units of `unit` degrees (e.g. M_PI/180 for radians).
+Longitudes off by a turn are tested as well. The loops are branch-free so
+that they can be vectorized.
+*/
+void
+rb_proj_area_mask (const rb_proj_area *area, double unit,
+                   const double *lon, const double *lat, long n,
+                   unsigned char *mask)
+{
+  double w = area->west * unit, e = area->east * unit;
+  double s = area->south * unit, nn = area->north * unit;
+  double turn = 360.0 * unit, l;
+  long i;
+
+  if ( area->west <= area->east ) {
+    for (i=0; i<n; i++) {
+      l = lon[i];
+      mask[i] = ( lat[i] >= s ) & ( lat[i] <= nn ) &
+                ( ( ( l >= w ) & ( l <= e ) ) |
+                  ( ( l - turn >= w ) & ( l - turn <= e ) ) |
+                  ( ( l + turn >= w ) & ( l + turn <= e ) ) );
+    }
+  }
+  else {
+    /* crossing the antimeridian */
+    for (i=0; i<n; i++) {
+      l = lon[i];
+      mask[i] = ( lat[i] >= s ) & ( lat[i] <= nn ) &
+                ( ( ( l >= w ) & ( l <= e + turn ) ) |
+                  ( ( l + turn >= w ) & ( l <= e ) ) );
+    }
+  }
+}
+
+/*
+Gets the area of use of the object as [west, south, east, north, name]
+in degrees (west > east if the area crosses the antimeridian). For a
+transformation, the smallest one of the areas of the operation, the source
+CRS and the target CRS is returned (name is nil if taken from the CRS).
+
+@return [Array, nil] nil if unknown
+*/
+static VALUE
+rb_proj_area_of_use (VALUE self)
+{
+  Proj *proj;
+  rb_proj_area area;
+  const char *name;
+
+  proj = rb_proj_get_struct(self);
+
+  if ( ! rb_proj_area_get(proj, &area, &name) ) {
+    return Qnil;
+  }
+
+  return rb_ary_new3(5,
+                     rb_float_new(area.west),
+                     rb_float_new(area.south),
+                     rb_float_new(area.east),
+                     rb_float_new(area.north),
+                     name ? rb_str_new2(name) : Qnil);
+}
+
+/*
+Tests points against the area of use of the object.
+The result is a String of bytes, 1 for points inside of the area and 0 for
+the others, which can be passed to #forward_batch etc. as `mask`.
+All points are inside if the area of use is unknown.
+
+@overload within_area_of_use(lons, lats)
+  @param lons [String, CArray, Array] longitudes in degrees
+  @param lats [String, CArray, Array] latitudes in degrees
+
+@return [String] mask
+
+@example
+  mask = pj.within_area_of_use(lons, lats)
+  mask.count("\x01")   # number of points inside
+*/
+static VALUE
+rb_proj_within_area_of_use (VALUE self, VALUE vlons, VALUE vlats)
+{
+  volatile VALUE vmask;
+  Proj *proj;
+  rb_proj_area area;
+  rb_proj_buffer blon, blat;
+  long n;
+  int known;
+
+  proj = rb_proj_get_struct(self);
+
+  known = rb_proj_area_get(proj, &area, NULL);
+
+  rb_proj_buffer_get_pair(vlons, vlats, &blon, &blat);
+  n = ( blon.len < blat.len ) ? blon.len : blat.len;
+
+  vmask = rb_str_new(NULL, n);
+  if ( known ) {
+    rb_proj_area_mask(&area, 1.0, blon.ptr, blat.ptr, n, (unsigned char *) RSTRING_PTR(vmask));
+  }
+  else {
+    memset(RSTRING_PTR(vmask), 1, n);
+  }
+
+  rb_proj_buffer_release(&blon);
+  rb_proj_buffer_release(&blat);
+
+  return vmask;
+}
+
+/*
+Returns true if the first axis of the source CRS is the latitude.
+
+@private
+*/
+static VALUE
+rb_proj_area_lat_first_p (VALUE self)
+{
+  return rb_proj_area_lat_first(rb_proj_get_struct(self)) ? Qtrue : Qfalse;
+}
+
+/*
+Sets the area of use and the axis order of the source CRS of the object
+rebuilt from a pipeline.
+
+@private
+*/
+static VALUE
+rb_proj_set_area (VALUE self, VALUE varea, VALUE vlat_first)
+{
+  Proj *proj = rb_proj_get_struct(self);
+
+  if ( NIL_P(varea) ) {
+    proj->area_state = 1;
+  }
+  else {
+    varea = rb_Array(varea);
+    if ( RARRAY_LEN(varea) < 4 ) {
+      rb_raise(rb_eArgError, "area should be [west, south, east, north]");
+    }
+    proj->area.west  = NUM2DBL(RARRAY_AREF(varea, 0));
+    proj->area.south = NUM2DBL(RARRAY_AREF(varea, 1));
+    proj->area.east  = NUM2DBL(RARRAY_AREF(varea, 2));
+    proj->area.north = NUM2DBL(RARRAY_AREF(varea, 3));
+    proj->area_state = 2;
+  }
+  proj->area_lat_first = RTEST(vlat_first);
+
+  return Qnil;
+}
+
+void
+Init_simple_proj_area (void)
+{
+  rb_define_method(rb_mCommon, "area_of_use", rb_proj_area_of_use, 0);
+  rb_define_method(rb_mCommon, "within_area_of_use", rb_proj_within_area_of_use, 2);
+  rb_define_private_method(rb_cProj, "_area_lat_first?", rb_proj_area_lat_first_p, 0);
+  rb_define_private_method(rb_cProj, "_set_area", rb_proj_set_area, 2);
+}
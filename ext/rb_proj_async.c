@@ -0,0 +1,1156 @@
+#include "ruby.h"
+#include "rb_proj.h"
+
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <pthread.h>
+
+/*
+Asynchronous transformation on a native worker pool.
+
+Jobs are queued to a bounded pool of native threads, each holding its own
+PJ_CONTEXT. A job signals its completion by writing a byte into a pipe, and
+the read end is given to Ruby as an IO, so a fiber scheduler can wait on
+it (IO#wait_readable) without blocking the other fibers.
+
+Workers never touch Ruby objects. The input is copied at submission, and
+the PJ object is cloned into the context of the worker from a template
+(rb_proj_async_src) made once per PJ of the PROJ object. The clones are
+cached in each worker by the serial number of the template. An object
+constructed by a worker (PROJ.new_async) is moved by the worker to the
+context of the templates (pool.clone_ctx), and cloned from there into the
+default context when it is taken by the task. Objects in pool.clone_ctx
+are cloned and destroyed only under pool.clone_lock.
+
+The API is defined only with PROJ 8.2 or later, since proj_clone() fails
+for operations with several candidate operations (e.g. EPSG:4267 to
+EPSG:4269) in the earlier versions.
+*/
+
+#define ASYNC_MAX_THREADS       64
+#define ASYNC_DEFAULT_MAX_QUEUE 256
+#define ASYNC_CHUNK             4096
+#define ASYNC_CACHE             8
+
+enum {
+  ASYNC_TRANSFORM = 0,
+  ASYNC_CREATE
+};
+
+enum {
+  ASYNC_QUEUED = 0,
+  ASYNC_RUNNING,
+  ASYNC_DONE,
+  ASYNC_FAILED,
+  ASYNC_CANCELLED
+};
+
+/* template of PJ object for workers, guarded by pool.clone_lock */
+struct rb_proj_async_src {
+  long refs;
+  unsigned long serial;
+  PJ *pj;                 /* in pool.clone_ctx */
+};
+
+typedef struct async_job {
+  struct async_job *next;   /* in queue or running list */
+  struct async_job *prev;   /* in running list */
+  int kind;
+  int state;              /* guarded by pool.lock */
+  int refs;               /* guarded by pool.lock */
+  volatile int cancel;
+  int err;
+  int wfd;                /* write end of the pipe (-1 after notified) */
+  double t_submit, t_start, t_end;
+  /* ASYNC_TRANSFORM */
+  rb_proj_async_src *src;
+  PJ_DIRECTION direction;
+  double factor_out;
+  double *x, *y;
+  long len;
+  /* ASYNC_CREATE */
+  char *def1, *def2;
+  PJ *result;
+  int is_src_latlong;
+} async_job;
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  async_job *head, *tail;   /* queue */
+  async_job *active;        /* running jobs */
+  long queued, running, nthreads, target, max_queue, high_water;
+  unsigned long submitted, completed, failed, cancelled, ran;
+  double wait_sum, run_sum;
+  pthread_mutex_t clone_lock;
+  PJ_CONTEXT *clone_ctx;
+  unsigned long serial;
+} pool;
+
+void
+rb_proj_async_src_release (rb_proj_async_src *src)
+{
+  pthread_mutex_lock(&pool.clone_lock);
+  if ( --src->refs == 0 ) {
+    proj_destroy(src->pj);
+    free(src);
+  }
+  pthread_mutex_unlock(&pool.clone_lock);
+}
+
+/* proj_clone() of operations with several candidates requires PROJ 8.2 */
+#if PROJ_AT_LEAST_VERSION(8,2,0)
+
+static VALUE rb_cAsyncTask;
+static VALUE rb_eAsyncCancelled;
+
+static double
+async_now (void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* template of the PJ object of proj, made at the first use */
+static rb_proj_async_src *
+async_src_get (Proj *proj)
+{
+  rb_proj_async_src *src;
+
+  if ( ! proj->async_src ) {
+    src = calloc(1, sizeof(rb_proj_async_src));
+    if ( ! src ) {
+      rb_memerror();
+    }
+    pthread_mutex_lock(&pool.clone_lock);
+    if ( ! pool.clone_ctx ) {
+      pool.clone_ctx = proj_context_create();
+    }
+    src->pj = proj_clone(pool.clone_ctx, proj->ref);
+    src->serial = ++pool.serial;
+    src->refs = 1;
+    pthread_mutex_unlock(&pool.clone_lock);
+    if ( ! src->pj ) {
+      free(src);
+      rb_raise(rb_eRuntimeError, "failed to clone PJ object for async transformation");
+    }
+    proj->async_src = src;
+  }
+
+  src = proj->async_src;
+  pthread_mutex_lock(&pool.clone_lock);
+  src->refs++;
+  pthread_mutex_unlock(&pool.clone_lock);
+
+  return src;
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void
+async_job_free (async_job *job)
+{
+  if ( job->wfd >= 0 ) {
+    close(job->wfd);
+  }
+  if ( job->src ) {
+    rb_proj_async_src_release(job->src);
+  }
+  if ( job->result ) {
+    pthread_mutex_lock(&pool.clone_lock);
+    proj_destroy(job->result);
+    pthread_mutex_unlock(&pool.clone_lock);
+  }
+  free(job->x);
+  free(job->y);
+  free(job->def1);
+  free(job->def2);
+  free(job);
+}
+
+/* called with pool.lock held */
+static int
+async_job_unref_locked (async_job *job)
+{
+  return ( --job->refs == 0 );
+}
+
+/* called with pool.lock held */
+static void
+async_job_notify_locked (async_job *job)
+{
+  char c = 1;
+  if ( job->wfd >= 0 ) {
+    if ( write(job->wfd, &c, 1) < 0 ) {
+      /* the reader is gone */
+    }
+    close(job->wfd);
+    job->wfd = -1;
+  }
+}
+
+/*
+Cancels the job. A queued job is removed from the queue and finished here,
+a running job is flagged to stop. Returns 1 if the reference of the pool is
+the last one and the job should be freed. Called with pool.lock held.
+*/
+static int
+async_cancel_locked (async_job *job)
+{
+  async_job *p;
+
+  if ( job->state == ASYNC_RUNNING ) {
+    job->cancel = 1;
+    return 0;
+  }
+  if ( job->state != ASYNC_QUEUED ) {
+    return 0;
+  }
+
+  if ( pool.head == job ) {
+    pool.head = job->next;
+  }
+  else {
+    for (p=pool.head; p && p->next != job; p=p->next)
+      ;
+    if ( p ) {
+      p->next = job->next;
+    }
+  }
+  if ( pool.tail == job ) {
+    for (p=pool.head; p && p->next; p=p->next)
+      ;
+    pool.tail = p;
+  }
+  job->next = NULL;
+  pool.queued--;
+  pool.cancelled++;
+  job->cancel = 1;
+  job->state = ASYNC_CANCELLED;
+  async_job_notify_locked(job);
+
+  return async_job_unref_locked(job);
+}
+
+/* ---------------------------------------------------------------------- */
+
+typedef struct {
+  unsigned long serial;
+  PJ *pj;
+  unsigned long stamp;
+} async_cache_entry;
+
+static PJ *
+async_worker_pj (PJ_CONTEXT *ctx, async_cache_entry *cache, unsigned long *stamp,
+                 rb_proj_async_src *src)
+{
+  int i, k = 0;
+
+  for (i=0; i<ASYNC_CACHE; i++) {
+    if ( cache[i].pj && cache[i].serial == src->serial ) {
+      cache[i].stamp = ++(*stamp);
+      return cache[i].pj;
+    }
+    if ( cache[i].stamp < cache[k].stamp ) {
+      k = i;
+    }
+  }
+
+  if ( cache[k].pj ) {
+    proj_destroy(cache[k].pj);
+  }
+
+  pthread_mutex_lock(&pool.clone_lock);
+  cache[k].pj = proj_clone(ctx, src->pj);
+  pthread_mutex_unlock(&pool.clone_lock);
+  cache[k].serial = src->serial;
+  cache[k].stamp  = ++(*stamp);
+
+  return cache[k].pj;
+}
+
+static int
+async_run_transform (async_job *job, PJ *pj)
+{
+  double *x, *y;
+  long i, j, m;
+
+  for (i=0; i<job->len; i+=ASYNC_CHUNK) {
+    if ( job->cancel ) {
+      return ASYNC_CANCELLED;
+    }
+    m = ( job->len - i < ASYNC_CHUNK ) ? job->len - i : ASYNC_CHUNK;
+    x = job->x + i;
+    y = job->y + i;
+    proj_trans_generic(pj, job->direction,
+                       x, sizeof(double), m,
+                       y, sizeof(double), m,
+                       NULL, 0, 0, NULL, 0, 0);
+    for (j=0; j<m; j++) {
+      if ( x[j] == HUGE_VAL || y[j] == HUGE_VAL ) {
+        x[j] = y[j] = NAN;
+      }
+      else {
+        x[j] *= job->factor_out;
+        y[j] *= job->factor_out;
+      }
+    }
+  }
+
+  return ASYNC_DONE;
+}
+
+static void *
+async_worker_main (void *arg)
+{
+  PJ_CONTEXT *ctx;
+  async_cache_entry cache[ASYNC_CACHE];
+  unsigned long stamp = 0;
+  async_job *job;
+  PJ *pj;
+  int state, err, i, do_free;
+
+  ctx = proj_context_create();
+  memset(cache, 0, sizeof(cache));
+
+  pthread_mutex_lock(&pool.lock);
+  for (;;) {
+    while ( ! pool.head && pool.nthreads <= pool.target ) {
+      pthread_cond_wait(&pool.cond, &pool.lock);
+    }
+    if ( pool.nthreads > pool.target ) {
+      pool.nthreads--;
+      break;
+    }
+
+    job = pool.head;
+    pool.head = job->next;
+    if ( ! pool.head ) {
+      pool.tail = NULL;
+    }
+    job->next = pool.active;
+    job->prev = NULL;
+    if ( pool.active ) {
+      pool.active->prev = job;
+    }
+    pool.active = job;
+    pool.queued--;
+    pool.running++;
+    job->state = ASYNC_RUNNING;
+    job->t_start = async_now();
+    pthread_mutex_unlock(&pool.lock);
+
+    err = 0;
+    if ( job->kind == ASYNC_TRANSFORM ) {
+      pj = async_worker_pj(ctx, cache, &stamp, job->src);
+      if ( pj ) {
+        state = async_run_transform(job, pj);
+      }
+      else {
+        err = proj_context_errno(ctx);
+        state = ASYNC_FAILED;
+      }
+    }
+    else {
+      pj = rb_proj_create_ref(ctx, job->def1, job->def2, &job->is_src_latlong);
+      if ( pj ) {
+        /* the context of the worker dies with the worker, so the object is
+           moved to pool.clone_ctx before it is handed to the task */
+        pthread_mutex_lock(&pool.clone_lock);
+        if ( ! pool.clone_ctx ) {
+          pool.clone_ctx = proj_context_create();
+        }
+        job->result = proj_clone(pool.clone_ctx, pj);
+        if ( ! job->result ) {
+          err = proj_context_errno(pool.clone_ctx);
+        }
+        pthread_mutex_unlock(&pool.clone_lock);
+        proj_destroy(pj);
+      }
+      else {
+        err = proj_context_errno(ctx);
+      }
+      if ( job->result ) {
+        state = ( job->cancel ) ? ASYNC_CANCELLED : ASYNC_DONE;
+      }
+      else {
+        state = ASYNC_FAILED;
+      }
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    if ( job->prev ) {
+      job->prev->next = job->next;
+    }
+    else {
+      pool.active = job->next;
+    }
+    if ( job->next ) {
+      job->next->prev = job->prev;
+    }
+    job->next = job->prev = NULL;
+    job->t_end = async_now();
+    job->state = state;
+    job->err = err;
+    pool.running--;
+    pool.ran++;
+    pool.wait_sum += job->t_start - job->t_submit;
+    pool.run_sum  += job->t_end - job->t_start;
+    switch ( state ) {
+    case ASYNC_DONE:      pool.completed++; break;
+    case ASYNC_FAILED:    pool.failed++;    break;
+    default:              pool.cancelled++; break;
+    }
+    async_job_notify_locked(job);
+    do_free = async_job_unref_locked(job);
+    pthread_mutex_unlock(&pool.lock);
+    if ( do_free ) {
+      async_job_free(job);
+    }
+    pthread_mutex_lock(&pool.lock);
+  }
+  pthread_mutex_unlock(&pool.lock);
+
+  for (i=0; i<ASYNC_CACHE; i++) {
+    if ( cache[i].pj ) {
+      proj_destroy(cache[i].pj);
+    }
+  }
+  proj_context_destroy(ctx);
+
+  return NULL;
+}
+
+/* called with pool.lock held */
+static void
+async_spawn_locked (void)
+{
+  pthread_t th;
+  pthread_attr_t attr;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  while ( pool.nthreads < pool.target ) {
+    if ( pthread_create(&th, &attr, async_worker_main, NULL) != 0 ) {
+      break;
+    }
+    pool.nthreads++;
+  }
+  pthread_attr_destroy(&attr);
+}
+
+static void
+async_atfork_prepare (void)
+{
+  pthread_mutex_lock(&pool.clone_lock);
+  pthread_mutex_lock(&pool.lock);
+}
+
+static void
+async_atfork_parent (void)
+{
+  pthread_mutex_unlock(&pool.lock);
+  pthread_mutex_unlock(&pool.clone_lock);
+}
+
+static void
+async_atfork_child (void)
+{
+  async_job *job, *next;
+  int k;
+
+  /* the workers don't exist in the child process, so the pending jobs are
+     cancelled (the memory of the running ones is left to the tasks). The
+     pipes are shared with the parent, whose tasks are still waiting on
+     them, so the write ends are only closed here and nothing is written. */
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.cond, NULL);
+  pthread_mutex_init(&pool.clone_lock, NULL);
+  for (k=0; k<2; k++) {
+    for (job=( k == 0 ) ? pool.head : pool.active; job; job=next) {
+      next = job->next;
+      job->next = job->prev = NULL;
+      job->cancel = 1;
+      job->state = ASYNC_CANCELLED;
+      if ( job->wfd >= 0 ) {
+        close(job->wfd);
+        job->wfd = -1;
+      }
+      pool.cancelled++;
+      if ( async_job_unref_locked(job) ) {
+        async_job_free(job);
+      }
+    }
+  }
+  pool.head     = NULL;
+  pool.tail     = NULL;
+  pool.active   = NULL;
+  pool.queued   = 0;
+  pool.nthreads = 0;
+  pool.running  = 0;
+}
+
+/* ---------------------------------------------------------------------- */
+
+typedef struct {
+  async_job *job;
+  VALUE io;
+  VALUE result;
+} AsyncTask;
+
+static void
+task_mark (void *ptr)
+{
+  AsyncTask *task = ptr;
+  rb_gc_mark_movable(task->io);
+  rb_gc_mark_movable(task->result);
+}
+
+static void
+task_compact (void *ptr)
+{
+  AsyncTask *task = ptr;
+  task->io     = rb_gc_location(task->io);
+  task->result = rb_gc_location(task->result);
+}
+
+static void
+task_release_job (AsyncTask *task)
+{
+  async_job *job = task->job;
+  int do_free;
+
+  if ( ! job ) {
+    return;
+  }
+  task->job = NULL;
+
+  pthread_mutex_lock(&pool.lock);
+  do_free  = async_cancel_locked(job);
+  do_free |= async_job_unref_locked(job);
+  pthread_mutex_unlock(&pool.lock);
+  if ( do_free ) {
+    async_job_free(job);
+  }
+}
+
+static void
+task_free (void *ptr)
+{
+  AsyncTask *task = ptr;
+  task_release_job(task);
+  free(task);
+}
+
+static size_t
+task_memsize (const void *ptr)
+{
+  const AsyncTask *task = ptr;
+  size_t size = sizeof(AsyncTask);
+  if ( task->job ) {
+    size += sizeof(async_job) + 2 * task->job->len * sizeof(double);
+  }
+  return size;
+}
+
+static const rb_data_type_t task_data_type = {
+    .wrap_struct_name = "ProjAsyncTask",
+    .function = {
+        .dmark = task_mark,
+        .dfree = task_free,
+        .dsize = task_memsize,
+        .dcompact = task_compact,
+    },
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+static VALUE
+task_new (async_job *job, int rfd)
+{
+  volatile VALUE vtask;
+  AsyncTask *task;
+
+  vtask = TypedData_Make_Struct(rb_cAsyncTask, AsyncTask, &task_data_type, task);
+  task->io = Qnil;
+  task->result = Qnil;
+  task->job = job;
+  RB_OBJ_WRITE(vtask, &task->io,
+               rb_funcall(rb_cIO, rb_intern("for_fd"), 2, INT2NUM(rfd),
+                          rb_str_new2("rb")));
+
+  return vtask;
+}
+
+/*
+Queues the job. The job is freed and an error is raised if the queue is full.
+*/
+static VALUE
+async_submit (async_job *job)
+{
+  int fds[2];
+
+  if ( pipe(fds) != 0 ) {
+    async_job_free(job);
+    rb_sys_fail("pipe");
+  }
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  job->wfd  = fds[1];
+  job->refs = 2;          /* task and pool */
+  job->state = ASYNC_QUEUED;
+  job->t_submit = async_now();
+
+  pthread_mutex_lock(&pool.lock);
+  if ( pool.queued >= pool.max_queue ) {
+    pthread_mutex_unlock(&pool.lock);
+    close(fds[0]);
+    async_job_free(job);
+    rb_raise(rb_eRuntimeError, "async queue is full (max_queue: %ld)", pool.max_queue);
+  }
+  if ( pool.tail ) {
+    pool.tail->next = job;
+  }
+  else {
+    pool.head = job;
+  }
+  pool.tail = job;
+  pool.queued++;
+  pool.submitted++;
+  if ( pool.queued > pool.high_water ) {
+    pool.high_water = pool.queued;
+  }
+  async_spawn_locked();
+  if ( pool.nthreads == 0 ) {
+    /* no task is made, so both references are dropped here */
+    async_cancel_locked(job);
+    pool.submitted--;
+    pool.cancelled--;
+    pthread_mutex_unlock(&pool.lock);
+    close(fds[0]);
+    async_job_free(job);
+    rb_raise(rb_eRuntimeError, "failed to start async worker");
+  }
+  pthread_cond_signal(&pool.cond);
+  pthread_mutex_unlock(&pool.lock);
+
+  return task_new(job, fds[0]);
+}
+
+static async_job *
+async_job_new (int kind)
+{
+  async_job *job = calloc(1, sizeof(async_job));
+  if ( ! job ) {
+    rb_memerror();
+  }
+  job->kind = kind;
+  job->wfd = -1;
+  return job;
+}
+
+static long
+async_length (VALUE vbuf)
+{
+  rb_proj_typed_buffer t;
+  long len;
+
+  rb_proj_typed_buffer_get(vbuf, &t, 0);
+  len = t.len;
+  rb_proj_typed_buffer_release(&t);
+
+  return len;
+}
+
+enum {
+  ASYNC_MODE_FORWARD = 0,
+  ASYNC_MODE_INVERSE,
+  ASYNC_MODE_TRANSFORM
+};
+
+static VALUE
+rb_proj_async_i (int argc, VALUE *argv, VALUE self, int mode)
+{
+  volatile VALUE vxs, vys, vopts;
+  ID kw_ids[1];
+  VALUE kw_vals[1];
+  rb_proj_typed_buffer t;
+  async_job *job;
+  Proj *proj;
+  PJ_DIRECTION direction = PJ_FWD;
+  double factor_in = 1.0;
+  int in_ang = 0, out_ang = 0;
+  long n, ny;
+
+  rb_scan_args(argc, argv, "2:", (VALUE *)&vxs, (VALUE *)&vys, (VALUE *)&vopts);
+
+  proj = rb_proj_get_struct(self);
+
+  kw_ids[0] = rb_intern("direction");
+  rb_get_kwargs(vopts, kw_ids, 0, ( mode == ASYNC_MODE_TRANSFORM ) ? 1 : 0, kw_vals);
+
+  switch ( mode ) {
+  case ASYNC_MODE_FORWARD:
+    if ( ! proj->forward ) {
+      rb_raise(rb_eRuntimeError, "requires latlong src crs. use #transform_async instead of #forward_async.");
+    }
+    break;
+  case ASYNC_MODE_INVERSE:
+    direction = PJ_INV;
+    if ( ! proj->inverse ) {
+      rb_raise(rb_eRuntimeError, "requires latlong src crs. use #transform_async instead of #inverse_async.");
+    }
+    break;
+  default:
+    if ( kw_vals[0] != Qundef && ! NIL_P(kw_vals[0]) ) {
+      if ( rb_to_id(kw_vals[0]) == id_inverse ) {
+        direction = PJ_INV;
+      }
+      else if ( rb_to_id(kw_vals[0]) != id_forward ) {
+        rb_raise(rb_eArgError, "invalid direction");
+      }
+    }
+    break;
+  }
+
+  /* units follow #forward and #inverse */
+  if ( mode != ASYNC_MODE_TRANSFORM ) {
+    in_ang  = ( proj_angular_input(proj->ref, direction) == 1 );
+    out_ang = ( proj_angular_output(proj->ref, direction) == 1 );
+  }
+  factor_in = ( in_ang ) ? M_PI / 180.0 : 1.0;
+
+  n  = async_length(vxs);
+  ny = async_length(vys);
+  if ( ny < n ) {
+    n = ny;
+  }
+
+  job = async_job_new(ASYNC_TRANSFORM);
+  job->direction  = direction;
+  job->factor_out = ( out_ang ) ? 180.0 / M_PI : 1.0;
+  job->len = n;
+  job->x = malloc((n > 0 ? n : 1) * sizeof(double));
+  job->y = malloc((n > 0 ? n : 1) * sizeof(double));
+  if ( ! job->x || ! job->y ) {
+    async_job_free(job);
+    rb_memerror();
+  }
+
+  rb_proj_typed_buffer_get(vxs, &t, 0);
+  rb_proj_typed_buffer_read(&t, 0, n, factor_in, job->x);
+  rb_proj_typed_buffer_release(&t);
+  rb_proj_typed_buffer_get(vys, &t, 0);
+  rb_proj_typed_buffer_read(&t, 0, n, factor_in, job->y);
+  rb_proj_typed_buffer_release(&t);
+
+  job->src = async_src_get(proj);
+
+  return async_submit(job);
+}
+
+/*
+Transforms coordinate buffers as #forward_batch does on the worker pool,
+without blocking the calling thread (or fiber). The input is copied at the
+call. The result [xbuf, ybuf] is given by PROJ::AsyncTask#value.
+
+@overload forward_async(lons, lats)
+  @param lons [String, Object, Array, PROJ::Buffer]
+  @param lats [String, Object, Array, PROJ::Buffer]
+
+@return [PROJ::AsyncTask]
+
+@example
+  task = pj.forward_async(lons, lats)
+  x, y = task.value
+*/
+static VALUE
+rb_proj_forward_async (int argc, VALUE *argv, VALUE self)
+{
+  return rb_proj_async_i(argc, argv, self, ASYNC_MODE_FORWARD);
+}
+
+/*
+Transforms coordinate buffers as #inverse_batch does on the worker pool.
+See #forward_async.
+
+@overload inverse_async(xs, ys)
+
+@return [PROJ::AsyncTask]
+*/
+static VALUE
+rb_proj_inverse_async (int argc, VALUE *argv, VALUE self)
+{
+  return rb_proj_async_i(argc, argv, self, ASYNC_MODE_INVERSE);
+}
+
+/*
+Transforms coordinate buffers as #transform_batch does on the worker pool.
+See #forward_async.
+
+@overload transform_async(xs, ys, direction: :forward)
+
+@return [PROJ::AsyncTask]
+*/
+static VALUE
+rb_proj_transform_async (int argc, VALUE *argv, VALUE self)
+{
+  return rb_proj_async_i(argc, argv, self, ASYNC_MODE_TRANSFORM);
+}
+
+/*
+Constructs a PROJ object from definition strings as PROJ.new does on the
+worker pool. The object is given by PROJ::AsyncTask#value. The persistent
+pipeline cache is not used.
+
+@overload new_async(def1, def2 = nil)
+  @param def1 [String]
+  @param def2 [String, nil]
+
+@return [PROJ::AsyncTask]
+
+@example
+  task = PROJ.new_async("EPSG:4267", "EPSG:4269")
+  pj = task.value
+*/
+static VALUE
+rb_proj_s_new_async (int argc, VALUE *argv, VALUE klass)
+{
+  VALUE vdef1, vdef2;
+  async_job *job;
+
+  rb_scan_args(argc, argv, "11", &vdef1, &vdef2);
+
+  Check_Type(vdef1, T_STRING);
+  if ( ! NIL_P(vdef2) ) {
+    Check_Type(vdef2, T_STRING);
+  }
+
+  job = async_job_new(ASYNC_CREATE);
+  job->def1 = strdup(StringValueCStr(vdef1));
+  job->def2 = NIL_P(vdef2) ? NULL : strdup(StringValueCStr(vdef2));
+  if ( ! job->def1 || ( ! NIL_P(vdef2) && ! job->def2 ) ) {
+    async_job_free(job);
+    rb_memerror();
+  }
+
+  return async_submit(job);
+}
+
+/* ---------------------------------------------------------------------- */
+
+static AsyncTask *
+task_get (VALUE self)
+{
+  AsyncTask *task;
+  TypedData_Get_Struct(self, AsyncTask, &task_data_type, task);
+  return task;
+}
+
+static int
+task_state (AsyncTask *task)
+{
+  int state;
+
+  if ( ! task->job ) {
+    return ASYNC_DONE;
+  }
+  pthread_mutex_lock(&pool.lock);
+  state = task->job->state;
+  pthread_mutex_unlock(&pool.lock);
+
+  return state;
+}
+
+/*
+Returns the state of the task (:queued, :running, :done, :failed or
+:cancelled).
+
+@return [Symbol]
+*/
+static VALUE
+rb_task_state (VALUE self)
+{
+  const char *name;
+
+  switch ( task_state(task_get(self)) ) {
+  case ASYNC_QUEUED:  name = "queued";    break;
+  case ASYNC_RUNNING: name = "running";   break;
+  case ASYNC_DONE:    name = "done";      break;
+  case ASYNC_FAILED:  name = "failed";    break;
+  default:            name = "cancelled"; break;
+  }
+
+  return ID2SYM(rb_intern(name));
+}
+
+/*
+Returns true if the task is finished (done, failed or cancelled).
+
+@return [Boolean]
+*/
+static VALUE
+rb_task_done_p (VALUE self)
+{
+  return ( task_state(task_get(self)) >= ASYNC_DONE ) ? Qtrue : Qfalse;
+}
+
+/*
+Returns the IO which becomes readable when the task is finished.
+
+@return [IO]
+*/
+static VALUE
+rb_task_io (VALUE self)
+{
+  return task_get(self)->io;
+}
+
+/*
+Cancels the task. A queued task is removed from the queue, and a running
+transformation stops at the next chunk. The construction by new_async
+can't be stopped, and the result is discarded.
+
+@return [Boolean] false if the task is already finished
+*/
+static VALUE
+rb_task_cancel (VALUE self)
+{
+  AsyncTask *task = task_get(self);
+  async_job *job = task->job;
+  int ret, do_free;
+
+  if ( ! job ) {
+    return Qfalse;
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  ret = ( job->state == ASYNC_QUEUED || job->state == ASYNC_RUNNING );
+  do_free = async_cancel_locked(job);
+  pthread_mutex_unlock(&pool.lock);
+
+  if ( do_free ) {
+    async_job_free(job);
+  }
+
+  return ret ? Qtrue : Qfalse;
+}
+
+/*
+Returns the result of the finished task. Raises RuntimeError if failed, or
+PROJ::AsyncTask::Cancelled if cancelled.
+
+@private
+*/
+static VALUE
+rb_task_result (VALUE self)
+{
+  AsyncTask *task = task_get(self);
+  async_job *job = task->job;
+  volatile VALUE vx, vy, vobj;
+  double *px, *py;
+  Proj *proj;
+  PJ *ref;
+  int state;
+
+  if ( ! job ) {
+    return task->result;
+  }
+
+  state = task_state(task);
+  switch ( state ) {
+  case ASYNC_QUEUED:
+  case ASYNC_RUNNING:
+    rb_raise(rb_eRuntimeError, "task is not finished");
+  case ASYNC_FAILED:
+    rb_raise(rb_eRuntimeError, "%s", proj_errno_string(job->err));
+  case ASYNC_CANCELLED:
+    rb_raise(rb_eAsyncCancelled, "task was cancelled");
+  default:
+    break;
+  }
+
+  if ( job->kind == ASYNC_TRANSFORM ) {
+    vx = rb_proj_buffer_new(job->len, &px);
+    vy = rb_proj_buffer_new(job->len, &py);
+    memcpy(px, job->x, job->len * sizeof(double));
+    memcpy(py, job->y, job->len * sizeof(double));
+    RB_OBJ_WRITE(self, &task->result, rb_assoc_new(vx, vy));
+  }
+  else {
+    /* moves the object built by the worker into the default context */
+    pthread_mutex_lock(&pool.clone_lock);
+    ref = proj_clone(PJ_DEFAULT_CTX, job->result);
+    pthread_mutex_unlock(&pool.clone_lock);
+    if ( ! ref ) {
+      rb_raise(rb_eRuntimeError, "%s", proj_errno_string(proj_context_errno(PJ_DEFAULT_CTX)));
+    }
+    vobj = rb_obj_alloc(rb_cProj);
+    TypedData_Get_Struct(vobj, Proj, &proj_data_type, proj);
+    rb_proj_set_ref(proj, ref);
+    proj->is_src_latlong = job->is_src_latlong;
+    rb_proj_setup_dispatch(proj);
+    RB_OBJ_WRITE(self, &task->result, vobj);
+  }
+
+  task_release_job(task);
+
+  return task->result;
+}
+
+/*
+Configures the worker pool. The number of threads can be changed at any
+time (surplus workers exit when idle).
+
+@overload configure_async(threads: nil, max_queue: nil)
+  @param threads [Integer, nil] number of worker threads (1..64)
+  @param max_queue [Integer, nil] maximum number of queued tasks. Each
+    unfinished task holds two file descriptors (a pipe), and a finished
+    one holds one until #value returns or the task is collected.
+
+@return [nil]
+*/
+static VALUE
+rb_proj_s_configure_async (int argc, VALUE *argv, VALUE klass)
+{
+  VALUE vopts;
+  ID kw_ids[2];
+  VALUE kw_vals[2];
+  long threads = -1, max_queue = -1;
+
+  rb_scan_args(argc, argv, "0:", &vopts);
+
+  kw_ids[0] = rb_intern("threads");
+  kw_ids[1] = rb_intern("max_queue");
+  rb_get_kwargs(vopts, kw_ids, 0, 2, kw_vals);
+
+  if ( kw_vals[0] != Qundef && ! NIL_P(kw_vals[0]) ) {
+    threads = NUM2LONG(kw_vals[0]);
+    if ( threads < 1 || threads > ASYNC_MAX_THREADS ) {
+      rb_raise(rb_eArgError, "threads should be in 1..%d", ASYNC_MAX_THREADS);
+    }
+  }
+  if ( kw_vals[1] != Qundef && ! NIL_P(kw_vals[1]) ) {
+    max_queue = NUM2LONG(kw_vals[1]);
+    if ( max_queue < 1 ) {
+      rb_raise(rb_eArgError, "max_queue should be positive");
+    }
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  if ( threads > 0 ) {
+    pool.target = threads;
+    if ( pool.nthreads > 0 ) {
+      async_spawn_locked();
+    }
+    pthread_cond_broadcast(&pool.cond);
+  }
+  if ( max_queue > 0 ) {
+    pool.max_queue = max_queue;
+  }
+  pthread_mutex_unlock(&pool.lock);
+
+  return Qnil;
+}
+
+/*
+Returns the metrics of the worker pool.
+
+@return [Hash] {threads:, max_threads:, max_queue:, queued:, running:,
+  high_water:, submitted:, completed:, failed:, cancelled:,
+  mean_wait:, mean_run:} (mean times in the queue and in the worker for the
+  tasks taken by the workers, in seconds)
+*/
+static VALUE
+rb_proj_s_async_stats (VALUE klass)
+{
+  VALUE vstats = rb_hash_new();
+  long threads, target, max_queue, queued, running, high_water;
+  unsigned long submitted, completed, failed, cancelled, ran;
+  double wait_sum, run_sum;
+
+  pthread_mutex_lock(&pool.lock);
+  threads    = pool.nthreads;
+  target     = pool.target;
+  max_queue  = pool.max_queue;
+  queued     = pool.queued;
+  running    = pool.running;
+  high_water = pool.high_water;
+  submitted  = pool.submitted;
+  completed  = pool.completed;
+  failed     = pool.failed;
+  cancelled  = pool.cancelled;
+  wait_sum   = pool.wait_sum;
+  run_sum    = pool.run_sum;
+  ran        = pool.ran;
+  pthread_mutex_unlock(&pool.lock);
+
+  rb_hash_aset(vstats, ID2SYM(rb_intern("threads")), LONG2NUM(threads));
+  rb_hash_aset(vstats, ID2SYM(rb_intern("max_threads")), LONG2NUM(target));
+  rb_hash_aset(vstats, ID2SYM(rb_intern("max_queue")), LONG2NUM(max_queue));
+  rb_hash_aset(vstats, ID2SYM(rb_intern("queued")), LONG2NUM(queued));
+  rb_hash_aset(vstats, ID2SYM(rb_intern("running")), LONG2NUM(running));
+  rb_hash_aset(vstats, ID2SYM(rb_intern("high_water")), LONG2NUM(high_water));
+  rb_hash_aset(vstats, ID2SYM(rb_intern("submitted")), ULONG2NUM(submitted));
+  rb_hash_aset(vstats, ID2SYM(rb_intern("completed")), ULONG2NUM(completed));
+  rb_hash_aset(vstats, ID2SYM(rb_intern("failed")), ULONG2NUM(failed));
+  rb_hash_aset(vstats, ID2SYM(rb_intern("cancelled")), ULONG2NUM(cancelled));
+  rb_hash_aset(vstats, ID2SYM(rb_intern("mean_wait")),
+               rb_float_new(ran ? wait_sum / ran : 0.0));
+  rb_hash_aset(vstats, ID2SYM(rb_intern("mean_run")),
+               rb_float_new(ran ? run_sum / ran : 0.0));
+
+  return vstats;
+}
+
+#endif
+
+void
+Init_simple_proj_async (void)
+{
+#if PROJ_AT_LEAST_VERSION(8,2,0)
+  long ncpu;
+  struct rlimit nofile;
+#endif
+
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.cond, NULL);
+  pthread_mutex_init(&pool.clone_lock, NULL);
+
+#if PROJ_AT_LEAST_VERSION(8,2,0)
+  pthread_atfork(async_atfork_prepare, async_atfork_parent, async_atfork_child);
+
+  ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  /* at least 2 so that a large job doesn't hold up all the others */
+  pool.target    = ( ncpu < 2 ) ? 2 : ( ncpu > 8 ) ? 8 : ncpu;
+  /* keep the pipes of a full queue within a quarter of the fd limit */
+  pool.max_queue = ASYNC_DEFAULT_MAX_QUEUE;
+  if ( getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur != RLIM_INFINITY &&
+       (rlim_t) pool.max_queue * 8 > nofile.rlim_cur ) {
+    pool.max_queue = ( nofile.rlim_cur / 8 > 0 ) ? (long) ( nofile.rlim_cur / 8 ) : 1;
+  }
+
+  rb_cAsyncTask = rb_define_class_under(rb_cProj, "AsyncTask", rb_cObject);
+  rb_undef_alloc_func(rb_cAsyncTask);
+  rb_eAsyncCancelled = rb_define_class_under(rb_cAsyncTask, "Cancelled", rb_eRuntimeError);
+
+  rb_define_method(rb_cProj, "forward_async", rb_proj_forward_async, -1);
+  rb_define_method(rb_cProj, "inverse_async", rb_proj_inverse_async, -1);
+  rb_define_method(rb_cProj, "transform_async", rb_proj_transform_async, -1);
+  rb_define_singleton_method(rb_cProj, "new_async", rb_proj_s_new_async, -1);
+  rb_define_singleton_method(rb_cProj, "configure_async", rb_proj_s_configure_async, -1);
+  rb_define_singleton_method(rb_cProj, "async_stats", rb_proj_s_async_stats, 0);
+
+  rb_define_method(rb_cAsyncTask, "state", rb_task_state, 0);
+  rb_define_method(rb_cAsyncTask, "done?", rb_task_done_p, 0);
+  rb_define_method(rb_cAsyncTask, "io", rb_task_io, 0);
+  rb_define_method(rb_cAsyncTask, "cancel", rb_task_cancel, 0);
+  rb_define_method(rb_cAsyncTask, "_result", rb_task_result, 0);
+#endif
+}
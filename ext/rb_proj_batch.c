@@ -0,0 +1,446 @@
+#include "ruby.h"
+#include "rb_proj.h"
+
+#include <math.h>
+#include <string.h>
+
+/*
+Batch transformation of coordinate buffers.
+
+The input is read by chunks of BATCH_CHUNK elements into doubles (widening,
+scaling and the conversion into radians are done in one pass), transformed by
+proj_trans_generic, and written into the output (conversion into degrees,
+scaling and narrowing in one pass), so no full double copy is made for
+typed buffers (PROJ::Buffer).
+*/
+
+#define BATCH_CHUNK 1024
+
+#define BATCH_DEG_TO_RAD (M_PI / 180.0)
+#define BATCH_RAD_TO_DEG (180.0 / M_PI)
+
+enum {
+  BATCH_FORWARD = 0,
+  BATCH_INVERSE,
+  BATCH_TRANSFORM
+};
+
+typedef struct {
+  Proj *proj;
+  PJ_DIRECTION direction;
+  double factor_in, factor_out;
+  VALUE vin[2], vout[2];
+  rb_proj_typed_buffer in[2], out[2];
+  long len;
+  const unsigned char *mask;   /* points to skip are 0 (or NULL) */
+  int use_area;                /* mask by the area of use */
+  int area_lat_first;          /* inputs are (lat, lon) for the area */
+  rb_proj_area area;
+} batch_args;
+
+/*
+Transforms the chunk through the result cache. Only the points not found
+in the cache are passed to proj_trans_generic.
+*/
+static void
+batch_trans_cached (batch_args *a, double *x, double *y, long m)
+{
+  rb_proj_memo *memo = a->proj->memo;
+  unsigned int tag;
+  double mx[BATCH_CHUNK], my[BATCH_CHUNK], in[3], out[3];
+  long miss[BATCH_CHUNK], nmiss = 0, j, k;
+  int err;
+
+  tag = ( a->direction == PJ_FWD ) ? RB_PROJ_MEMO_TAG_BATCH_FWD : RB_PROJ_MEMO_TAG_BATCH_INV;
+
+  in[2] = 0.0;
+  for (j=0; j<m; j++) {
+    in[0] = x[j];
+    in[1] = y[j];
+    if ( rb_proj_memo_lookup(memo, tag, in, out, &err) ) {
+      x[j] = out[0];
+      y[j] = out[1];
+    }
+    else {
+      miss[nmiss] = j;
+      mx[nmiss] = x[j];
+      my[nmiss] = y[j];
+      nmiss++;
+    }
+  }
+
+  if ( nmiss == 0 ) {
+    return;
+  }
+
+  proj_trans_generic(a->proj->ref, a->direction,
+                     mx, sizeof(double), nmiss,
+                     my, sizeof(double), nmiss,
+                     NULL, 0, 0, NULL, 0, 0);
+
+  out[2] = 0.0;
+  for (k=0; k<nmiss; k++) {
+    j = miss[k];
+    in[0] = x[j];
+    in[1] = y[j];
+    out[0] = x[j] = mx[k];
+    out[1] = y[j] = my[k];
+    rb_proj_memo_store(memo, tag, in, out, ( mx[k] == HUGE_VAL || my[k] == HUGE_VAL ) ? 0 : -1);
+  }
+}
+
+static void
+batch_trans (batch_args *a, double *x, double *y, long m)
+{
+  if ( a->proj->memo ) {
+    batch_trans_cached(a, x, y, m);
+  }
+  else {
+    proj_trans_generic(a->proj->ref, a->direction,
+                       x, sizeof(double), m,
+                       y, sizeof(double), m,
+                       NULL, 0, 0, NULL, 0, 0);
+  }
+}
+
+/*
+Transforms only the points of the chunk selected by the mask.
+The others give HUGE_VAL without calling PROJ.
+*/
+static void
+batch_trans_masked (batch_args *a, double *x, double *y, long m,
+                    const unsigned char *mask)
+{
+  double cx[BATCH_CHUNK], cy[BATCH_CHUNK];
+  long idx[BATCH_CHUNK], j, k, nsel = 0;
+
+  for (j=0; j<m; j++) {
+    if ( mask[j] ) {
+      idx[nsel] = j;
+      cx[nsel] = x[j];
+      cy[nsel] = y[j];
+      nsel++;
+    }
+    x[j] = y[j] = HUGE_VAL;
+  }
+
+  if ( nsel == 0 ) {
+    return;
+  }
+
+  batch_trans(a, cx, cy, nsel);
+
+  for (k=0; k<nsel; k++) {
+    x[idx[k]] = cx[k];
+    y[idx[k]] = cy[k];
+  }
+}
+
+/* the buffers are taken here, so that batch_release releases them */
+static VALUE
+batch_run (VALUE arg)
+{
+  batch_args *a = (batch_args *) arg;
+  double x[BATCH_CHUNK], y[BATCH_CHUNK];
+  unsigned char mask[BATCH_CHUNK];
+  long i, j, m;
+
+  rb_proj_typed_buffer_get(a->vin[0], &a->in[0], 0);
+  rb_proj_typed_buffer_get(a->vin[1], &a->in[1], 0);
+  rb_proj_typed_buffer_get(a->vout[0], &a->out[0], 1);
+  rb_proj_typed_buffer_get(a->vout[1], &a->out[1], 1);
+  if ( a->in[0].len < a->len || a->in[1].len < a->len ||
+       a->out[0].len < a->len || a->out[1].len < a->len ) {
+    rb_raise(rb_eArgError, "buffer is too short");
+  }
+
+  for (i=0; i<a->len; i+=BATCH_CHUNK) {
+    m = ( a->len - i < BATCH_CHUNK ) ? a->len - i : BATCH_CHUNK;
+    rb_proj_typed_buffer_read(&a->in[0], i, m, a->factor_in, x);
+    rb_proj_typed_buffer_read(&a->in[1], i, m, a->factor_in, y);
+    if ( a->use_area ) {
+      if ( a->area_lat_first ) {
+        rb_proj_area_mask(&a->area, a->factor_in, y, x, m, mask);
+      }
+      else {
+        rb_proj_area_mask(&a->area, a->factor_in, x, y, m, mask);
+      }
+      batch_trans_masked(a, x, y, m, mask);
+    }
+    else if ( a->mask ) {
+      batch_trans_masked(a, x, y, m, a->mask + i);
+    }
+    else {
+      batch_trans(a, x, y, m);
+    }
+    for (j=0; j<m; j++) {
+      if ( x[j] == HUGE_VAL || y[j] == HUGE_VAL ) {
+        x[j] = y[j] = NAN;
+      }
+    }
+    rb_proj_typed_buffer_write(&a->out[0], i, m, a->factor_out, x);
+    rb_proj_typed_buffer_write(&a->out[1], i, m, a->factor_out, y);
+  }
+
+  return Qnil;
+}
+
+static VALUE
+batch_release (VALUE arg)
+{
+  batch_args *a = (batch_args *) arg;
+
+  rb_proj_typed_buffer_release(&a->in[0]);
+  rb_proj_typed_buffer_release(&a->in[1]);
+  rb_proj_typed_buffer_release(&a->out[0]);
+  rb_proj_typed_buffer_release(&a->out[1]);
+
+  return Qnil;
+}
+
+static long
+batch_length (VALUE vbuf)
+{
+  rb_proj_typed_buffer t;
+  long len;
+
+  rb_proj_typed_buffer_get(vbuf, &t, 0);
+  len = t.len;
+  rb_proj_typed_buffer_release(&t);
+
+  return len;
+}
+
+/*
+Returns the mask as a String of bytes (at least n bytes).
+*/
+static VALUE
+batch_mask (VALUE vmask, long n)
+{
+  volatile VALUE vstr;
+  VALUE v;
+  long i;
+
+  if ( RB_TYPE_P(vmask, T_STRING) ) {
+    if ( RSTRING_LEN(vmask) < n ) {
+      rb_raise(rb_eArgError, "mask is too short");
+    }
+    return vmask;
+  }
+
+  vmask = rb_Array(vmask);
+  if ( RARRAY_LEN(vmask) < n ) {
+    rb_raise(rb_eArgError, "mask is too short");
+  }
+  vstr = rb_str_new(NULL, n);
+  for (i=0; i<n; i++) {
+    v = RARRAY_AREF(vmask, i);
+    RSTRING_PTR(vstr)[i] = ( RTEST(v) && v != INT2FIX(0) );
+  }
+
+  return vstr;
+}
+
+static VALUE
+rb_proj_batch_i (int argc, VALUE *argv, VALUE self, int mode)
+{
+  volatile VALUE vxs, vys, vopts, vxout, vyout, vmask = Qnil;
+  ID kw_ids[6];
+  VALUE kw_vals[6];
+  batch_args a;
+  Proj *proj;
+  int type = RB_PROJ_TYPE_FLOAT64, in_ang = 0, out_ang = 0;
+  double scale = 1.0, offset = 0.0;
+  long n, ny;
+
+  rb_scan_args(argc, argv, "2:", (VALUE *)&vxs, (VALUE *)&vys, (VALUE *)&vopts);
+
+  proj = rb_proj_get_struct(self);
+
+  memset(&a, 0, sizeof(batch_args));
+  a.proj = proj;
+
+  kw_ids[0] = rb_intern("out");
+  kw_ids[1] = rb_intern("out_type");
+  kw_ids[2] = rb_intern("out_scale");
+  kw_ids[3] = rb_intern("out_offset");
+  kw_ids[4] = rb_intern("mask");
+  kw_ids[5] = rb_intern("direction");
+  rb_get_kwargs(vopts, kw_ids, 0, ( mode == BATCH_TRANSFORM ) ? 6 : 5, kw_vals);
+
+  switch ( mode ) {
+  case BATCH_FORWARD:
+    a.direction = PJ_FWD;
+    if ( ! proj->forward ) {
+      rb_raise(rb_eRuntimeError, "requires latlong src crs. use #transform_batch instead of #forward_batch.");
+    }
+    break;
+  case BATCH_INVERSE:
+    a.direction = PJ_INV;
+    if ( ! proj->inverse ) {
+      rb_raise(rb_eRuntimeError, "requires latlong src crs. use #transform_batch instead of #inverse_batch.");
+    }
+    break;
+  default:
+    a.direction = PJ_FWD;
+    if ( kw_vals[5] != Qundef && ! NIL_P(kw_vals[5]) ) {
+      if ( rb_to_id(kw_vals[5]) == id_inverse ) {
+        a.direction = PJ_INV;
+      }
+      else if ( rb_to_id(kw_vals[5]) != id_forward ) {
+        rb_raise(rb_eArgError, "invalid direction");
+      }
+    }
+    break;
+  }
+
+  /* units follow #forward and #inverse */
+  if ( mode != BATCH_TRANSFORM ) {
+    in_ang  = ( proj_angular_input(proj->ref, a.direction) == 1 );
+    out_ang = ( proj_angular_output(proj->ref, a.direction) == 1 );
+  }
+  a.factor_in  = ( in_ang ) ? BATCH_DEG_TO_RAD : 1.0;
+  a.factor_out = ( out_ang ) ? BATCH_RAD_TO_DEG : 1.0;
+
+  n  = batch_length(vxs);
+  ny = batch_length(vys);
+  if ( ny < n ) {
+    n = ny;
+  }
+
+  if ( kw_vals[0] == Qundef || NIL_P(kw_vals[0]) ) {
+    if ( kw_vals[1] != Qundef && ! NIL_P(kw_vals[1]) ) {
+      type = rb_proj_typed_buffer_type(kw_vals[1]);
+    }
+    if ( kw_vals[2] != Qundef && ! NIL_P(kw_vals[2]) ) {
+      scale = NUM2DBL(kw_vals[2]);
+      if ( scale == 0.0 || ! isfinite(scale) ) {
+        rb_raise(rb_eArgError, "invalid scale");
+      }
+    }
+    if ( kw_vals[3] != Qundef && ! NIL_P(kw_vals[3]) ) {
+      offset = NUM2DBL(kw_vals[3]);
+    }
+    if ( type == RB_PROJ_TYPE_FLOAT64 && scale == 1.0 && offset == 0.0 ) {
+      double *ptr;
+      vxout = rb_proj_buffer_new(n, &ptr);
+      vyout = rb_proj_buffer_new(n, &ptr);
+    }
+    else {
+      vxout = rb_proj_typed_buffer_new(type, scale, offset, n);
+      vyout = rb_proj_typed_buffer_new(type, scale, offset, n);
+    }
+  }
+  else {
+    VALUE vout = rb_Array(kw_vals[0]);
+    if ( RARRAY_LEN(vout) != 2 ) {
+      rb_raise(rb_eArgError, "out should be an array with 2 buffers");
+    }
+    vxout = RARRAY_AREF(vout, 0);
+    vyout = RARRAY_AREF(vout, 1);
+    if ( batch_length(vxout) < n || batch_length(vyout) < n ) {
+      rb_raise(rb_eArgError, "output buffer is too short");
+    }
+  }
+
+  if ( kw_vals[4] != Qundef && ! NIL_P(kw_vals[4]) ) {
+    vmask = kw_vals[4];
+    if ( SYMBOL_P(vmask) ) {
+      if ( rb_to_id(vmask) != rb_intern("area_of_use") ) {
+        rb_raise(rb_eArgError, "invalid mask");
+      }
+      if ( mode != BATCH_FORWARD ) {
+        rb_raise(rb_eArgError, "mask: :area_of_use is available only for #forward_batch");
+      }
+      a.use_area = rb_proj_area_get(proj, &a.area, NULL);
+      if ( a.use_area ) {
+        a.area_lat_first = rb_proj_area_lat_first(proj);
+      }
+    }
+    else {
+      vmask = batch_mask(vmask, n);
+      a.mask = (const unsigned char *) RSTRING_PTR(vmask);
+    }
+  }
+
+  a.vin[0]  = vxs;
+  a.vin[1]  = vys;
+  a.vout[0] = vxout;
+  a.vout[1] = vyout;
+  a.len = n;
+
+  rb_ensure(batch_run, (VALUE) &a, batch_release, (VALUE) &a);
+
+  RB_GC_GUARD(vmask);
+
+  return rb_assoc_new(vxout, vyout);
+}
+
+/*
+Transforms coordinate buffers as #forward does (longitudes and latitudes
+in degrees). Points which can not be transformed give NaN (the minimum
+value for integer outputs).
+
+Buffers may be Strings packed with doubles, objects exporting MemoryView of
+doubles, Arrays (input only) or PROJ::Buffer of float32 or scaled integers.
+The output is returned as Strings packed with doubles, or as PROJ::Buffer
+if `out_type`, `out_scale` or `out_offset` is given, or stored into `out`.
+
+Points where `mask` is 0 (a String of bytes as returned by
+#within_area_of_use, or an Array) give NaN without being transformed.
+`mask: :area_of_use` tests the points against #area_of_use on the fly,
+taking the axis order of the source CRS (latitude first for EPSG:4326).
+
+@overload forward_batch(lons, lats, out: nil, out_type: :float64, out_scale: 1.0, out_offset: 0.0, mask: nil)
+  @param lons [String, Object, Array, PROJ::Buffer]
+  @param lats [String, Object, Array, PROJ::Buffer]
+  @param out [Array, nil] [xbuf, ybuf]
+  @param mask [String, Array, Symbol, nil] points to transform, or :area_of_use
+
+@return [Array] [xbuf, ybuf]
+
+@example
+  lons = PROJ::Buffer.new(e7_lons, :int32, scale: 1e-7)
+  lats = PROJ::Buffer.new(e7_lats, :int32, scale: 1e-7)
+  x, y = pj.forward_batch(lons, lats, out_type: :float32)
+*/
+static VALUE
+rb_proj_forward_batch (int argc, VALUE *argv, VALUE self)
+{
+  return rb_proj_batch_i(argc, argv, self, BATCH_FORWARD);
+}
+
+/*
+Transforms coordinate buffers as #inverse does. See #forward_batch.
+
+@overload inverse_batch(xs, ys, out: nil, out_type: :float64, out_scale: 1.0, out_offset: 0.0, mask: nil)
+
+@return [Array] [lonbuf, latbuf]
+*/
+static VALUE
+rb_proj_inverse_batch (int argc, VALUE *argv, VALUE self)
+{
+  return rb_proj_batch_i(argc, argv, self, BATCH_INVERSE);
+}
+
+/*
+Transforms coordinate buffers as #transform (or #transform_inverse) does.
+See #forward_batch.
+
+@overload transform_batch(xs, ys, direction: :forward, out: nil, out_type: :float64, out_scale: 1.0, out_offset: 0.0, mask: nil)
+
+@return [Array] [xbuf, ybuf]
+*/
+static VALUE
+rb_proj_transform_batch (int argc, VALUE *argv, VALUE self)
+{
+  return rb_proj_batch_i(argc, argv, self, BATCH_TRANSFORM);
+}
+
+void
+Init_simple_proj_batch (void)
+{
+  rb_define_method(rb_cProj, "forward_batch", rb_proj_forward_batch, -1);
+  rb_define_method(rb_cProj, "inverse_batch", rb_proj_inverse_batch, -1);
+  rb_define_method(rb_cProj, "transform_batch", rb_proj_transform_batch, -1);
+}
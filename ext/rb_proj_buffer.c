@@ -0,0 +1,734 @@
+#include "ruby.h"
+#include "rb_proj.h"
+
+#include <math.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+Coordinate buffers for the batch methods.
+
+A buffer is one of
+ * a String packed with native doubles (e.g. [x1, x2, ...].pack("d*")),
+ * an object exporting a contiguous MemoryView of doubles (CArray, Numo::NArray),
+ * an Array of Numeric (read only, copied),
+ * a PROJ::Buffer (typed elements, read only and decoded into doubles
+   unless it is plain float64; the batch methods read and write it by chunks).
+*/
+
+VALUE rb_cProjBuffer;
+
+typedef struct {
+  VALUE data;       /* String or object exporting MemoryView */
+  int type;
+  double scale;
+  double offset;
+} ProjBuffer;
+
+static const size_t typed_elem_size[] = { 8, 4, 4, 2 };
+static const char  *typed_type_name[] = { "float64", "float32", "int32", "int16" };
+static const char   typed_view_format[] = { 'd', 'f', 'l', 's' };
+
+static void
+mark_typed_buffer (void *ap)
+{
+  ProjBuffer *tb = ap;
+  rb_gc_mark_movable(tb->data);
+}
+
+static void
+compact_typed_buffer (void *ap)
+{
+  ProjBuffer *tb = ap;
+  tb->data = rb_gc_location(tb->data);
+}
+
+static const rb_data_type_t typed_buffer_data_type = {
+    .wrap_struct_name = "PROJ::Buffer",
+    .function = {
+        .dmark = mark_typed_buffer,
+        .dfree = RUBY_TYPED_DEFAULT_FREE,
+        .dcompact = compact_typed_buffer
+    },
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+static int
+typed_buffer_p (VALUE obj)
+{
+  return rb_typeddata_is_kind_of(obj, &typed_buffer_data_type);
+}
+
+static ProjBuffer *
+typed_buffer_struct (VALUE obj)
+{
+  ProjBuffer *tb;
+  TypedData_Get_Struct(obj, ProjBuffer, &typed_buffer_data_type, tb);
+  if ( NIL_P(tb->data) ) {
+    rb_raise(rb_eRuntimeError, "PROJ::Buffer is not initialized");
+  }
+  return tb;
+}
+
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+
+#ifdef WORDS_BIGENDIAN
+#define NATIVE_ENDIAN_PREFIX '>'
+#else
+#define NATIVE_ENDIAN_PREFIX '<'
+#endif
+
+static int
+rb_proj_view_is_double (const rb_memory_view_t *view)
+{
+  const char *fmt = view->format;
+
+  if ( view->byte_size % sizeof(double) != 0 ) {
+    return 0;
+  }
+  if ( fmt == NULL ) {
+    return 1;
+  }
+  if ( *fmt == '=' || *fmt == '@' || *fmt == NATIVE_ENDIAN_PREFIX ) {
+    fmt++;
+  }
+  return ( fmt[0] == 'd' && fmt[1] == '\0' );
+}
+
+/* checks the item size and the format (if given) against the element type */
+static int
+rb_proj_view_is_typed (const rb_memory_view_t *view, int type)
+{
+  const char *fmt = view->format;
+
+  if ( view->item_size > 0 && (size_t) view->item_size != typed_elem_size[type] ) {
+    return 0;
+  }
+  if ( fmt == NULL ) {
+    return 1;
+  }
+  if ( *fmt == '=' || *fmt == '@' || *fmt == NATIVE_ENDIAN_PREFIX ) {
+    fmt++;
+  }
+  if ( fmt[0] == 'i' && type == RB_PROJ_TYPE_INT32 && sizeof(int) == 4 ) {
+    return ( fmt[1] == '\0' );
+  }
+  return ( fmt[0] == typed_view_format[type] && fmt[1] == '\0' );
+}
+#endif
+
+/*
+Uses an aligned copy of the first nbytes of a String whose data is not
+aligned for the elements (e.g. made by byteslice). The copy is written
+back to the String on release if writable.
+*/
+static char *
+buffer_aligned_copy (rb_proj_buffer *buf, VALUE str, long nbytes, int writable)
+{
+  buf->kind      = RB_PROJ_BUFFER_ALIGNED;
+  buf->obj       = str;
+  buf->copy      = rb_str_new(RSTRING_PTR(str), nbytes);
+  buf->copy_size = nbytes;
+  buf->writeback = writable;
+  return RSTRING_PTR(buf->copy);
+}
+
+static VALUE
+buffer_str_modify (VALUE str)
+{
+  rb_str_modify(str);
+  return Qnil;
+}
+
+void
+rb_proj_buffer_get (VALUE obj, rb_proj_buffer *buf, int writable)
+{
+  memset(buf, 0, sizeof(rb_proj_buffer));
+  buf->obj = obj;
+
+  if ( typed_buffer_p(obj) ) {
+    ProjBuffer *tb = typed_buffer_struct(obj);
+    rb_proj_typed_buffer t;
+    volatile VALUE vtmp;
+    if ( tb->type == RB_PROJ_TYPE_FLOAT64 && tb->scale == 1.0 && tb->offset == 0.0 ) {
+      rb_proj_buffer_get(tb->data, buf, writable);
+      return;
+    }
+    if ( writable ) {
+      rb_raise(rb_eArgError, "%s buffer can not be used as output buffer of this method",
+               typed_type_name[tb->type]);
+    }
+    rb_proj_typed_buffer_get(obj, &t, 0);
+    vtmp = rb_str_new(NULL, t.len * sizeof(double));
+    rb_proj_typed_buffer_read(&t, 0, t.len, 1.0, (double *) RSTRING_PTR(vtmp));
+    buf->len  = t.len;
+    rb_proj_typed_buffer_release(&t);
+    buf->kind = RB_PROJ_BUFFER_COPY;
+    buf->obj  = vtmp;
+    buf->ptr  = (double *) RSTRING_PTR(vtmp);
+    buf->ndim = 1;
+    buf->shape[0] = buf->len;
+    return;
+  }
+
+  if ( RB_TYPE_P(obj, T_STRING) ) {
+    if ( writable ) {
+      rb_str_modify(obj);
+    }
+    if ( RSTRING_LEN(obj) % sizeof(double) != 0 ) {
+      rb_raise(rb_eArgError, "length of packed buffer should be multiple of %d", (int) sizeof(double));
+    }
+    buf->kind = RB_PROJ_BUFFER_STRING;
+    buf->ptr  = (double *) RSTRING_PTR(obj);
+    buf->len  = RSTRING_LEN(obj) / sizeof(double);
+    if ( (uintptr_t) buf->ptr % sizeof(double) != 0 ) {
+      buf->ptr = (double *) buffer_aligned_copy(buf, obj, buf->len * sizeof(double), writable);
+    }
+    buf->ndim = 1;
+    buf->shape[0] = buf->len;
+    return;
+  }
+
+  if ( RB_TYPE_P(obj, T_ARRAY) ) {
+    volatile VALUE vtmp;
+    long i;
+    if ( writable ) {
+      rb_raise(rb_eArgError, "Array can not be used as output buffer");
+    }
+    buf->len  = RARRAY_LEN(obj);
+    vtmp      = rb_str_new(NULL, buf->len * sizeof(double));
+    buf->ptr  = (double *) RSTRING_PTR(vtmp);
+    for (i=0; i<buf->len; i++) {
+      buf->ptr[i] = NUM2DBL(RARRAY_AREF(obj, i));
+    }
+    buf->kind = RB_PROJ_BUFFER_COPY;
+    buf->obj  = vtmp;
+    buf->ndim = 1;
+    buf->shape[0] = buf->len;
+    return;
+  }
+
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+  if ( rb_memory_view_available_p(obj) ) {
+    int flags = RUBY_MEMORY_VIEW_FORMAT;
+    if ( writable ) {
+      flags |= RUBY_MEMORY_VIEW_WRITABLE;
+    }
+    if ( ! rb_memory_view_get(obj, &buf->view, flags) ) {
+      rb_raise(rb_eArgError, "failed to get memory view");
+    }
+    if ( ( buf->view.strides && ! rb_memory_view_is_contiguous(&buf->view) ) ||
+         ! rb_proj_view_is_double(&buf->view) ) {
+      rb_memory_view_release(&buf->view);
+      rb_raise(rb_eArgError, "memory view should be contiguous array of double");
+    }
+    buf->kind = RB_PROJ_BUFFER_VIEW;
+    buf->ptr  = (double *) buf->view.data;
+    buf->len  = buf->view.byte_size / sizeof(double);
+    if ( buf->view.shape && buf->view.ndim == 2 ) {
+      buf->ndim = 2;
+      buf->shape[0] = buf->view.shape[0];
+      buf->shape[1] = buf->view.shape[1];
+    }
+    else {
+      buf->ndim = 1;
+      buf->shape[0] = buf->len;
+    }
+    return;
+  }
+#endif
+
+  rb_raise(rb_eTypeError, "invalid coordinate buffer (%s)", rb_obj_classname(obj));
+}
+
+typedef struct {
+  VALUE obj;
+  rb_proj_buffer *buf;
+} buffer_get_args;
+
+static VALUE
+buffer_get_protected (VALUE arg)
+{
+  buffer_get_args *g = (buffer_get_args *) arg;
+  rb_proj_buffer_get(g->obj, g->buf, 0);
+  return Qnil;
+}
+
+/*
+Takes two input buffers. If taking the second one raises, the first one is
+released before the exception is propagated.
+*/
+void
+rb_proj_buffer_get_pair (VALUE obj1, VALUE obj2, rb_proj_buffer *buf1, rb_proj_buffer *buf2)
+{
+  buffer_get_args g;
+  int state = 0;
+
+  rb_proj_buffer_get(obj1, buf1, 0);
+  g.obj = obj2;
+  g.buf = buf2;
+  rb_protect(buffer_get_protected, (VALUE) &g, &state);
+  if ( state ) {
+    rb_proj_buffer_release(buf1);
+    rb_jump_tag(state);
+  }
+}
+
+/*
+Locks the String of the buffer (rb_str_locktmp) so that it can't be resized
+or modified by other threads while the buffer is used without GVL. It is
+unlocked by rb_proj_buffer_release.
+*/
+void
+rb_proj_buffer_lock (rb_proj_buffer *buf)
+{
+  if ( buf->kind == RB_PROJ_BUFFER_STRING && ! buf->locked ) {
+    rb_str_locktmp(buf->obj);
+    buf->locked = 1;
+  }
+}
+
+void
+rb_proj_buffer_release (rb_proj_buffer *buf)
+{
+  VALUE errinfo;
+  int state = 0;
+
+  if ( buf->locked ) {
+    rb_str_unlocktmp(buf->obj);
+    buf->locked = 0;
+  }
+  if ( buf->kind == RB_PROJ_BUFFER_ALIGNED && buf->writeback ) {
+    /* not raising here, release is called from ensure functions */
+    errinfo = rb_errinfo();
+    rb_protect(buffer_str_modify, buf->obj, &state);
+    if ( state ) {
+      rb_set_errinfo(errinfo);
+    }
+    else if ( RSTRING_LEN(buf->obj) >= buf->copy_size ) {
+      memcpy(RSTRING_PTR(buf->obj), RSTRING_PTR(buf->copy), buf->copy_size);
+    }
+  }
+  buf->copy = Qnil;
+  buf->writeback = 0;
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+  if ( buf->kind == RB_PROJ_BUFFER_VIEW ) {
+    rb_memory_view_release(&buf->view);
+  }
+#endif
+  buf->kind = RB_PROJ_BUFFER_NONE;
+  buf->ptr  = NULL;
+  buf->len  = 0;
+}
+
+/*
+Returns the number of points of a grid of nrow x ncol (both positive).
+Raises ArgumentError if the buffer of doubles for them can't be sized.
+*/
+long
+rb_proj_shape_size (long nrow, long ncol)
+{
+  if ( nrow > LONG_MAX / ncol ||
+       nrow * ncol > LONG_MAX / (long) sizeof(double) ) {
+    rb_raise(rb_eArgError, "shape is too large (%ld x %ld)", nrow, ncol);
+  }
+  return nrow * ncol;
+}
+
+VALUE
+rb_proj_buffer_new (long len, double **ptr)
+{
+  volatile VALUE vbuf;
+
+  vbuf = rb_str_new(NULL, len * sizeof(double));
+  *ptr = (double *) RSTRING_PTR(vbuf);
+
+  return vbuf;
+}
+
+/*
+Typed buffers.
+
+rb_proj_typed_buffer_read() and rb_proj_typed_buffer_write() convert a range
+of elements from/into doubles fused with the scaling and an extra factor
+(e.g. degrees to radians), so that the batch methods work on a small chunk
+of doubles instead of a full double copy. The loops are simple enough for
+the compiler to vectorize. Integer outputs are rounded and saturated,
+and NaN is stored as the minimum value of the type.
+*/
+
+void
+rb_proj_typed_buffer_get (VALUE obj, rb_proj_typed_buffer *tbuf, int writable)
+{
+  ProjBuffer *tb;
+  VALUE data;
+
+  memset(tbuf, 0, sizeof(rb_proj_typed_buffer));
+  tbuf->obj = obj;
+
+  if ( ! typed_buffer_p(obj) ) {
+    rb_proj_buffer_get(obj, &tbuf->buf, writable);
+    tbuf->ptr    = (char *) tbuf->buf.ptr;
+    tbuf->len    = tbuf->buf.len;
+    tbuf->type   = RB_PROJ_TYPE_FLOAT64;
+    tbuf->scale  = 1.0;
+    tbuf->offset = 0.0;
+    return;
+  }
+
+  tb = typed_buffer_struct(obj);
+  data = tb->data;
+  tbuf->type   = tb->type;
+  tbuf->scale  = tb->scale;
+  tbuf->offset = tb->offset;
+
+  if ( RB_TYPE_P(data, T_STRING) ) {
+    if ( writable ) {
+      rb_str_modify(data);
+    }
+    tbuf->ptr = RSTRING_PTR(data);
+    tbuf->len = RSTRING_LEN(data) / typed_elem_size[tb->type];
+    if ( (uintptr_t) tbuf->ptr % typed_elem_size[tb->type] != 0 ) {
+      tbuf->ptr = buffer_aligned_copy(&tbuf->buf, data,
+                                      tbuf->len * typed_elem_size[tb->type], writable);
+    }
+    return;
+  }
+
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+  if ( rb_memory_view_available_p(data) ) {
+    int flags = RUBY_MEMORY_VIEW_FORMAT;
+    if ( writable ) {
+      flags |= RUBY_MEMORY_VIEW_WRITABLE;
+    }
+    if ( ! rb_memory_view_get(data, &tbuf->view, flags) ) {
+      rb_raise(rb_eArgError, "failed to get memory view");
+    }
+    if ( ( tbuf->view.strides && ! rb_memory_view_is_contiguous(&tbuf->view) ) ||
+         ! rb_proj_view_is_typed(&tbuf->view, tb->type) ) {
+      rb_memory_view_release(&tbuf->view);
+      rb_raise(rb_eArgError, "memory view should be contiguous array of %s",
+               typed_type_name[tb->type]);
+    }
+    tbuf->is_view = 1;
+    tbuf->ptr = (char *) tbuf->view.data;
+    tbuf->len = tbuf->view.byte_size / typed_elem_size[tb->type];
+    return;
+  }
+#endif
+
+  rb_raise(rb_eTypeError, "invalid data of PROJ::Buffer (%s)", rb_obj_classname(data));
+}
+
+void
+rb_proj_typed_buffer_release (rb_proj_typed_buffer *tbuf)
+{
+#ifdef HAVE_RUBY_MEMORY_VIEW_H
+  if ( tbuf->is_view ) {
+    rb_memory_view_release(&tbuf->view);
+    tbuf->is_view = 0;
+  }
+#endif
+  rb_proj_buffer_release(&tbuf->buf);
+  tbuf->ptr = NULL;
+  tbuf->len = 0;
+}
+
+/* dst[i] = (raw[start+i] * scale + offset) * factor */
+void
+rb_proj_typed_buffer_read (const rb_proj_typed_buffer *tbuf, long start, long n,
+                           double factor, double *dst)
+{
+  const double a = tbuf->scale * factor;
+  const double b = tbuf->offset * factor;
+  long i;
+
+  switch ( tbuf->type ) {
+  case RB_PROJ_TYPE_FLOAT64: {
+    const double *p = (const double *) tbuf->ptr + start;
+    if ( a == 1.0 && b == 0.0 ) {
+      memcpy(dst, p, n * sizeof(double));
+    }
+    else {
+      for (i=0; i<n; i++) {
+        dst[i] = p[i] * a + b;
+      }
+    }
+    break;
+  }
+  case RB_PROJ_TYPE_FLOAT32: {
+    const float *p = (const float *) tbuf->ptr + start;
+    for (i=0; i<n; i++) {
+      dst[i] = (double) p[i] * a + b;
+    }
+    break;
+  }
+  case RB_PROJ_TYPE_INT32: {
+    const int32_t *p = (const int32_t *) tbuf->ptr + start;
+    for (i=0; i<n; i++) {
+      dst[i] = (double) p[i] * a + b;
+    }
+    break;
+  }
+  case RB_PROJ_TYPE_INT16: {
+    const int16_t *p = (const int16_t *) tbuf->ptr + start;
+    for (i=0; i<n; i++) {
+      dst[i] = (double) p[i] * a + b;
+    }
+    break;
+  }
+  }
+}
+
+#define TYPED_BUFFER_NARROW_INT(ctype, vmin, vmax)                  \
+  {                                                                 \
+    ctype *p = (ctype *) tbuf->ptr + start;                         \
+    double v;                                                       \
+    for (i=0; i<n; i++) {                                           \
+      v = nearbyint(src[i] * a + b);                                \
+      p[i] = ( v >= (double) (vmax) ) ? (vmax) :                    \
+             ( v >  (double) (vmin) ) ? (ctype) v : (vmin);         \
+    }                                                               \
+  }
+
+/* raw[start+i] = (src[i] * factor - offset) / scale */
+void
+rb_proj_typed_buffer_write (rb_proj_typed_buffer *tbuf, long start, long n,
+                            double factor, const double *src)
+{
+  const double a = factor / tbuf->scale;
+  const double b = - tbuf->offset / tbuf->scale;
+  long i;
+
+  switch ( tbuf->type ) {
+  case RB_PROJ_TYPE_FLOAT64: {
+    double *p = (double *) tbuf->ptr + start;
+    if ( a == 1.0 && b == 0.0 ) {
+      memcpy(p, src, n * sizeof(double));
+    }
+    else {
+      for (i=0; i<n; i++) {
+        p[i] = src[i] * a + b;
+      }
+    }
+    break;
+  }
+  case RB_PROJ_TYPE_FLOAT32: {
+    float *p = (float *) tbuf->ptr + start;
+    for (i=0; i<n; i++) {
+      p[i] = (float) (src[i] * a + b);
+    }
+    break;
+  }
+  case RB_PROJ_TYPE_INT32:
+    TYPED_BUFFER_NARROW_INT(int32_t, INT32_MIN, INT32_MAX);
+    break;
+  case RB_PROJ_TYPE_INT16:
+    TYPED_BUFFER_NARROW_INT(int16_t, INT16_MIN, INT16_MAX);
+    break;
+  }
+}
+
+int
+rb_proj_typed_buffer_type (VALUE vtype)
+{
+  ID id = rb_to_id(vtype);
+  int i;
+
+  for (i=0; i<(int)(sizeof(typed_type_name)/sizeof(typed_type_name[0])); i++) {
+    if ( id == rb_intern(typed_type_name[i]) ) {
+      return i;
+    }
+  }
+  rb_raise(rb_eArgError, "invalid buffer type '%s'", rb_id2name(id));
+}
+
+static VALUE
+rb_typed_buffer_s_allocate (VALUE klass)
+{
+  ProjBuffer *tb;
+  VALUE obj = TypedData_Make_Struct(klass, ProjBuffer, &typed_buffer_data_type, tb);
+  tb->data   = Qnil;
+  tb->type   = RB_PROJ_TYPE_FLOAT64;
+  tb->scale  = 1.0;
+  tb->offset = 0.0;
+  return obj;
+}
+
+/*
+Creates a typed coordinate buffer. The value of an element is
+raw * scale + offset (e.g. int32 with scale 1e-7 for E7 degrees).
+If `data` is an Integer, a zero-filled String of the length is allocated.
+
+@overload initialize(data, type = :float64, scale: 1.0, offset: 0.0)
+  @param data [String, Integer, Object] String, length, or object exporting MemoryView
+  @param type [Symbol] :float64, :float32, :int32 or :int16
+  @param scale [Numeric]
+  @param offset [Numeric]
+
+@example
+  lons = PROJ::Buffer.new(e7_lons.pack("l*"), :int32, scale: 1e-7)
+  out  = PROJ::Buffer.new(lons.size, :float32)
+*/
+static VALUE
+rb_typed_buffer_initialize (int argc, VALUE *argv, VALUE self)
+{
+  volatile VALUE vdata, vtype, vopts;
+  ID kw_ids[2];
+  VALUE kw_vals[2];
+  ProjBuffer *tb;
+
+  rb_scan_args(argc, argv, "11:", (VALUE *)&vdata, (VALUE *)&vtype, (VALUE *)&vopts);
+
+  TypedData_Get_Struct(self, ProjBuffer, &typed_buffer_data_type, tb);
+
+  kw_ids[0] = rb_intern("scale");
+  kw_ids[1] = rb_intern("offset");
+  rb_get_kwargs(vopts, kw_ids, 0, 2, kw_vals);
+
+  tb->type   = NIL_P(vtype) ? RB_PROJ_TYPE_FLOAT64 : rb_proj_typed_buffer_type(vtype);
+  tb->scale  = ( kw_vals[0] == Qundef ) ? 1.0 : NUM2DBL(kw_vals[0]);
+  tb->offset = ( kw_vals[1] == Qundef ) ? 0.0 : NUM2DBL(kw_vals[1]);
+
+  if ( tb->scale == 0.0 || ! isfinite(tb->scale) || ! isfinite(tb->offset) ) {
+    rb_raise(rb_eArgError, "invalid scale or offset");
+  }
+
+  if ( RB_INTEGER_TYPE_P(vdata) ) {
+    long len = NUM2LONG(vdata);
+    if ( len < 0 ) {
+      rb_raise(rb_eArgError, "negative length");
+    }
+    vdata = rb_str_new(NULL, len * typed_elem_size[tb->type]);
+    memset(RSTRING_PTR(vdata), 0, RSTRING_LEN(vdata));
+  }
+  else if ( RB_TYPE_P(vdata, T_STRING) ) {
+    if ( RSTRING_LEN(vdata) % typed_elem_size[tb->type] != 0 ) {
+      rb_raise(rb_eArgError, "length of packed buffer should be multiple of %d",
+               (int) typed_elem_size[tb->type]);
+    }
+  }
+
+  RB_OBJ_WRITE(self, &tb->data, vdata);
+
+  return Qnil;
+}
+
+VALUE
+rb_proj_typed_buffer_new (int type, double scale, double offset, long len)
+{
+  VALUE obj = rb_typed_buffer_s_allocate(rb_cProjBuffer);
+  ProjBuffer *tb;
+  volatile VALUE vdata;
+
+  TypedData_Get_Struct(obj, ProjBuffer, &typed_buffer_data_type, tb);
+  vdata = rb_str_new(NULL, len * typed_elem_size[type]);
+  tb->type   = type;
+  tb->scale  = scale;
+  tb->offset = offset;
+  RB_OBJ_WRITE(obj, &tb->data, vdata);
+
+  return obj;
+}
+
+/*
+Returns the underlying data.
+
+@return [String, Object]
+*/
+static VALUE
+rb_typed_buffer_data (VALUE self)
+{
+  return typed_buffer_struct(self)->data;
+}
+
+/*
+Returns the element type.
+
+@return [Symbol]
+*/
+static VALUE
+rb_typed_buffer_type (VALUE self)
+{
+  return ID2SYM(rb_intern(typed_type_name[typed_buffer_struct(self)->type]));
+}
+
+/*
+@return [Float]
+*/
+static VALUE
+rb_typed_buffer_scale (VALUE self)
+{
+  return rb_float_new(typed_buffer_struct(self)->scale);
+}
+
+/*
+@return [Float]
+*/
+static VALUE
+rb_typed_buffer_offset (VALUE self)
+{
+  return rb_float_new(typed_buffer_struct(self)->offset);
+}
+
+/*
+Returns the number of elements.
+
+@return [Integer]
+*/
+static VALUE
+rb_typed_buffer_size (VALUE self)
+{
+  rb_proj_typed_buffer t;
+  long len;
+
+  rb_proj_typed_buffer_get(self, &t, 0);
+  len = t.len;
+  rb_proj_typed_buffer_release(&t);
+
+  return LONG2NUM(len);
+}
+
+/*
+Returns the values (raw * scale + offset) as an Array of Float.
+
+@return [Array<Float>]
+*/
+static VALUE
+rb_typed_buffer_to_a (VALUE self)
+{
+  volatile VALUE vtmp, vary;
+  rb_proj_typed_buffer t;
+  double *v;
+  long i, len;
+
+  rb_proj_typed_buffer_get(self, &t, 0);
+  len = t.len;
+  vtmp = rb_str_new(NULL, len * sizeof(double));
+  v = (double *) RSTRING_PTR(vtmp);
+  rb_proj_typed_buffer_read(&t, 0, len, 1.0, v);
+  rb_proj_typed_buffer_release(&t);
+
+  vary = rb_ary_new_capa(len);
+  for (i=0; i<len; i++) {
+    rb_ary_push(vary, rb_float_new(v[i]));
+  }
+
+  return vary;
+}
+
+void
+Init_simple_proj_buffer (void)
+{
+  rb_cProjBuffer = rb_define_class_under(rb_cProj, "Buffer", rb_cObject);
+  rb_define_alloc_func(rb_cProjBuffer, rb_typed_buffer_s_allocate);
+  rb_define_method(rb_cProjBuffer, "initialize", rb_typed_buffer_initialize, -1);
+  rb_define_method(rb_cProjBuffer, "data", rb_typed_buffer_data, 0);
+  rb_define_method(rb_cProjBuffer, "type", rb_typed_buffer_type, 0);
+  rb_define_method(rb_cProjBuffer, "scale", rb_typed_buffer_scale, 0);
+  rb_define_method(rb_cProjBuffer, "offset", rb_typed_buffer_offset, 0);
+  rb_define_method(rb_cProjBuffer, "size", rb_typed_buffer_size, 0);
+  rb_define_method(rb_cProjBuffer, "length", rb_typed_buffer_size, 0);
+  rb_define_method(rb_cProjBuffer, "to_a", rb_typed_buffer_to_a, 0);
+}
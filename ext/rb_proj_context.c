@@ -0,0 +1,133 @@
+#include "ruby.h"
+#include "rb_proj.h"
+
+/*
+Settings of the default context, which is used for the construction of
+PROJ and PROJ::CRS objects. The contexts created for worker threads are
+copied from the default context, so they inherit these settings.
+*/
+
+static const char **
+context_paths (VALUE vpaths, VALUE *vholder, int *count)
+{
+  const char **paths;
+  long i, n;
+
+  vpaths = rb_Array(vpaths);
+  n = RARRAY_LEN(vpaths);
+
+  *vholder = rb_str_new(NULL, ( n + 1 ) * sizeof(char *));
+  paths = (const char **) RSTRING_PTR(*vholder);
+  for (i=0; i<n; i++) {
+    VALUE vpath = RARRAY_AREF(vpaths, i);
+    paths[i] = ( NIL_P(vpath) ) ? NULL : StringValueCStr(vpath);
+  }
+  paths[n] = NULL;
+  *count = (int) n;
+
+  return paths;
+}
+
+/*
+Sets the path of proj.db (and auxiliary databases) of the default context.
+The path may be a SQLite URI ("file:...?immutable=1"), and nil restores
+the default path.
+
+@private
+*/
+static VALUE
+rb_proj_s_set_database_path (VALUE klass, VALUE vpath, VALUE vaux)
+{
+  volatile VALUE vpaths = rb_ary_dup(rb_Array(vaux)), vholder;
+  const char **aux;
+  int count;
+
+  rb_ary_unshift(vpaths, vpath);     /* keep the path alive with aux paths */
+  aux = context_paths(vpaths, (VALUE *) &vholder, &count);
+
+  if ( ! proj_context_set_database_path(PJ_DEFAULT_CTX, aux[0],
+                                        ( count > 1 ) ? aux + 1 : NULL, NULL) ) {
+    rb_raise(rb_eRuntimeError, "failed to open database '%s'",
+             ( aux[0] ) ? aux[0] : "(default)");
+  }
+
+  RB_GC_GUARD(vpaths);
+  RB_GC_GUARD(vholder);
+
+  return Qnil;
+}
+
+/*
+Sets the search paths of resource files (grids, init files) of the default
+context.
+
+@private
+*/
+static VALUE
+rb_proj_s_set_search_paths (VALUE klass, VALUE vpaths)
+{
+  volatile VALUE vholder;
+  const char **paths;
+  int count;
+
+  vpaths = rb_Array(vpaths);
+  paths = context_paths(vpaths, (VALUE *) &vholder, &count);
+  proj_context_set_search_paths(PJ_DEFAULT_CTX, count, paths);
+
+  RB_GC_GUARD(vpaths);
+  RB_GC_GUARD(vholder);
+
+  return Qnil;
+}
+
+#if PROJ_AT_LEAST_VERSION(7,0,0)
+
+/*
+Configures the cache of remote grid chunks of the default context.
+nil leaves the setting unchanged.
+
+@private
+*/
+static VALUE
+rb_proj_s_set_grid_cache (VALUE klass, VALUE venabled, VALUE vfilename,
+                          VALUE vmax_size, VALUE vttl)
+{
+  if ( ! NIL_P(venabled) ) {
+    proj_grid_cache_set_enable(PJ_DEFAULT_CTX, RTEST(venabled));
+  }
+  if ( ! NIL_P(vfilename) ) {
+    proj_grid_cache_set_filename(PJ_DEFAULT_CTX, StringValueCStr(vfilename));
+  }
+  if ( ! NIL_P(vmax_size) ) {
+    proj_grid_cache_set_max_size(PJ_DEFAULT_CTX, NUM2INT(vmax_size));
+  }
+  if ( ! NIL_P(vttl) ) {
+    proj_grid_cache_set_ttl(PJ_DEFAULT_CTX, NUM2INT(vttl));
+  }
+  return Qnil;
+}
+
+/*
+Clears the cache of remote grid chunks.
+
+@return [nil]
+*/
+static VALUE
+rb_proj_s_clear_grid_cache (VALUE klass)
+{
+  proj_grid_cache_clear(PJ_DEFAULT_CTX);
+  return Qnil;
+}
+
+#endif
+
+void
+Init_simple_proj_context (void)
+{
+  rb_define_singleton_method(rb_cProj, "_set_database_path", rb_proj_s_set_database_path, 2);
+  rb_define_singleton_method(rb_cProj, "_set_search_paths", rb_proj_s_set_search_paths, 1);
+#if PROJ_AT_LEAST_VERSION(7,0,0)
+  rb_define_singleton_method(rb_cProj, "_set_grid_cache", rb_proj_s_set_grid_cache, 4);
+  rb_define_singleton_method(rb_cProj, "clear_grid_cache", rb_proj_s_clear_grid_cache, 0);
+#endif
+}
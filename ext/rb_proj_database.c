@@ -0,0 +1,106 @@
+#include "ruby.h"
+#include "rb_proj.h"
+
+static VALUE
+database_type_name (PJ_TYPE type)
+{
+  const char *name;
+
+  switch ( type ) {
+  case PJ_TYPE_GEODETIC_CRS:          name = "geodetic_crs"; break;
+  case PJ_TYPE_GEOCENTRIC_CRS:        name = "geocentric_crs"; break;
+  case PJ_TYPE_GEOGRAPHIC_CRS:        name = "geographic_crs"; break;
+  case PJ_TYPE_GEOGRAPHIC_2D_CRS:     name = "geographic_2d_crs"; break;
+  case PJ_TYPE_GEOGRAPHIC_3D_CRS:     name = "geographic_3d_crs"; break;
+  case PJ_TYPE_VERTICAL_CRS:          name = "vertical_crs"; break;
+  case PJ_TYPE_PROJECTED_CRS:         name = "projected_crs"; break;
+  case PJ_TYPE_COMPOUND_CRS:          name = "compound_crs"; break;
+  case PJ_TYPE_TEMPORAL_CRS:          name = "temporal_crs"; break;
+  case PJ_TYPE_ENGINEERING_CRS:       name = "engineering_crs"; break;
+  case PJ_TYPE_BOUND_CRS:             name = "bound_crs"; break;
+#if PROJ_AT_LEAST_VERSION(9,2,0)
+  case PJ_TYPE_DERIVED_PROJECTED_CRS: name = "derived_projected_crs"; break;
+#endif
+  case PJ_TYPE_OTHER_CRS:             name = "other_crs"; break;
+  default:                            name = "crs"; break;
+  }
+
+  return ID2SYM(rb_intern(name));
+}
+
+static VALUE
+database_str (const char *str)
+{
+  return ( str ) ? rb_str_new2(str) : Qnil;
+}
+
+/*
+Returns the list of CRS in the database as an Array of
+[auth_name, code, name, type, deprecated, west, south, east, north,
+area_name, projection_method_name, celestial_body_name]
+(the bbox members are nil if the area of use is unknown).
+
+@private
+*/
+static VALUE
+rb_proj_s_crs_info_list (VALUE klass, VALUE vauth)
+{
+  volatile VALUE vlist;
+  PROJ_CRS_LIST_PARAMETERS *params;
+  PROJ_CRS_INFO **list, *info;
+  VALUE vrec;
+  int count, i;
+
+  params = proj_get_crs_list_parameters_create();
+  params->allow_deprecated = 1;
+
+  list = proj_get_crs_info_list_from_database(PJ_DEFAULT_CTX,
+                                              NIL_P(vauth) ? NULL : StringValueCStr(vauth),
+                                              params, &count);
+  proj_get_crs_list_parameters_destroy(params);
+
+  if ( ! list ) {
+    rb_raise(rb_eRuntimeError, "failed to get CRS list from database");
+  }
+
+  vlist = rb_ary_new_capa(count);
+  for (i=0; i<count; i++) {
+    info = list[i];
+    vrec = rb_ary_new_capa(12);
+    rb_ary_push(vrec, database_str(info->auth_name));
+    rb_ary_push(vrec, database_str(info->code));
+    rb_ary_push(vrec, database_str(info->name));
+    rb_ary_push(vrec, database_type_name(info->type));
+    rb_ary_push(vrec, info->deprecated ? Qtrue : Qfalse);
+    if ( info->bbox_valid ) {
+      rb_ary_push(vrec, rb_float_new(info->west_lon_degree));
+      rb_ary_push(vrec, rb_float_new(info->south_lat_degree));
+      rb_ary_push(vrec, rb_float_new(info->east_lon_degree));
+      rb_ary_push(vrec, rb_float_new(info->north_lat_degree));
+    }
+    else {
+      rb_ary_push(vrec, Qnil);
+      rb_ary_push(vrec, Qnil);
+      rb_ary_push(vrec, Qnil);
+      rb_ary_push(vrec, Qnil);
+    }
+    rb_ary_push(vrec, database_str(info->area_name));
+    rb_ary_push(vrec, database_str(info->projection_method_name));
+#if PROJ_AT_LEAST_VERSION(8,1,0)
+    rb_ary_push(vrec, database_str(info->celestial_body_name));
+#else
+    rb_ary_push(vrec, Qnil);
+#endif
+    rb_ary_push(vlist, vrec);
+  }
+
+  proj_crs_info_list_destroy(list);
+
+  return vlist;
+}
+
+void
+Init_simple_proj_database (void)
+{
+  rb_define_singleton_method(rb_cCrs, "_crs_info_list", rb_proj_s_crs_info_list, 1);
+}
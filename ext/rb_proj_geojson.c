@@ -0,0 +1,299 @@
+#include "ruby.h"
+#include "rb_proj.h"
+
+#include <math.h>
+#include <string.h>
+
+/*
+Reprojection of GeoJSON geometries (parsed into Hash and Array).
+
+The positions are collected into an Array while walking the structure,
+transformed in one batch by proj_trans_generic, and written back.
+"bbox" members of the visited objects are recomputed.
+*/
+
+typedef struct {
+  VALUE vpos;     /* Array of positions (Array of Numeric) */
+  VALUE vbbox;    /* Array of [object, first, last] for objects with bbox */
+} geojson_walk;
+
+static VALUE
+geojson_get (VALUE hash, const char *key)
+{
+  VALUE v = rb_hash_lookup2(hash, rb_str_new_cstr(key), Qundef);
+  if ( v == Qundef ) {
+    v = rb_hash_lookup2(hash, ID2SYM(rb_intern(key)), Qnil);
+  }
+  return v;
+}
+
+static void
+geojson_collect (geojson_walk *w, VALUE vcoords, int depth)
+{
+  long i;
+
+  Check_Type(vcoords, T_ARRAY);
+
+  if ( depth == 0 ) {
+    if ( RARRAY_LEN(vcoords) < 2 ) {
+      rb_raise(rb_eArgError, "position should have two or more elements");
+    }
+    rb_ary_push(w->vpos, vcoords);
+    return;
+  }
+
+  for (i=0; i<RARRAY_LEN(vcoords); i++) {
+    geojson_collect(w, RARRAY_AREF(vcoords, i), depth - 1);
+  }
+}
+
+static int
+geojson_depth (VALUE vtype)
+{
+  const char *type;
+
+  Check_Type(vtype, T_STRING);
+  type = StringValueCStr(vtype);
+
+  if ( ! strcmp(type, "Point") ) {
+    return 0;
+  }
+  else if ( ! strcmp(type, "MultiPoint") || ! strcmp(type, "LineString") ) {
+    return 1;
+  }
+  else if ( ! strcmp(type, "MultiLineString") || ! strcmp(type, "Polygon") ) {
+    return 2;
+  }
+  else if ( ! strcmp(type, "MultiPolygon") ) {
+    return 3;
+  }
+  return -1;
+}
+
+static void
+geojson_walk_object (geojson_walk *w, VALUE vobj)
+{
+  volatile VALUE vtype, vmember;
+  const char *type;
+  long first, i;
+  int depth;
+
+  if ( NIL_P(vobj) ) {   /* feature without geometry */
+    return;
+  }
+
+  Check_Type(vobj, T_HASH);
+
+  vtype = geojson_get(vobj, "type");
+  if ( SYMBOL_P(vtype) ) {
+    vtype = rb_sym2str(vtype);
+  }
+  if ( ! RB_TYPE_P(vtype, T_STRING) ) {
+    rb_raise(rb_eArgError, "GeoJSON object without type");
+  }
+  type  = StringValueCStr(vtype);
+  first = RARRAY_LEN(w->vpos);
+
+  if ( ! strcmp(type, "FeatureCollection") ) {
+    vmember = geojson_get(vobj, "features");
+    Check_Type(vmember, T_ARRAY);
+    for (i=0; i<RARRAY_LEN(vmember); i++) {
+      geojson_walk_object(w, RARRAY_AREF(vmember, i));
+    }
+  }
+  else if ( ! strcmp(type, "Feature") ) {
+    geojson_walk_object(w, geojson_get(vobj, "geometry"));
+  }
+  else if ( ! strcmp(type, "GeometryCollection") ) {
+    vmember = geojson_get(vobj, "geometries");
+    Check_Type(vmember, T_ARRAY);
+    for (i=0; i<RARRAY_LEN(vmember); i++) {
+      geojson_walk_object(w, RARRAY_AREF(vmember, i));
+    }
+  }
+  else if ( ( depth = geojson_depth(vtype) ) >= 0 ) {
+    geojson_collect(w, geojson_get(vobj, "coordinates"), depth);
+  }
+  else {
+    rb_raise(rb_eArgError, "unknown GeoJSON type '%s'", type);
+  }
+
+  if ( RB_TYPE_P(geojson_get(vobj, "bbox"), T_ARRAY) ) {
+    rb_ary_push(w->vbbox, rb_ary_new3(3, vobj, LONG2NUM(first), LONG2NUM(RARRAY_LEN(w->vpos))));
+  }
+}
+
+static void
+geojson_update_bbox (VALUE vobj, long first, long last,
+                     const double *x, const double *y, const double *z, const int *has_z)
+{
+  volatile VALUE vkey, vbbox;
+  double min[3] = { HUGE_VAL, HUGE_VAL, HUGE_VAL };
+  double max[3] = { -HUGE_VAL, -HUGE_VAL, -HUGE_VAL };
+  long i;
+  int ndim;
+
+  vkey  = rb_str_new_cstr("bbox");
+  vbbox = rb_hash_lookup2(vobj, vkey, Qundef);
+  if ( vbbox == Qundef ) {
+    vkey  = ID2SYM(rb_intern("bbox"));
+    vbbox = rb_hash_aref(vobj, vkey);
+  }
+  if ( first >= last ) {
+    return;
+  }
+
+  ndim = ( RARRAY_LEN(vbbox) == 6 ) ? 3 : 2;
+
+  for (i=first; i<last; i++) {
+    if ( x[i] < min[0] ) min[0] = x[i];
+    if ( x[i] > max[0] ) max[0] = x[i];
+    if ( y[i] < min[1] ) min[1] = y[i];
+    if ( y[i] > max[1] ) max[1] = y[i];
+    if ( has_z[i] ) {
+      if ( z[i] < min[2] ) min[2] = z[i];
+      if ( z[i] > max[2] ) max[2] = z[i];
+    }
+  }
+
+  if ( ndim == 3 && min[2] <= max[2] ) {
+    vbbox = rb_ary_new3(6, rb_float_new(min[0]), rb_float_new(min[1]), rb_float_new(min[2]),
+                           rb_float_new(max[0]), rb_float_new(max[1]), rb_float_new(max[2]));
+  }
+  else {
+    vbbox = rb_ary_new3(4, rb_float_new(min[0]), rb_float_new(min[1]),
+                           rb_float_new(max[0]), rb_float_new(max[1]));
+  }
+  rb_hash_aset(vobj, vkey, vbbox);
+}
+
+/*
+Transforms the coordinates of GeoJSON object (Hash parsed from GeoJSON) in place.
+See PROJ#transform_geojson.
+
+@private
+*/
+static VALUE
+rb_proj_transform_geojson (VALUE self, VALUE vobj, VALUE vdir, VALUE vlatlon)
+{
+  volatile VALUE vx, vy, vz, vflag;
+  geojson_walk w;
+  Proj *proj;
+  PJ_DIRECTION direction;
+  double *x, *y, *z, *t;
+  int *has_z, in_ang = 0, out_ang = 0, latlon, errno;
+  long n, i;
+  VALUE vp;
+
+  proj = rb_proj_get_struct(self);
+
+  if ( rb_to_id(vdir) == id_forward ) {
+    direction = PJ_FWD;
+  }
+  else if ( rb_to_id(vdir) == id_inverse ) {
+    direction = PJ_INV;
+  }
+  else {
+    rb_raise(rb_eArgError, "invalid direction");
+  }
+  latlon = RTEST(vlatlon);
+
+  /* units follow #forward and #inverse if the source is latlong */
+  if ( proj->forward ) {
+    in_ang  = ( proj_angular_input(proj->ref, direction) == 1 );
+    out_ang = ( proj_angular_output(proj->ref, direction) == 1 );
+  }
+
+  w.vpos  = rb_ary_new();
+  w.vbbox = rb_ary_new();
+  geojson_walk_object(&w, vobj);
+
+  n = RARRAY_LEN(w.vpos);
+  if ( n == 0 ) {
+    return vobj;
+  }
+
+  vx = rb_proj_buffer_new(n, &x);
+  vy = rb_proj_buffer_new(n, &y);
+  vz = rb_proj_buffer_new(n, &z);
+  vflag = rb_str_new(NULL, n * sizeof(int));
+  has_z = (int *) RSTRING_PTR(vflag);
+
+  for (i=0; i<n; i++) {
+    vp = RARRAY_AREF(w.vpos, i);
+    x[i] = NUM2DBL(RARRAY_AREF(vp, 0));
+    y[i] = NUM2DBL(RARRAY_AREF(vp, 1));
+    has_z[i] = ( RARRAY_LEN(vp) >= 3 );
+    z[i] = ( has_z[i] ) ? NUM2DBL(RARRAY_AREF(vp, 2)) : 0.0;
+  }
+
+  /* as #forward_latlon, positions are given as (lat, lon) */
+  if ( latlon && direction == PJ_FWD ) {
+    t = x; x = y; y = t;
+  }
+
+  if ( in_ang ) {
+    for (i=0; i<n; i++) {
+      x[i] = proj_torad(x[i]);
+      y[i] = proj_torad(y[i]);
+    }
+  }
+
+  proj_errno_reset(proj->ref);
+  proj_trans_generic(proj->ref, direction,
+                     x, sizeof(double), n,
+                     y, sizeof(double), n,
+                     z, sizeof(double), n,
+                     NULL, 0, 0);
+
+  for (i=0; i<n; i++) {
+    if ( x[i] == HUGE_VAL || y[i] == HUGE_VAL ) {
+      errno = proj_errno(proj->ref);
+      rb_raise(rb_eRuntimeError, "%s",
+               ( errno ) ? proj_errno_string(errno) : "transformation failed");
+    }
+  }
+
+  if ( out_ang ) {
+    for (i=0; i<n; i++) {
+      x[i] = proj_todeg(x[i]);
+      y[i] = proj_todeg(y[i]);
+    }
+  }
+
+  /* as #inverse_latlon, positions are returned as (lat, lon) */
+  if ( latlon && direction == PJ_INV ) {
+    t = x; x = y; y = t;
+  }
+
+  for (i=0; i<n; i++) {
+    vp = RARRAY_AREF(w.vpos, i);
+    rb_ary_store(vp, 0, rb_float_new(x[i]));
+    rb_ary_store(vp, 1, rb_float_new(y[i]));
+    if ( has_z[i] ) {
+      rb_ary_store(vp, 2, rb_float_new(z[i]));
+    }
+  }
+
+  for (i=0; i<RARRAY_LEN(w.vbbox); i++) {
+    vp = RARRAY_AREF(w.vbbox, i);
+    geojson_update_bbox(RARRAY_AREF(vp, 0),
+                        NUM2LONG(RARRAY_AREF(vp, 1)), NUM2LONG(RARRAY_AREF(vp, 2)),
+                        x, y, z, has_z);
+  }
+
+  RB_GC_GUARD(vx);
+  RB_GC_GUARD(vy);
+  RB_GC_GUARD(vz);
+  RB_GC_GUARD(vflag);
+  RB_GC_GUARD(w.vpos);
+  RB_GC_GUARD(w.vbbox);
+
+  return vobj;
+}
+
+void
+Init_simple_proj_geojson (void)
+{
+  rb_define_private_method(rb_cProj, "_transform_geojson", rb_proj_transform_geojson, 3);
+}
@@ -0,0 +1,473 @@
+#include "ruby.h"
+#include "rb_proj.h"
+
+#include <math.h>
+#include <string.h>
+
+/*
+Approximate transformation of regular grids.
+
+The grid is split into blocks whose corners, edge midpoints and center are
+transformed exactly. If the bilinear interpolation from the corners agrees
+with the exact values within max_error, the rest of the block is
+interpolated, otherwise the block is split into quarters. All exact points
+requested at one level of subdivision are transformed in one batch.
+*/
+
+/* initial block size (in pixels) */
+#define GRID_MAX_SPAN 64
+
+/* blocks smaller than this are transformed exactly instead of being split */
+#define GRID_MIN_SPAN 4
+
+enum {
+  GRID_NONE = 0,
+  GRID_PENDING,
+  GRID_EXACT
+};
+
+static int
+grid_grow (void **ptr, long count, size_t size)
+{
+  void *p = realloc(*ptr, count * size);
+  if ( ! p ) {
+    return -1;
+  }
+  *ptr = p;
+  return 0;
+}
+
+static int
+grid_request (rb_proj_grid *g, long r, long c)
+{
+  long k = r * g->ncol + c;
+
+  if ( g->state[k] != GRID_NONE ) {
+    return 0;
+  }
+  if ( g->npend >= g->cpend ) {
+    g->cpend = ( g->cpend ) ? g->cpend * 2 : 1024;
+    if ( grid_grow((void **) &g->pend, g->cpend, sizeof(long)) ||
+         grid_grow((void **) &g->px, g->cpend, sizeof(double)) ||
+         grid_grow((void **) &g->py, g->cpend, sizeof(double)) ) {
+      return -1;
+    }
+  }
+  g->state[k] = GRID_PENDING;
+  g->pend[g->npend] = k;
+  g->px[g->npend] = g->x0 + c * g->xc + r * g->xr;
+  g->py[g->npend] = g->y0 + c * g->yc + r * g->yr;
+  g->npend++;
+
+  return 0;
+}
+
+static void
+grid_flush (rb_proj_grid *g)
+{
+  long i, k;
+
+  if ( g->npend == 0 ) {
+    return;
+  }
+
+  proj_trans_generic(g->ref, g->direction,
+                     g->px, sizeof(double), g->npend,
+                     g->py, sizeof(double), g->npend,
+                     NULL, 0, 0,
+                     NULL, 0, 0);
+
+  for (i=0; i<g->npend; i++) {
+    k = g->pend[i];
+    g->x[k] = g->px[i];
+    g->y[k] = g->py[i];
+    g->state[k] = GRID_EXACT;
+  }
+
+  g->npend = 0;
+}
+
+static int
+grid_push (rb_proj_grid *g, long r0, long r1, long c0, long c1)
+{
+  rb_proj_grid_block *b;
+
+  if ( g->nnext >= g->cnext ) {
+    g->cnext = ( g->cnext ) ? g->cnext * 2 : 256;
+    if ( grid_grow((void **) &g->next, g->cnext, sizeof(rb_proj_grid_block)) ) {
+      return -1;
+    }
+  }
+  b = &g->next[g->nnext++];
+  b->r0 = r0;
+  b->r1 = r1;
+  b->c0 = c0;
+  b->c1 = c1;
+
+  return 0;
+}
+
+static void
+grid_swap (rb_proj_grid *g)
+{
+  rb_proj_grid_block *tmp = g->blocks;
+  long ctmp = g->cblocks;
+
+  g->blocks  = g->next;
+  g->cblocks = g->cnext;
+  g->nblocks = g->nnext;
+  g->next    = tmp;
+  g->cnext   = ctmp;
+  g->nnext   = 0;
+}
+
+#define GRID_MID(a, b) ( ((b) - (a) >= 2) ? ((a) + (b)) / 2 : (a) )
+
+static int
+grid_request_block (rb_proj_grid *g, const rb_proj_grid_block *b)
+{
+  long rs[3], cs[3];
+  int i, j;
+
+  rs[0] = b->r0; rs[1] = GRID_MID(b->r0, b->r1); rs[2] = b->r1;
+  cs[0] = b->c0; cs[1] = GRID_MID(b->c0, b->c1); cs[2] = b->c1;
+
+  for (i=0; i<3; i++) {
+    for (j=0; j<3; j++) {
+      if ( grid_request(g, rs[i], cs[j]) ) {
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+static void
+grid_interp (const rb_proj_grid *g, const rb_proj_grid_block *b, long r, long c,
+             double *xo, double *yo)
+{
+  long a  = b->r0 * g->ncol + b->c0;
+  long bb = b->r0 * g->ncol + b->c1;
+  long cc = b->r1 * g->ncol + b->c0;
+  long d  = b->r1 * g->ncol + b->c1;
+  double u = ( b->c1 > b->c0 ) ? (double)(c - b->c0) / (b->c1 - b->c0) : 0.0;
+  double v = ( b->r1 > b->r0 ) ? (double)(r - b->r0) / (b->r1 - b->r0) : 0.0;
+  double wa = (1-u)*(1-v), wb = u*(1-v), wc = (1-u)*v, wd = u*v;
+
+  *xo = wa * g->x[a] + wb * g->x[bb] + wc * g->x[cc] + wd * g->x[d];
+  *yo = wa * g->y[a] + wb * g->y[bb] + wc * g->y[cc] + wd * g->y[d];
+}
+
+static double
+grid_block_error (const rb_proj_grid *g, const rb_proj_grid_block *b)
+{
+  long rs[3], cs[3], k;
+  double xi, yi, ex, ey, err, maxerr = 0.0;
+  int i, j;
+
+  rs[0] = b->r0; rs[1] = GRID_MID(b->r0, b->r1); rs[2] = b->r1;
+  cs[0] = b->c0; cs[1] = GRID_MID(b->c0, b->c1); cs[2] = b->c1;
+
+  for (i=0; i<3; i++) {
+    for (j=0; j<3; j++) {
+      k = rs[i] * g->ncol + cs[j];
+      if ( ! isfinite(g->x[k]) || ! isfinite(g->y[k]) ) {
+        return HUGE_VAL;
+      }
+      grid_interp(g, b, rs[i], cs[j], &xi, &yi);
+      ex = xi - g->x[k];
+      ey = yi - g->y[k];
+      err = sqrt(ex*ex + ey*ey);
+      if ( err > maxerr ) {
+        maxerr = err;
+      }
+    }
+  }
+
+  return maxerr;
+}
+
+static void
+grid_fill_block (rb_proj_grid *g, const rb_proj_grid_block *b)
+{
+  long r, c, k;
+
+  for (r=b->r0; r<=b->r1; r++) {
+    for (c=b->c0; c<=b->c1; c++) {
+      k = r * g->ncol + c;
+      if ( g->state[k] != GRID_EXACT ) {
+        grid_interp(g, b, r, c, &g->x[k], &g->y[k]);
+      }
+    }
+  }
+}
+
+/*
+Runs the grid transformation. The caller sets ref, direction, the affine
+mapping (x0, y0, xc, xr, yc, yr), nrow, ncol, max_error and the output
+arrays x, y, and the other members zeroed. This function doesn't call the
+Ruby API, so it can be called without GVL. Returns -1 if memory allocation
+failed. rb_proj_grid_free() should be called after this.
+*/
+int
+rb_proj_grid_run (rb_proj_grid *g)
+{
+  rb_proj_grid_block *b;
+  long r0, r1, c0, c1, rm, cm, i;
+
+  g->state = calloc(g->nrow * g->ncol, sizeof(unsigned char));
+  if ( ! g->state ) {
+    return -1;
+  }
+
+  if ( g->max_error <= 0.0 ) {
+    for (r0=0; r0<g->nrow; r0++) {
+      for (c0=0; c0<g->ncol; c0++) {
+        if ( grid_request(g, r0, c0) ) return -1;
+      }
+    }
+    grid_flush(g);
+    return 0;
+  }
+
+  for (r0=0; ; r0=r1) {
+    r1 = ( r0 + GRID_MAX_SPAN < g->nrow - 1 ) ? r0 + GRID_MAX_SPAN : g->nrow - 1;
+    for (c0=0; ; c0=c1) {
+      c1 = ( c0 + GRID_MAX_SPAN < g->ncol - 1 ) ? c0 + GRID_MAX_SPAN : g->ncol - 1;
+      if ( grid_push(g, r0, r1, c0, c1) ) return -1;
+      if ( c1 >= g->ncol - 1 ) break;
+    }
+    if ( r1 >= g->nrow - 1 ) break;
+  }
+  grid_swap(g);
+
+  while ( g->nblocks > 0 ) {
+    for (i=0; i<g->nblocks; i++) {
+      if ( grid_request_block(g, &g->blocks[i]) ) return -1;
+    }
+    grid_flush(g);
+    for (i=0; i<g->nblocks; i++) {
+      b = &g->blocks[i];
+      if ( b->r1 - b->r0 <= 2 && b->c1 - b->c0 <= 2 ) {
+        continue; /* all points are exact */
+      }
+      if ( grid_block_error(g, b) <= g->max_error ) {
+        grid_fill_block(g, b);
+        continue;
+      }
+      if ( b->r1 - b->r0 <= GRID_MIN_SPAN && b->c1 - b->c0 <= GRID_MIN_SPAN ) {
+        for (r0=b->r0; r0<=b->r1; r0++) {
+          for (c0=b->c0; c0<=b->c1; c0++) {
+            if ( grid_request(g, r0, c0) ) return -1;
+          }
+        }
+        continue;
+      }
+      rm = GRID_MID(b->r0, b->r1);
+      cm = GRID_MID(b->c0, b->c1);
+      if ( rm > b->r0 && cm > b->c0 ) {
+        if ( grid_push(g, b->r0, rm, b->c0, cm) ||
+             grid_push(g, b->r0, rm, cm, b->c1) ||
+             grid_push(g, rm, b->r1, b->c0, cm) ||
+             grid_push(g, rm, b->r1, cm, b->c1) ) return -1;
+      }
+      else if ( rm > b->r0 ) {
+        if ( grid_push(g, b->r0, rm, b->c0, b->c1) ||
+             grid_push(g, rm, b->r1, b->c0, b->c1) ) return -1;
+      }
+      else {
+        if ( grid_push(g, b->r0, b->r1, b->c0, cm) ||
+             grid_push(g, b->r0, b->r1, cm, b->c1) ) return -1;
+      }
+    }
+    grid_swap(g);
+  }
+  grid_flush(g);
+
+  return 0;
+}
+
+void
+rb_proj_grid_free (rb_proj_grid *g)
+{
+  free(g->state);
+  free(g->pend);
+  free(g->px);
+  free(g->py);
+  free(g->blocks);
+  free(g->next);
+  g->state  = NULL;
+  g->pend   = NULL;
+  g->px     = NULL;
+  g->py     = NULL;
+  g->blocks = NULL;
+  g->next   = NULL;
+}
+
+typedef struct {
+  rb_proj_grid grid;
+  VALUE vxout, vyout;     /* output buffers given by `out` (or nil) */
+  long n;
+  rb_proj_buffer bx, by;
+  int status;
+} grid_args;
+
+/* the output buffers are taken here, so that grid_cleanup releases them */
+static VALUE
+grid_run (VALUE arg)
+{
+  grid_args *a = (grid_args *) arg;
+
+  if ( ! NIL_P(a->vxout) ) {
+    rb_proj_buffer_get(a->vxout, &a->bx, 1);
+    rb_proj_buffer_get(a->vyout, &a->by, 1);
+    if ( a->bx.len < a->n || a->by.len < a->n ) {
+      rb_raise(rb_eArgError, "output buffer is too small");
+    }
+    a->grid.x = a->bx.ptr;
+    a->grid.y = a->by.ptr;
+  }
+
+  a->status = rb_proj_grid_run(&a->grid);
+
+  return Qnil;
+}
+
+static VALUE
+grid_cleanup (VALUE arg)
+{
+  grid_args *a = (grid_args *) arg;
+
+  rb_proj_grid_free(&a->grid);
+  rb_proj_buffer_release(&a->bx);
+  rb_proj_buffer_release(&a->by);
+
+  return Qnil;
+}
+
+static void
+rb_proj_get_pair (VALUE vpair, const char *name, double *a, double *b)
+{
+  vpair = rb_Array(vpair);
+  if ( RARRAY_LEN(vpair) != 2 ) {
+    rb_raise(rb_eArgError, "%s should be an array with 2 elements", name);
+  }
+  *a = NUM2DBL(RARRAY_AREF(vpair, 0));
+  *b = NUM2DBL(RARRAY_AREF(vpair, 1));
+}
+
+/*
+Transforms the points of a regular grid approximately.
+
+The input point at (row i, column j) is (x0 + j*dx, y0 + i*dy).
+Points are transformed as #transform (or #transform_inverse) does,
+a sparse set of them exactly and the rest by bilinear interpolation
+with error less than max_error in units of the output coordinates.
+If max_error is 0, all points are transformed exactly.
+Points failed to be transformed are set to Float::INFINITY.
+
+The output buffers are returned as Strings packed with native doubles
+in row-major order, or, if `out` is given, are written into the given
+buffers (packed Strings or objects exporting a writable MemoryView of doubles).
+
+@overload transform_grid(origin, spacing, shape, max_error: 0.0, direction: :forward, out: nil)
+  @param origin [Array] [x0, y0]
+  @param spacing [Array] [dx, dy]
+  @param shape [Array] [nrow, ncol]
+  @param max_error [Numeric] error bound of interpolation
+  @param direction [Symbol] :forward or :inverse
+  @param out [Array, nil] [xbuf, ybuf]
+
+@return [Array] [xbuf, ybuf]
+
+@example
+  x, y = pj.transform_grid([135.0, 35.0], [0.01, -0.01], [1000, 1000], max_error: 0.1)
+  x.unpack("d*")
+*/
+static VALUE
+rb_proj_transform_grid (int argc, VALUE *argv, VALUE self)
+{
+  volatile VALUE vorigin, vspacing, vshape, vopts, vxout, vyout;
+  ID kw_ids[3];
+  VALUE kw_vals[3];
+  Proj *proj;
+  grid_args a;
+  rb_proj_grid *g = &a.grid;
+  double dx, dy;
+  long n;
+
+  rb_scan_args(argc, argv, "3:", (VALUE *)&vorigin, (VALUE *)&vspacing,
+                                 (VALUE *)&vshape, (VALUE *)&vopts);
+
+  proj = rb_proj_get_struct(self);
+
+  memset(&a, 0, sizeof(grid_args));
+  a.vxout = Qnil;
+  a.vyout = Qnil;
+
+  kw_ids[0] = rb_intern("max_error");
+  kw_ids[1] = rb_intern("direction");
+  kw_ids[2] = rb_intern("out");
+  rb_get_kwargs(vopts, kw_ids, 0, 3, kw_vals);
+
+  rb_proj_get_pair(vorigin, "origin", &g->x0, &g->y0);
+  rb_proj_get_pair(vspacing, "spacing", &dx, &dy);
+  g->xc = dx;
+  g->yr = dy;
+  vshape = rb_Array(vshape);
+  if ( RARRAY_LEN(vshape) != 2 ) {
+    rb_raise(rb_eArgError, "shape should be an array with 2 elements");
+  }
+  g->nrow = NUM2LONG(RARRAY_AREF(vshape, 0));
+  g->ncol = NUM2LONG(RARRAY_AREF(vshape, 1));
+  if ( g->nrow <= 0 || g->ncol <= 0 ) {
+    rb_raise(rb_eArgError, "invalid shape");
+  }
+  n = rb_proj_shape_size(g->nrow, g->ncol);
+
+  g->max_error = ( kw_vals[0] == Qundef ) ? 0.0 : NUM2DBL(kw_vals[0]);
+  if ( g->max_error < 0.0 ) {
+    rb_raise(rb_eArgError, "max_error should be non-negative");
+  }
+
+  g->direction = PJ_FWD;
+  if ( kw_vals[1] != Qundef ) {
+    if ( rb_to_id(kw_vals[1]) == id_inverse ) {
+      g->direction = PJ_INV;
+    }
+    else if ( rb_to_id(kw_vals[1]) != id_forward ) {
+      rb_raise(rb_eArgError, "invalid direction");
+    }
+  }
+
+  if ( kw_vals[2] == Qundef || NIL_P(kw_vals[2]) ) {
+    vxout = rb_proj_buffer_new(n, &g->x);
+    vyout = rb_proj_buffer_new(n, &g->y);
+  }
+  else {
+    VALUE vout = rb_Array(kw_vals[2]);
+    if ( RARRAY_LEN(vout) != 2 ) {
+      rb_raise(rb_eArgError, "out should be an array with 2 buffers");
+    }
+    vxout = a.vxout = RARRAY_AREF(vout, 0);
+    vyout = a.vyout = RARRAY_AREF(vout, 1);
+  }
+
+  g->ref = proj->ref;
+  a.n = n;
+
+  rb_ensure(grid_run, (VALUE) &a, grid_cleanup, (VALUE) &a);
+
+  if ( a.status ) {
+    rb_memerror();
+  }
+
+  return rb_assoc_new(vxout, vyout);
+}
+
+void
+Init_simple_proj_grid (void)
+{
+  rb_define_method(rb_cProj, "transform_grid", rb_proj_transform_grid, -1);
+}
@@ -0,0 +1,502 @@
+#include "ruby.h"
+#include "rb_proj.h"
+
+#include <math.h>
+#include <string.h>
+
+/*
+Adaptive densification of lines.
+
+All segments are processed level by level. At each level the midpoints
+(in the source CRS) of the segments not yet accepted are transformed in one
+batch, and a segment is accepted when the transformed midpoint deviates from
+the midpoint of the transformed end points by less than the tolerance.
+Otherwise it is replaced by its two halves, so the list stays in order.
+*/
+
+#define LINE_DEFAULT_MAX_DEPTH 16
+#define LINE_LIMIT_MAX_DEPTH   30
+
+typedef struct {
+  double sx0, sy0, sx1, sy1;   /* end points in the source CRS */
+  double tx0, ty0, tx1, ty1;   /* end points in the target CRS */
+  long part;
+  int depth;
+  int done;                    /* accepted (2: single point part) */
+} line_seg;
+
+typedef struct {
+  PJ *ref;
+  PJ_DIRECTION direction;
+  double tol2;
+  int max_depth;
+  int lon_axis;                /* -1: no antimeridian handling */
+
+  const double *x, *y;
+  long npoint;
+  long *offsets;               /* input parts (npart + 1) */
+  long npart;
+
+  /* parts after splitting at the antimeridian */
+  double *px, *py, *qx, *qy;
+  long *poff;
+  long np, cp, npoff, cpoff;
+
+  line_seg *seg, *next;
+  long nseg, cseg, cnext;
+  double *mx, *my;
+
+  rb_proj_buffer *bx, *by;
+} line_work;
+
+static int
+line_grow (void **ptr, long *cap, long need, size_t size)
+{
+  void *p;
+  long c = ( *cap > 0 ) ? *cap : 64;
+
+  if ( need <= *cap ) {
+    return 0;
+  }
+  while ( c < need ) {
+    c *= 2;
+  }
+  p = realloc(*ptr, c * size);
+  if ( ! p ) {
+    return -1;
+  }
+  *ptr = p;
+  *cap = c;
+  return 0;
+}
+
+static int
+line_push_point (line_work *w, double x, double y)
+{
+  long c = w->cp;
+  if ( line_grow((void **) &w->px, &c, w->np + 1, sizeof(double)) ) {
+    return -1;
+  }
+  c = w->cp;
+  if ( line_grow((void **) &w->py, &c, w->np + 1, sizeof(double)) ) {
+    return -1;
+  }
+  w->cp = c;
+  w->px[w->np] = x;
+  w->py[w->np] = y;
+  w->np++;
+  return 0;
+}
+
+static int
+line_push_part (line_work *w)
+{
+  if ( line_grow((void **) &w->poff, &w->cpoff, w->npoff + 1, sizeof(long)) ) {
+    return -1;
+  }
+  w->poff[w->npoff++] = w->np;
+  return 0;
+}
+
+/*
+Copies the input parts, splitting a part where a segment crosses the
+antimeridian (the segment is taken as the shorter way around).
+*/
+static int
+line_split_parts (line_work *w)
+{
+  double a0, b0, a1, b1, lon0, lon1, lat0, lat1, latc, t, edge;
+  long i, j;
+
+  for (i=0; i<w->npart; i++) {
+    if ( line_push_part(w) ) {
+      return -1;
+    }
+    for (j=w->offsets[i]; j<w->offsets[i+1]; j++) {
+      a1 = w->x[j];
+      b1 = w->y[j];
+      if ( w->lon_axis >= 0 && j > w->offsets[i] ) {
+        a0 = w->x[j-1];
+        b0 = w->y[j-1];
+        lon0 = ( w->lon_axis == 0 ) ? a0 : b0;
+        lat0 = ( w->lon_axis == 0 ) ? b0 : a0;
+        lon1 = ( w->lon_axis == 0 ) ? a1 : b1;
+        lat1 = ( w->lon_axis == 0 ) ? b1 : a1;
+        if ( fabs(lon1 - lon0) > 180.0 ) {
+          if ( lon1 - lon0 > 180.0 ) {        /* crossing westward */
+            edge = -180.0;
+            lon1 -= 360.0;
+          }
+          else {                             /* crossing eastward */
+            edge = 180.0;
+            lon1 += 360.0;
+          }
+          t = ( edge - lon0 ) / ( lon1 - lon0 );
+          latc = lat0 + t * ( lat1 - lat0 );
+          if ( ( w->lon_axis == 0 ) ? line_push_point(w, edge, latc)
+                                    : line_push_point(w, latc, edge) ) {
+            return -1;
+          }
+          if ( line_push_part(w) ) {
+            return -1;
+          }
+          if ( ( w->lon_axis == 0 ) ? line_push_point(w, -edge, latc)
+                                    : line_push_point(w, latc, -edge) ) {
+            return -1;
+          }
+        }
+      }
+      if ( line_push_point(w, a1, b1) ) {
+        return -1;
+      }
+    }
+  }
+  if ( line_push_part(w) ) {
+    return -1;
+  }
+  w->npoff--;    /* the last entry is the end of the last part */
+
+  return 0;
+}
+
+static int
+line_push_seg (line_seg **list, long *n, long *cap, const line_seg *s)
+{
+  if ( line_grow((void **) list, cap, *n + 1, sizeof(line_seg)) ) {
+    return -1;
+  }
+  (*list)[(*n)++] = *s;
+  return 0;
+}
+
+static VALUE
+line_run (VALUE arg)
+{
+  line_work *w = (line_work *) arg;
+  volatile VALUE vox, voy, voffsets;
+  line_seg s, *p, *tmp;
+  long i, j, k, nactive, nnext, nout, cm = 0, ctmp;
+  double dx, dy, *ox, *oy;
+  int errno;
+
+  if ( line_split_parts(w) ) {
+    rb_memerror();
+  }
+
+  /* transform the vertices */
+  w->qx = malloc((w->np + 1) * sizeof(double));
+  w->qy = malloc((w->np + 1) * sizeof(double));
+  if ( ! w->qx || ! w->qy ) {
+    rb_memerror();
+  }
+  memcpy(w->qx, w->px, w->np * sizeof(double));
+  memcpy(w->qy, w->py, w->np * sizeof(double));
+  proj_errno_reset(w->ref);
+  proj_trans_generic(w->ref, w->direction,
+                     w->qx, sizeof(double), w->np,
+                     w->qy, sizeof(double), w->np,
+                     NULL, 0, 0, NULL, 0, 0);
+  for (i=0; i<w->np; i++) {
+    if ( w->qx[i] == HUGE_VAL || w->qy[i] == HUGE_VAL ) {
+      errno = proj_errno(w->ref);
+      rb_raise(rb_eRuntimeError, "%s",
+               ( errno ) ? proj_errno_string(errno) : "transformation failed");
+    }
+  }
+
+  /* initial segments */
+  for (i=0; i<w->npoff; i++) {
+    long i0 = w->poff[i], i1 = w->poff[i+1];
+    memset(&s, 0, sizeof(s));
+    s.part = i;
+    if ( i1 - i0 == 1 ) {
+      s.sx0 = s.sx1 = w->px[i0];
+      s.sy0 = s.sy1 = w->py[i0];
+      s.tx0 = s.tx1 = w->qx[i0];
+      s.ty0 = s.ty1 = w->qy[i0];
+      s.done = 2;
+      if ( line_push_seg(&w->seg, &w->nseg, &w->cseg, &s) ) {
+        rb_memerror();
+      }
+      continue;
+    }
+    for (j=i0; j<i1-1; j++) {
+      s.sx0 = w->px[j];   s.sy0 = w->py[j];
+      s.sx1 = w->px[j+1]; s.sy1 = w->py[j+1];
+      s.tx0 = w->qx[j];   s.ty0 = w->qy[j];
+      s.tx1 = w->qx[j+1]; s.ty1 = w->qy[j+1];
+      if ( line_push_seg(&w->seg, &w->nseg, &w->cseg, &s) ) {
+        rb_memerror();
+      }
+    }
+  }
+
+  /* subdivide level by level */
+  for (;;) {
+    nactive = 0;
+    for (i=0; i<w->nseg; i++) {
+      if ( ! w->seg[i].done ) {
+        nactive++;
+      }
+    }
+    if ( nactive == 0 ) {
+      break;
+    }
+
+    if ( line_grow((void **) &w->mx, &cm, nactive, sizeof(double)) ) {
+      rb_memerror();
+    }
+    ctmp = 0;
+    if ( line_grow((void **) &w->my, &ctmp, cm, sizeof(double)) ) {
+      rb_memerror();
+    }
+    for (i=0, k=0; i<w->nseg; i++) {
+      p = &w->seg[i];
+      if ( ! p->done ) {
+        w->mx[k] = 0.5 * (p->sx0 + p->sx1);
+        w->my[k] = 0.5 * (p->sy0 + p->sy1);
+        k++;
+      }
+    }
+    proj_trans_generic(w->ref, w->direction,
+                       w->mx, sizeof(double), nactive,
+                       w->my, sizeof(double), nactive,
+                       NULL, 0, 0, NULL, 0, 0);
+
+    nnext = 0;
+    for (i=0, k=0; i<w->nseg; i++) {
+      p = &w->seg[i];
+      if ( p->done ) {
+        if ( line_push_seg(&w->next, &nnext, &w->cnext, p) ) {
+          rb_memerror();
+        }
+        continue;
+      }
+      dx = w->mx[k] - 0.5 * (p->tx0 + p->tx1);
+      dy = w->my[k] - 0.5 * (p->ty0 + p->ty1);
+      if ( w->mx[k] == HUGE_VAL || ! ( dx * dx + dy * dy > w->tol2 ) ||
+           p->depth >= w->max_depth ) {
+        s = *p;
+        s.done = 1;
+        if ( line_push_seg(&w->next, &nnext, &w->cnext, &s) ) {
+          rb_memerror();
+        }
+      }
+      else {
+        s = *p;
+        s.depth++;
+        s.sx1 = 0.5 * (p->sx0 + p->sx1);
+        s.sy1 = 0.5 * (p->sy0 + p->sy1);
+        s.tx1 = w->mx[k];
+        s.ty1 = w->my[k];
+        if ( line_push_seg(&w->next, &nnext, &w->cnext, &s) ) {
+          rb_memerror();
+        }
+        s = *p;
+        s.depth++;
+        s.sx0 = 0.5 * (p->sx0 + p->sx1);
+        s.sy0 = 0.5 * (p->sy0 + p->sy1);
+        s.tx0 = w->mx[k];
+        s.ty0 = w->my[k];
+        if ( line_push_seg(&w->next, &nnext, &w->cnext, &s) ) {
+          rb_memerror();
+        }
+      }
+      k++;
+    }
+
+    tmp = w->seg; w->seg = w->next; w->next = tmp;
+    ctmp = w->cseg; w->cseg = w->cnext; w->cnext = ctmp;
+    w->nseg = nnext;
+  }
+
+  /* the first point of each part and the last point of each segment */
+  nout = 0;
+  for (i=0; i<w->nseg; i++) {
+    if ( i == 0 || w->seg[i].part != w->seg[i-1].part ) {
+      nout++;
+    }
+    if ( w->seg[i].done != 2 ) {
+      nout++;
+    }
+  }
+
+  vox = rb_proj_buffer_new(nout, &ox);
+  voy = rb_proj_buffer_new(nout, &oy);
+  voffsets = rb_ary_new();
+
+  for (i=0, k=0; i<w->nseg; i++) {
+    p = &w->seg[i];
+    if ( i == 0 || p->part != w->seg[i-1].part ) {
+      rb_ary_push(voffsets, LONG2NUM(k));
+      ox[k] = p->tx0;
+      oy[k] = p->ty0;
+      k++;
+    }
+    if ( p->done != 2 ) {
+      ox[k] = p->tx1;
+      oy[k] = p->ty1;
+      k++;
+    }
+  }
+  rb_ary_push(voffsets, LONG2NUM(k));
+
+  return rb_ary_new3(3, vox, voy, voffsets);
+}
+
+static VALUE
+line_cleanup (VALUE arg)
+{
+  line_work *w = (line_work *) arg;
+
+  rb_proj_buffer_release(w->bx);
+  rb_proj_buffer_release(w->by);
+  free(w->px);
+  free(w->py);
+  free(w->qx);
+  free(w->qy);
+  free(w->poff);
+  free(w->seg);
+  free(w->next);
+  free(w->mx);
+  free(w->my);
+
+  return Qnil;
+}
+
+/*
+Transforms lines (or polygon rings) with adaptive densification.
+
+Each segment is subdivided at its midpoint in the source CRS recursively
+until the transformed midpoint deviates from the midpoint of the transformed
+end points by less than `tolerance` (in units of output coordinates)
+or the depth of subdivision reaches `max_depth`.
+The coordinates are handled as #transform (or #transform_inverse) does.
+
+The lines are given as coordinate buffers (see #transform_grid) with
+`offsets` (the start index of each part followed by the end of the last part).
+If `antimeridian` is given (:x or true if the longitude is the x coordinate,
+:y if the longitude is the y coordinate), segments crossing the antimeridian
+are taken as the shorter way around and the parts are split there.
+Empty parts are dropped.
+
+@overload transform_line(xs, ys, tolerance:, offsets: nil, max_depth: 16, antimeridian: nil, direction: :forward)
+  @param xs [String, CArray, Array] x coordinates
+  @param ys [String, CArray, Array] y coordinates
+  @param tolerance [Numeric] tolerance of the deviation
+  @param offsets [Array<Integer>, nil] offsets of the parts (default: [0, xs.size])
+
+@return [Array] [xbuf, ybuf, offsets]
+
+@example
+  pj = PROJ.new("OGC:CRS84", "EPSG:3413")
+  x, y, offsets = pj.transform_line([-170, 170], [60, 60], tolerance: 100, antimeridian: :x)
+*/
+static VALUE
+rb_proj_transform_line (int argc, VALUE *argv, VALUE self)
+{
+  volatile VALUE vxs, vys, vopts, vtmp = Qnil;
+  ID kw_ids[5];
+  VALUE kw_vals[5];
+  rb_proj_buffer bx, by;
+  line_work w;
+  Proj *proj;
+  double tolerance;
+  long i, n, whole[2];
+
+  rb_scan_args(argc, argv, "2:", (VALUE *)&vxs, (VALUE *)&vys, (VALUE *)&vopts);
+
+  proj = rb_proj_get_struct(self);
+
+  kw_ids[0] = rb_intern("tolerance");
+  kw_ids[1] = rb_intern("offsets");
+  kw_ids[2] = rb_intern("max_depth");
+  kw_ids[3] = rb_intern("antimeridian");
+  kw_ids[4] = rb_intern("direction");
+  rb_get_kwargs(vopts, kw_ids, 1, 4, kw_vals);
+
+  memset(&w, 0, sizeof(w));
+  w.ref = proj->ref;
+
+  tolerance = NUM2DBL(kw_vals[0]);
+  if ( ! ( tolerance > 0.0 ) ) {
+    rb_raise(rb_eArgError, "tolerance should be positive");
+  }
+  w.tol2 = tolerance * tolerance;
+
+  w.max_depth = LINE_DEFAULT_MAX_DEPTH;
+  if ( kw_vals[2] != Qundef && ! NIL_P(kw_vals[2]) ) {
+    w.max_depth = NUM2INT(kw_vals[2]);
+    if ( w.max_depth < 0 || w.max_depth > LINE_LIMIT_MAX_DEPTH ) {
+      rb_raise(rb_eArgError, "max_depth should be in 0..%d", LINE_LIMIT_MAX_DEPTH);
+    }
+  }
+
+  w.lon_axis = -1;
+  if ( kw_vals[3] != Qundef && RTEST(kw_vals[3]) ) {
+    if ( kw_vals[3] == Qtrue || ( SYMBOL_P(kw_vals[3]) && SYM2ID(kw_vals[3]) == rb_intern("x") ) ) {
+      w.lon_axis = 0;
+    }
+    else if ( SYMBOL_P(kw_vals[3]) && SYM2ID(kw_vals[3]) == rb_intern("y") ) {
+      w.lon_axis = 1;
+    }
+    else {
+      rb_raise(rb_eArgError, "antimeridian should be :x or :y");
+    }
+  }
+
+  w.direction = PJ_FWD;
+  if ( kw_vals[4] != Qundef && ! NIL_P(kw_vals[4]) ) {
+    if ( rb_to_id(kw_vals[4]) == id_inverse ) {
+      w.direction = PJ_INV;
+    }
+    else if ( rb_to_id(kw_vals[4]) != id_forward ) {
+      rb_raise(rb_eArgError, "invalid direction");
+    }
+  }
+
+  if ( kw_vals[1] != Qundef && ! NIL_P(kw_vals[1]) ) {
+    VALUE voff = rb_Array(kw_vals[1]);
+    w.npart = RARRAY_LEN(voff) - 1;
+    vtmp = rb_str_new(NULL, RARRAY_LEN(voff) * sizeof(long));
+    w.offsets = (long *) RSTRING_PTR(vtmp);
+    for (i=0; i<RARRAY_LEN(voff); i++) {
+      w.offsets[i] = NUM2LONG(RARRAY_AREF(voff, i));
+    }
+  }
+
+  rb_proj_buffer_get_pair(vxs, vys, &bx, &by);
+  n = ( bx.len < by.len ) ? bx.len : by.len;
+
+  if ( ! w.offsets ) {
+    w.offsets = whole;
+    w.offsets[0] = 0;
+    w.offsets[1] = n;
+    w.npart = 1;
+  }
+  for (i=0; i<=w.npart; i++) {
+    if ( w.offsets[i] < 0 || w.offsets[i] > n || ( i > 0 && w.offsets[i] < w.offsets[i-1] ) ) {
+      rb_proj_buffer_release(&bx);
+      rb_proj_buffer_release(&by);
+      rb_raise(rb_eArgError, "invalid offsets");
+    }
+  }
+
+  w.x = bx.ptr;
+  w.y = by.ptr;
+  w.npoint = n;
+
+  w.bx = &bx;
+  w.by = &by;
+
+  vtmp = rb_ensure(line_run, (VALUE) &w, line_cleanup, (VALUE) &w);
+  RB_GC_GUARD(vtmp);
+
+  return vtmp;
+}
+
+void
+Init_simple_proj_line (void)
+{
+  rb_define_method(rb_cProj, "transform_line", rb_proj_transform_line, -1);
+}
@@ -0,0 +1,349 @@
+#include "ruby.h"
+#include "rb_proj.h"
+
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <pthread.h>
+
+/*
+Result cache of a PROJ object.
+
+A fixed-size open-addressing hash table keyed on the bit patterns of the
+input coordinates and a tag of the method (direction and unit conversions).
+A key is searched in RB_PROJ_MEMO_PROBES slots from its home slot. If none
+of them is free, one of them is evicted in turn, so the memory is bounded by
+the capacity given at #enable_result_cache. Failures are cached as well.
+
+The table is guarded by a mutex, so it can be shared by threads running
+without GVL.
+*/
+
+#define RB_PROJ_MEMO_PROBES   8
+#define RB_PROJ_MEMO_MIN      16
+#define RB_PROJ_MEMO_MAX      (1L << 24)
+
+typedef struct {
+  uint64_t key[3];        /* bit patterns of x, y, z */
+  uint32_t tag;           /* 0 for empty slot */
+  int32_t  err;           /* proj_errno of failure, or -1 */
+  double out[3];
+} rb_proj_memo_entry;
+
+struct rb_proj_memo {
+  rb_proj_memo_entry *table;
+  long capacity;          /* power of 2 */
+  long count;
+  unsigned int victim;
+  unsigned long hits, misses, evictions;
+  pthread_mutex_t lock;
+};
+
+static uint64_t
+memo_mix (uint64_t h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static void
+memo_key (const double *in, uint64_t *key)
+{
+  memcpy(&key[0], &in[0], sizeof(uint64_t));
+  memcpy(&key[1], &in[1], sizeof(uint64_t));
+  memcpy(&key[2], &in[2], sizeof(uint64_t));
+}
+
+static long
+memo_home (rb_proj_memo *memo, uint32_t tag, const uint64_t *key)
+{
+  uint64_t h;
+  h = memo_mix(key[2] ^ tag);
+  h = memo_mix(key[1] ^ h);
+  h = memo_mix(key[0] ^ h);
+  return (long) (h & (uint64_t) (memo->capacity - 1));
+}
+
+static int
+memo_match (const rb_proj_memo_entry *e, uint32_t tag, const uint64_t *key)
+{
+  return e->tag == tag && e->key[0] == key[0] && e->key[1] == key[1] && e->key[2] == key[2];
+}
+
+/*
+Searches the result of (in[0], in[1], in[2]) for the method `tag` (> 0).
+Returns 1 and sets `out` and `err` (-1 for success) if found.
+*/
+int
+rb_proj_memo_lookup (rb_proj_memo *memo, unsigned int tag, const double *in,
+                     double *out, int *err)
+{
+  rb_proj_memo_entry *e;
+  uint64_t key[3];
+  long home, i;
+  int found = 0;
+
+  memo_key(in, key);
+  home = memo_home(memo, tag, key);
+
+  pthread_mutex_lock(&memo->lock);
+  for (i=0; i<RB_PROJ_MEMO_PROBES; i++) {
+    e = &memo->table[(home + i) & (memo->capacity - 1)];
+    if ( e->tag == 0 ) {
+      break;
+    }
+    if ( memo_match(e, tag, key) ) {
+      out[0] = e->out[0];
+      out[1] = e->out[1];
+      out[2] = e->out[2];
+      *err = e->err;
+      found = 1;
+      break;
+    }
+  }
+  if ( found ) {
+    memo->hits++;
+  }
+  else {
+    memo->misses++;
+  }
+  pthread_mutex_unlock(&memo->lock);
+
+  return found;
+}
+
+/*
+Stores the result of (in[0], in[1], in[2]) for the method `tag` (> 0).
+`err` is -1 for success.
+*/
+void
+rb_proj_memo_store (rb_proj_memo *memo, unsigned int tag, const double *in,
+                    const double *out, int err)
+{
+  rb_proj_memo_entry *e = NULL, *s;
+  uint64_t key[3];
+  long home, i;
+
+  memo_key(in, key);
+  home = memo_home(memo, tag, key);
+
+  pthread_mutex_lock(&memo->lock);
+  for (i=0; i<RB_PROJ_MEMO_PROBES; i++) {
+    s = &memo->table[(home + i) & (memo->capacity - 1)];
+    if ( s->tag == 0 ) {
+      memo->count++;
+      e = s;
+      break;
+    }
+    if ( memo_match(s, tag, key) ) {
+      e = s;
+      break;
+    }
+  }
+  if ( ! e ) {
+    memo->victim = (memo->victim + 1) % RB_PROJ_MEMO_PROBES;
+    e = &memo->table[(home + memo->victim) & (memo->capacity - 1)];
+    memo->evictions++;
+  }
+  e->key[0] = key[0];
+  e->key[1] = key[1];
+  e->key[2] = key[2];
+  e->tag    = tag;
+  e->err    = err;
+  e->out[0] = out[0];
+  e->out[1] = out[1];
+  e->out[2] = out[2];
+  pthread_mutex_unlock(&memo->lock);
+}
+
+void
+rb_proj_memo_clear (rb_proj_memo *memo)
+{
+  pthread_mutex_lock(&memo->lock);
+  memset(memo->table, 0, memo->capacity * sizeof(rb_proj_memo_entry));
+  memo->count = 0;
+  pthread_mutex_unlock(&memo->lock);
+}
+
+void
+rb_proj_memo_free (rb_proj_memo *memo)
+{
+  pthread_mutex_destroy(&memo->lock);
+  rb_gc_adjust_memory_usage(-(ssize_t) rb_proj_memo_memsize(memo));
+  free(memo->table);
+  free(memo);
+}
+
+size_t
+rb_proj_memo_memsize (const rb_proj_memo *memo)
+{
+  return sizeof(rb_proj_memo) + memo->capacity * sizeof(rb_proj_memo_entry);
+}
+
+static rb_proj_memo *
+memo_new (long capacity)
+{
+  rb_proj_memo *memo;
+
+  memo = calloc(1, sizeof(rb_proj_memo));
+  if ( ! memo ) {
+    rb_memerror();
+  }
+  memo->table = calloc(capacity, sizeof(rb_proj_memo_entry));
+  if ( ! memo->table ) {
+    free(memo);
+    rb_memerror();
+  }
+  memo->capacity = capacity;
+  pthread_mutex_init(&memo->lock, NULL);
+  rb_gc_adjust_memory_usage((ssize_t) rb_proj_memo_memsize(memo));
+
+  return memo;
+}
+
+/*
+Enables the result cache of the object (or resizes it, dropping the cached
+results). The results of #forward, #inverse, #transform_forward etc. and
+of the batch methods are cached by the bit patterns of the input
+coordinates, which pays off for inputs repeating the same points
+(e.g. fixed stations). The capacity is rounded up to a power of 2.
+
+@overload enable_result_cache(capacity = 4096)
+  @param capacity [Integer] number of cached results
+
+@return [self]
+
+@example
+  pj = PROJ.new("EPSG:32654").enable_result_cache(1024)
+  stations.each { |lon, lat| pj.forward(lon, lat) }
+  pj.result_cache_stats[:hit_rate]
+*/
+static VALUE
+rb_proj_enable_result_cache (int argc, VALUE *argv, VALUE self)
+{
+  VALUE vcapacity;
+  Proj *proj;
+  rb_proj_memo *old;
+  long capacity = 4096, n;
+
+  rb_scan_args(argc, argv, "01", &vcapacity);
+
+  if ( ! NIL_P(vcapacity) ) {
+    capacity = NUM2LONG(vcapacity);
+  }
+  if ( capacity <= 0 || capacity > RB_PROJ_MEMO_MAX ) {
+    rb_raise(rb_eArgError, "capacity should be in 1..%ld", RB_PROJ_MEMO_MAX);
+  }
+  for (n=RB_PROJ_MEMO_MIN; n<capacity; n<<=1)
+    ;
+
+  proj = rb_proj_get_struct(self);
+
+  old = proj->memo;
+  if ( old && old->capacity == n ) {
+    rb_proj_memo_clear(old);
+    return self;
+  }
+
+  proj->memo = memo_new(n);
+  if ( old ) {
+    rb_proj_memo_free(old);
+  }
+
+  return self;
+}
+
+/*
+Disables the result cache of the object and releases it.
+
+@return [self]
+*/
+static VALUE
+rb_proj_disable_result_cache (VALUE self)
+{
+  Proj *proj;
+  rb_proj_memo *memo;
+
+  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+
+  memo = proj->memo;
+  if ( memo ) {
+    proj->memo = NULL;
+    rb_proj_memo_free(memo);
+  }
+
+  return self;
+}
+
+/*
+Drops the cached results (the statistics are kept).
+
+@return [self]
+*/
+static VALUE
+rb_proj_clear_result_cache (VALUE self)
+{
+  Proj *proj;
+
+  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+
+  if ( proj->memo ) {
+    rb_proj_memo_clear(proj->memo);
+  }
+
+  return self;
+}
+
+/*
+Returns the statistics of the result cache, or nil if it is disabled.
+
+@return [Hash, nil] {capacity:, size:, hits:, misses:, evictions:, hit_rate:}
+*/
+static VALUE
+rb_proj_result_cache_stats (VALUE self)
+{
+  Proj *proj;
+  rb_proj_memo *memo;
+  unsigned long hits, misses, evictions;
+  long count;
+  VALUE vstats;
+
+  TypedData_Get_Struct(self, Proj, &proj_data_type, proj);
+
+  memo = proj->memo;
+  if ( ! memo ) {
+    return Qnil;
+  }
+
+  pthread_mutex_lock(&memo->lock);
+  hits      = memo->hits;
+  misses    = memo->misses;
+  evictions = memo->evictions;
+  count     = memo->count;
+  pthread_mutex_unlock(&memo->lock);
+
+  vstats = rb_hash_new();
+  rb_hash_aset(vstats, ID2SYM(rb_intern("capacity")), LONG2NUM(memo->capacity));
+  rb_hash_aset(vstats, ID2SYM(rb_intern("size")), LONG2NUM(count));
+  rb_hash_aset(vstats, ID2SYM(rb_intern("hits")), ULONG2NUM(hits));
+  rb_hash_aset(vstats, ID2SYM(rb_intern("misses")), ULONG2NUM(misses));
+  rb_hash_aset(vstats, ID2SYM(rb_intern("evictions")), ULONG2NUM(evictions));
+  rb_hash_aset(vstats, ID2SYM(rb_intern("hit_rate")),
+               rb_float_new(( hits + misses > 0 ) ? (double) hits / (double) (hits + misses) : 0.0));
+
+  return vstats;
+}
+
+void
+Init_simple_proj_memo (void)
+{
+  rb_define_method(rb_cProj, "enable_result_cache", rb_proj_enable_result_cache, -1);
+  rb_define_method(rb_cProj, "disable_result_cache", rb_proj_disable_result_cache, 0);
+  rb_define_method(rb_cProj, "clear_result_cache", rb_proj_clear_result_cache, 0);
+  rb_define_method(rb_cProj, "result_cache_stats", rb_proj_result_cache_stats, 0);
+}
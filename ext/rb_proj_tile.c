@@ -0,0 +1,612 @@
+#include "ruby.h"
+#include "rb_proj.h"
+
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+
+/*
+Tile pyramid on a Mercator-like target CRS (XYZ scheme, row 0 at north).
+
+The pyramid is bound to a PROJ object transforming coordinates from any
+source CRS to the target CRS. The zoom 0 tile covers `extent` of the target
+CRS, which defaults to the extent of EPSG:3857.
+*/
+
+#define TILE_WEBMERC_HALF_WIDTH 20037508.342789244
+
+/* number of points transformed at once */
+#define TILE_CHUNK 1024
+
+#define TILE_MAX_ZOOM 30
+
+typedef struct {
+  VALUE vproj;
+  double minx, miny, maxx, maxy;
+  int tile_size;
+} TilePyramid;
+
+static VALUE rb_cTilePyramid;
+
+static void
+tile_mark (void *ptr)
+{
+  TilePyramid *tp = ptr;
+  rb_gc_mark_movable(tp->vproj);
+}
+
+static void
+tile_compact (void *ptr)
+{
+  TilePyramid *tp = ptr;
+  tp->vproj = rb_gc_location(tp->vproj);
+}
+
+static size_t
+tile_memsize (const void *ptr)
+{
+  return sizeof(TilePyramid);
+}
+
+static const rb_data_type_t tile_data_type = {
+    .wrap_struct_name = "TilePyramid",
+    .function = {
+        .dmark = tile_mark,
+        .dfree = RUBY_TYPED_DEFAULT_FREE,
+        .dsize = tile_memsize,
+        .dcompact = tile_compact,
+    },
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+static VALUE
+rb_tile_s_allocate (VALUE klass)
+{
+  TilePyramid *tp;
+  VALUE obj = TypedData_Make_Struct(klass, TilePyramid, &tile_data_type, tp);
+  tp->vproj = Qnil;
+  return obj;
+}
+
+static PJ *
+tile_get_ref (TilePyramid *tp)
+{
+  Proj *proj;
+  proj = rb_proj_get_struct(tp->vproj);
+  return proj->ref;
+}
+
+static int
+tile_check_zoom (VALUE vzoom)
+{
+  int zoom = NUM2INT(vzoom);
+  if ( zoom < 0 || zoom > TILE_MAX_ZOOM ) {
+    rb_raise(rb_eArgError, "zoom level should be in 0..%d", TILE_MAX_ZOOM);
+  }
+  return zoom;
+}
+
+/* checks a String given as int32 output buffer */
+static void
+tile_check_int_buffer (VALUE vbuf)
+{
+  if ( ! NIL_P(vbuf) ) {
+    Check_Type(vbuf, T_STRING);
+    rb_str_modify(vbuf);
+  }
+}
+
+/*
+Creates a tile pyramid bound to the PROJ object.
+
+@overload initialize(proj, tile_size: 256, extent: nil)
+  @param proj [PROJ] transformation from the source CRS to a Mercator-like target CRS
+  @param tile_size [Integer] width and height of a tile in pixels
+  @param extent [Array, nil] [xmin, ymin, xmax, ymax] of zoom 0 tile in the target CRS
+*/
+static VALUE
+rb_tile_initialize (int argc, VALUE *argv, VALUE self)
+{
+  volatile VALUE vproj, vopts;
+  ID kw_ids[2];
+  VALUE kw_vals[2];
+  TilePyramid *tp;
+
+  rb_scan_args(argc, argv, "1:", (VALUE *)&vproj, (VALUE *)&vopts);
+
+  TypedData_Get_Struct(self, TilePyramid, &tile_data_type, tp);
+
+  if ( ! rb_obj_is_kind_of(vproj, rb_cProj) ) {
+    rb_raise(rb_eTypeError, "PROJ object required");
+  }
+
+  kw_ids[0] = rb_intern("tile_size");
+  kw_ids[1] = rb_intern("extent");
+  rb_get_kwargs(vopts, kw_ids, 0, 2, kw_vals);
+
+  tp->tile_size = ( kw_vals[0] == Qundef ) ? 256 : NUM2INT(kw_vals[0]);
+  if ( tp->tile_size <= 0 ) {
+    rb_raise(rb_eArgError, "invalid tile_size");
+  }
+
+  if ( kw_vals[1] == Qundef || NIL_P(kw_vals[1]) ) {
+    tp->minx = -TILE_WEBMERC_HALF_WIDTH;
+    tp->miny = -TILE_WEBMERC_HALF_WIDTH;
+    tp->maxx =  TILE_WEBMERC_HALF_WIDTH;
+    tp->maxy =  TILE_WEBMERC_HALF_WIDTH;
+  }
+  else {
+    VALUE vext = rb_Array(kw_vals[1]);
+    if ( RARRAY_LEN(vext) != 4 ) {
+      rb_raise(rb_eArgError, "extent should be an array with 4 elements");
+    }
+    tp->minx = NUM2DBL(RARRAY_AREF(vext, 0));
+    tp->miny = NUM2DBL(RARRAY_AREF(vext, 1));
+    tp->maxx = NUM2DBL(RARRAY_AREF(vext, 2));
+    tp->maxy = NUM2DBL(RARRAY_AREF(vext, 3));
+    if ( tp->minx >= tp->maxx || tp->miny >= tp->maxy ) {
+      rb_raise(rb_eArgError, "invalid extent");
+    }
+  }
+
+  RB_OBJ_WRITE(self, &tp->vproj, vproj);
+
+  return Qnil;
+}
+
+/*
+Returns the PROJ object.
+
+@return [PROJ]
+*/
+static VALUE
+rb_tile_proj (VALUE self)
+{
+  TilePyramid *tp;
+  TypedData_Get_Struct(self, TilePyramid, &tile_data_type, tp);
+  return tp->vproj;
+}
+
+/*
+Returns the tile size in pixels.
+
+@return [Integer]
+*/
+static VALUE
+rb_tile_tile_size (VALUE self)
+{
+  TilePyramid *tp;
+  TypedData_Get_Struct(self, TilePyramid, &tile_data_type, tp);
+  return INT2NUM(tp->tile_size);
+}
+
+/*
+Returns the extent of zoom 0 tile in the target CRS.
+
+@return [Array] [xmin, ymin, xmax, ymax]
+*/
+static VALUE
+rb_tile_extent (VALUE self)
+{
+  TilePyramid *tp;
+  TypedData_Get_Struct(self, TilePyramid, &tile_data_type, tp);
+  return rb_ary_new3(4, rb_float_new(tp->minx), rb_float_new(tp->miny),
+                        rb_float_new(tp->maxx), rb_float_new(tp->maxy));
+}
+
+/* target coordinates to fractional tile coordinates */
+static inline int
+tile_locate (const TilePyramid *tp, double n, double x, double y,
+             int32_t *tx, int32_t *ty, double *px, double *py)
+{
+  double fx, fy;
+
+  if ( ! isfinite(x) || ! isfinite(y) ||
+       x < tp->minx || x > tp->maxx || y < tp->miny || y > tp->maxy ) {
+    *tx = *ty = -1;
+    *px = *py = NAN;
+    return 0;
+  }
+
+  fx = (x - tp->minx) / (tp->maxx - tp->minx) * n;
+  fy = (tp->maxy - y) / (tp->maxy - tp->miny) * n;
+  *tx = (int32_t) floor(fx);
+  *ty = (int32_t) floor(fy);
+  if ( *tx >= n ) *tx = (int32_t) n - 1;
+  if ( *ty >= n ) *ty = (int32_t) n - 1;
+  *px = (fx - *tx) * tp->tile_size;
+  *py = (fy - *ty) * tp->tile_size;
+
+  return 1;
+}
+
+typedef struct {
+  TilePyramid *tp;
+  PJ *ref;
+  int zoom;
+  VALUE vxs, vys, vtx, vty, vpx, vpy;
+  rb_proj_buffer bx, by, bpx, bpy;
+} tile_locate_args;
+
+/* the buffers are taken here, so that tile_locate_cleanup releases them */
+static VALUE
+tile_locate_run (VALUE arg)
+{
+  tile_locate_args *a = (tile_locate_args *) arg;
+  double tmpx[TILE_CHUNK], tmpy[TILE_CHUNK];
+  double n = ldexp(1.0, a->zoom), *px, *py;
+  int32_t *tx, *ty;
+  long len, i, k, m;
+
+  rb_proj_buffer_get(a->vxs, &a->bx, 0);
+  rb_proj_buffer_get(a->vys, &a->by, 0);
+  len = ( a->bx.len < a->by.len ) ? a->bx.len : a->by.len;
+
+  if ( ! NIL_P(a->vpx) ) {
+    rb_proj_buffer_get(a->vpx, &a->bpx, 1);
+    rb_proj_buffer_get(a->vpy, &a->bpy, 1);
+  }
+
+  if ( ( ! NIL_P(a->vtx) && ( RSTRING_LEN(a->vtx) < (long) (len * sizeof(int32_t)) ||
+                              RSTRING_LEN(a->vty) < (long) (len * sizeof(int32_t)) ) ) ||
+       ( ! NIL_P(a->vpx) && ( a->bpx.len < len || a->bpy.len < len ) ) ) {
+    rb_raise(rb_eArgError, "output buffer is too small");
+  }
+
+  if ( NIL_P(a->vtx) ) {
+    a->vtx = rb_str_new(NULL, len * sizeof(int32_t));
+    a->vty = rb_str_new(NULL, len * sizeof(int32_t));
+  }
+  tx = (int32_t *) RSTRING_PTR(a->vtx);
+  ty = (int32_t *) RSTRING_PTR(a->vty);
+
+  if ( NIL_P(a->vpx) ) {
+    a->vpx = rb_proj_buffer_new(len, &px);
+    a->vpy = rb_proj_buffer_new(len, &py);
+  }
+  else {
+    px = a->bpx.ptr;
+    py = a->bpy.ptr;
+  }
+
+  for (i=0; i<len; i+=TILE_CHUNK) {
+    m = ( len - i < TILE_CHUNK ) ? len - i : TILE_CHUNK;
+    memcpy(tmpx, a->bx.ptr + i, m * sizeof(double));
+    memcpy(tmpy, a->by.ptr + i, m * sizeof(double));
+    proj_trans_generic(a->ref, PJ_FWD,
+                       tmpx, sizeof(double), m,
+                       tmpy, sizeof(double), m,
+                       NULL, 0, 0, NULL, 0, 0);
+    for (k=0; k<m; k++) {
+      tile_locate(a->tp, n, tmpx[k], tmpy[k], &tx[i+k], &ty[i+k], &px[i+k], &py[i+k]);
+    }
+  }
+
+  return Qnil;
+}
+
+static VALUE
+tile_locate_cleanup (VALUE arg)
+{
+  tile_locate_args *a = (tile_locate_args *) arg;
+
+  rb_proj_buffer_release(&a->bx);
+  rb_proj_buffer_release(&a->by);
+  rb_proj_buffer_release(&a->bpx);
+  rb_proj_buffer_release(&a->bpy);
+
+  return Qnil;
+}
+
+/*
+Locates the points in the tiles at the zoom level.
+
+The input coordinates are in the source CRS of the PROJ object (as #transform).
+Returns the tile indices as Strings packed with int32 and the pixel offsets
+in the tiles as Strings packed with doubles. Points which can not be
+transformed or are outside the extent get tile index -1 and offset NaN.
+The output buffers can be given by `out` (nil for a pair of them to allocate
+new ones).
+
+@overload locate(xs, ys, zoom, out: nil)
+  @param xs [String, CArray, Array] x coordinates in source CRS
+  @param ys [String, CArray, Array] y coordinates in source CRS
+  @param zoom [Integer] zoom level
+  @param out [Array, nil] [tx, ty, px, py] output buffers
+
+@return [Array] [tx, ty, px, py]
+
+@example
+  tiles = PROJ::TilePyramid.new(PROJ.new("OGC:CRS84", "EPSG:3857"))
+  tx, ty, px, py = tiles.locate(lons, lats, 12)
+  tx.unpack("l*")
+*/
+static VALUE
+rb_tile_locate (int argc, VALUE *argv, VALUE self)
+{
+  volatile VALUE vxs, vys, vzoom, vopts;
+  ID kw_ids[1];
+  VALUE kw_vals[1];
+  tile_locate_args a;
+
+  rb_scan_args(argc, argv, "3:", (VALUE *)&vxs, (VALUE *)&vys, (VALUE *)&vzoom, (VALUE *)&vopts);
+
+  memset(&a, 0, sizeof(tile_locate_args));
+
+  TypedData_Get_Struct(self, TilePyramid, &tile_data_type, a.tp);
+
+  kw_ids[0] = rb_intern("out");
+  rb_get_kwargs(vopts, kw_ids, 0, 1, kw_vals);
+
+  a.zoom = tile_check_zoom(vzoom);
+  a.ref  = tile_get_ref(a.tp);
+  a.vxs  = vxs;
+  a.vys  = vys;
+
+  if ( kw_vals[0] != Qundef && ! NIL_P(kw_vals[0]) ) {
+    VALUE vout = rb_Array(kw_vals[0]);
+    if ( RARRAY_LEN(vout) != 4 ) {
+      rb_raise(rb_eArgError, "out should be an array with 4 buffers");
+    }
+    a.vtx = RARRAY_AREF(vout, 0);
+    a.vty = RARRAY_AREF(vout, 1);
+    a.vpx = RARRAY_AREF(vout, 2);
+    a.vpy = RARRAY_AREF(vout, 3);
+  }
+  else {
+    a.vtx = a.vty = a.vpx = a.vpy = Qnil;
+  }
+
+  if ( NIL_P(a.vtx) != NIL_P(a.vty) || NIL_P(a.vpx) != NIL_P(a.vpy) ) {
+    rb_raise(rb_eArgError, "out buffers should be given in pairs ([tx, ty] and [px, py])");
+  }
+
+  tile_check_int_buffer(a.vtx);
+  tile_check_int_buffer(a.vty);
+
+  rb_ensure(tile_locate_run, (VALUE) &a, tile_locate_cleanup, (VALUE) &a);
+
+  RB_GC_GUARD(vxs);
+  RB_GC_GUARD(vys);
+
+  return rb_ary_new3(4, a.vtx, a.vty, a.vpx, a.vpy);
+}
+
+/*
+Computes the bounds of a tile in the source CRS. Each edge of the tile
+is densified with `densify` points before inversely transformed.
+Returns 0 for a tile out of the pyramid (e.g. -1 given by #locate).
+*/
+static int
+tile_bounds_i (const TilePyramid *tp, PJ *ref, int zoom, double tx, double ty,
+               int densify, double *bounds)
+{
+  double n = ldexp(1.0, zoom);
+  double w = (tp->maxx - tp->minx) / n, h = (tp->maxy - tp->miny) / n;
+  double x0 = tp->minx + tx * w, y1 = tp->maxy - ty * h;
+  double xs[TILE_CHUNK], ys[TILE_CHUNK];
+  double t;
+  int i, m = 0, nseg = densify + 1, valid = 0;
+
+  if ( ! ( tx >= 0.0 && tx < n && ty >= 0.0 && ty < n ) ) {
+    return 0;
+  }
+
+  for (i=0; i<nseg; i++) {
+    t = (double) i / nseg;
+    xs[m] = x0 + t * w;     ys[m] = y1;          m++;  /* north */
+    xs[m] = x0 + w;         ys[m] = y1 - t * h;  m++;  /* east  */
+    xs[m] = x0 + w - t * w; ys[m] = y1 - h;      m++;  /* south */
+    xs[m] = x0;             ys[m] = y1 - h + t * h; m++; /* west */
+  }
+
+  proj_trans_generic(ref, PJ_INV,
+                     xs, sizeof(double), m,
+                     ys, sizeof(double), m,
+                     NULL, 0, 0, NULL, 0, 0);
+
+  bounds[0] = bounds[1] =  HUGE_VAL;
+  bounds[2] = bounds[3] = -HUGE_VAL;
+  for (i=0; i<m; i++) {
+    if ( ! isfinite(xs[i]) || ! isfinite(ys[i]) ) {
+      continue;
+    }
+    valid = 1;
+    if ( xs[i] < bounds[0] ) bounds[0] = xs[i];
+    if ( ys[i] < bounds[1] ) bounds[1] = ys[i];
+    if ( xs[i] > bounds[2] ) bounds[2] = xs[i];
+    if ( ys[i] > bounds[3] ) bounds[3] = ys[i];
+  }
+
+  return valid;
+}
+
+static int
+tile_check_densify (VALUE vopts)
+{
+  ID kw_ids[1];
+  VALUE kw_vals[1];
+  int densify;
+
+  kw_ids[0] = rb_intern("densify");
+  rb_get_kwargs(vopts, kw_ids, 0, 1, kw_vals);
+
+  densify = ( kw_vals[0] == Qundef ) ? 21 : NUM2INT(kw_vals[0]);
+  if ( densify < 0 || 4 * (densify + 1) > TILE_CHUNK ) {
+    rb_raise(rb_eArgError, "densify should be in 0..%d", TILE_CHUNK / 4 - 1);
+  }
+
+  return densify;
+}
+
+/*
+Computes the bounds of tiles in the source CRS.
+
+If tx and ty are Integers, returns [xmin, ymin, xmax, ymax] of the tile.
+If tx and ty are Strings packed with int32, returns a String packed
+with doubles (xmin, ymin, xmax, ymax for each tile).
+Bounds are NaN for tiles which can not be transformed and for tiles out
+of 0...2**zoom (e.g. -1 given by #locate for points not located).
+
+@overload bounds(zoom, tx, ty, densify: 21)
+  @param zoom [Integer] zoom level
+  @param tx [Integer, String] tile column(s)
+  @param ty [Integer, String] tile row(s)
+  @param densify [Integer] number of points added to each edge
+
+@return [Array, String]
+*/
+static VALUE
+rb_tile_bounds (int argc, VALUE *argv, VALUE self)
+{
+  volatile VALUE vzoom, vtx, vty, vopts, vout;
+  TilePyramid *tp;
+  double bounds[4], *out;
+  const int32_t *tx, *ty;
+  long len, i;
+  int zoom, densify;
+  PJ *ref;
+
+  rb_scan_args(argc, argv, "3:", (VALUE *)&vzoom, (VALUE *)&vtx, (VALUE *)&vty, (VALUE *)&vopts);
+
+  TypedData_Get_Struct(self, TilePyramid, &tile_data_type, tp);
+
+  zoom = tile_check_zoom(vzoom);
+  densify = tile_check_densify(vopts);
+  ref = tile_get_ref(tp);
+
+  if ( ! RB_TYPE_P(vtx, T_STRING) ) {
+    if ( ! tile_bounds_i(tp, ref, zoom, NUM2DBL(vtx), NUM2DBL(vty), densify, bounds) ) {
+      bounds[0] = bounds[1] = bounds[2] = bounds[3] = NAN;
+    }
+    return rb_ary_new3(4, rb_float_new(bounds[0]), rb_float_new(bounds[1]),
+                          rb_float_new(bounds[2]), rb_float_new(bounds[3]));
+  }
+
+  Check_Type(vty, T_STRING);
+  len = RSTRING_LEN(vtx) / sizeof(int32_t);
+  if ( RSTRING_LEN(vty) / (long) sizeof(int32_t) < len ) {
+    len = RSTRING_LEN(vty) / sizeof(int32_t);
+  }
+
+  vout = rb_proj_buffer_new(4 * len, &out);
+  tx = (const int32_t *) RSTRING_PTR(vtx);
+  ty = (const int32_t *) RSTRING_PTR(vty);
+
+  for (i=0; i<len; i++) {
+    if ( ! tile_bounds_i(tp, ref, zoom, tx[i], ty[i], densify, &out[4*i]) ) {
+      out[4*i] = out[4*i+1] = out[4*i+2] = out[4*i+3] = NAN;
+    }
+  }
+
+  return vout;
+}
+
+/*
+Computes the range of tiles covering the bbox given in the source CRS.
+The boundary of the bbox is densified with `densify` points on each edge
+before transformed. A bbox crossing the antimeridian (xmin > xmax) is not
+supported and raises ArgumentError; split it at the antimeridian into two
+bboxes and take the range of each.
+
+@overload tile_range(bbox, zoom, densify: 21)
+  @param bbox [Array] [xmin, ymin, xmax, ymax] in source CRS
+  @param zoom [Integer] zoom level
+
+@return [Array, nil] [tx_min, ty_min, tx_max, ty_max] or nil if no tile covers
+*/
+static VALUE
+rb_tile_tile_range (int argc, VALUE *argv, VALUE self)
+{
+  volatile VALUE vbbox, vzoom, vopts;
+  TilePyramid *tp;
+  double xs[TILE_CHUNK], ys[TILE_CHUNK], bbox[4], t, n, fx, fy;
+  double minx = HUGE_VAL, miny = HUGE_VAL, maxx = -HUGE_VAL, maxy = -HUGE_VAL;
+  long tx0, ty0, tx1, ty1;
+  int i, m = 0, nseg, zoom, densify;
+  PJ *ref;
+
+  rb_scan_args(argc, argv, "2:", (VALUE *)&vbbox, (VALUE *)&vzoom, (VALUE *)&vopts);
+
+  TypedData_Get_Struct(self, TilePyramid, &tile_data_type, tp);
+
+  zoom = tile_check_zoom(vzoom);
+  densify = tile_check_densify(vopts);
+  ref = tile_get_ref(tp);
+  n = ldexp(1.0, zoom);
+
+  vbbox = rb_Array(vbbox);
+  if ( RARRAY_LEN(vbbox) != 4 ) {
+    rb_raise(rb_eArgError, "bbox should be an array with 4 elements");
+  }
+  for (i=0; i<4; i++) {
+    bbox[i] = NUM2DBL(RARRAY_AREF(vbbox, i));
+  }
+  if ( bbox[0] > bbox[2] ) {
+    rb_raise(rb_eArgError, "bbox crossing the antimeridian (xmin > xmax) is not supported, split it into two");
+  }
+  if ( bbox[1] > bbox[3] ) {
+    rb_raise(rb_eArgError, "invalid bbox (ymin > ymax)");
+  }
+
+  nseg = densify + 1;
+  for (i=0; i<nseg; i++) {
+    t = (double) i / nseg;
+    xs[m] = bbox[0] + t * (bbox[2] - bbox[0]); ys[m] = bbox[3]; m++;
+    xs[m] = bbox[2]; ys[m] = bbox[3] - t * (bbox[3] - bbox[1]); m++;
+    xs[m] = bbox[2] - t * (bbox[2] - bbox[0]); ys[m] = bbox[1]; m++;
+    xs[m] = bbox[0]; ys[m] = bbox[1] + t * (bbox[3] - bbox[1]); m++;
+  }
+
+  proj_trans_generic(ref, PJ_FWD,
+                     xs, sizeof(double), m,
+                     ys, sizeof(double), m,
+                     NULL, 0, 0, NULL, 0, 0);
+
+  for (i=0; i<m; i++) {
+    if ( ! isfinite(xs[i]) || ! isfinite(ys[i]) ) {
+      continue;
+    }
+    if ( xs[i] < minx ) minx = xs[i];
+    if ( ys[i] < miny ) miny = ys[i];
+    if ( xs[i] > maxx ) maxx = xs[i];
+    if ( ys[i] > maxy ) maxy = ys[i];
+  }
+
+  /* clip to the extent */
+  if ( minx < tp->minx ) minx = tp->minx;
+  if ( miny < tp->miny ) miny = tp->miny;
+  if ( maxx > tp->maxx ) maxx = tp->maxx;
+  if ( maxy > tp->maxy ) maxy = tp->maxy;
+  if ( minx > maxx || miny > maxy ) {
+    return Qnil;
+  }
+
+  fx = (minx - tp->minx) / (tp->maxx - tp->minx) * n;
+  fy = (tp->maxy - maxy) / (tp->maxy - tp->miny) * n;
+  tx0 = (long) floor(fx);
+  ty0 = (long) floor(fy);
+  fx = (maxx - tp->minx) / (tp->maxx - tp->minx) * n;
+  fy = (tp->maxy - miny) / (tp->maxy - tp->miny) * n;
+  tx1 = (long) floor(fx);
+  ty1 = (long) floor(fy);
+  if ( tx1 >= n ) tx1 = (long) n - 1;
+  if ( ty1 >= n ) ty1 = (long) n - 1;
+
+  return rb_ary_new3(4, LONG2NUM(tx0), LONG2NUM(ty0), LONG2NUM(tx1), LONG2NUM(ty1));
+}
+
+void
+Init_simple_proj_tile (void)
+{
+  rb_cTilePyramid = rb_define_class_under(rb_cProj, "TilePyramid", rb_cObject);
+
+  rb_define_alloc_func(rb_cTilePyramid, rb_tile_s_allocate);
+  rb_define_method(rb_cTilePyramid, "initialize", rb_tile_initialize, -1);
+  rb_define_method(rb_cTilePyramid, "proj", rb_tile_proj, 0);
+  rb_define_method(rb_cTilePyramid, "tile_size", rb_tile_tile_size, 0);
+  rb_define_method(rb_cTilePyramid, "extent", rb_tile_extent, 0);
+  rb_define_method(rb_cTilePyramid, "locate", rb_tile_locate, -1);
+  rb_define_method(rb_cTilePyramid, "bounds", rb_tile_bounds, -1);
+  rb_define_method(rb_cTilePyramid, "tile_range", rb_tile_tile_range, -1);
+}
@@ -0,0 +1,622 @@
+#include "ruby.h"
+#include "rb_proj.h"
+
+#include <math.h>
+#include <string.h>
+
+/*
+Incremental transformation of tracks (sequences of nearby points).
+
+For each track, the exact result at an anchor point is kept together with
+the first and second derivatives of the transformation there (central
+differences of 13 exact transformations with `step`). Following points are
+extrapolated from the anchor by the Taylor expansion of the given order, as
+long as they are within the radius where the estimated truncation error is
+below `max_error` (and within `max_distance`). Otherwise the point is
+transformed exactly and becomes the new anchor.
+
+The radius of the first order expansion is sqrt(2 max_error / K2), where K2
+bounds the second derivatives. For the second order expansion it is
+cbrt(6 max_error / K3), where K3 bounds the third derivatives.
+*/
+
+#define TRACK_DEG_TO_RAD (M_PI / 180.0)
+#define TRACK_RAD_TO_DEG (180.0 / M_PI)
+
+#define TRACK_NPOINTS 13
+
+enum {
+  TRACK_FORWARD = 0,
+  TRACK_INVERSE,
+  TRACK_TRANSFORM,
+  TRACK_TRANSFORM_INVERSE
+};
+
+typedef struct {
+  double u0, v0;           /* anchor (input) */
+  double x0, y0;           /* exact result at the anchor */
+  double j[2][2];          /* [output][du, dv] */
+  double h[2][3];          /* [output][duu, duv, dvv] */
+  double radius;           /* extrapolation radius around the anchor */
+  int has_h;               /* derivatives are valid */
+} track_state;
+
+typedef struct {
+  VALUE vproj;
+  VALUE tracks;            /* Hash of track_id => String (track_state) */
+  int method;
+  PJ_DIRECTION direction;
+  double factor_in, factor_out;
+  int order;
+  double max_error, max_distance, step;
+  unsigned long n_exact, n_approx;
+} ProjTrack;
+
+static VALUE rb_cProjTrack;
+
+static void
+track_mark (void *ptr)
+{
+  ProjTrack *tr = ptr;
+  rb_gc_mark_movable(tr->vproj);
+  rb_gc_mark_movable(tr->tracks);
+}
+
+static void
+track_compact (void *ptr)
+{
+  ProjTrack *tr = ptr;
+  tr->vproj  = rb_gc_location(tr->vproj);
+  tr->tracks = rb_gc_location(tr->tracks);
+}
+
+static size_t
+track_memsize (const void *ptr)
+{
+  return sizeof(ProjTrack);
+}
+
+static const rb_data_type_t track_data_type = {
+    .wrap_struct_name = "ProjTrack",
+    .function = {
+        .dmark = track_mark,
+        .dfree = RUBY_TYPED_DEFAULT_FREE,
+        .dsize = track_memsize,
+        .dcompact = track_compact,
+    },
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+static VALUE
+rb_track_s_allocate (VALUE klass)
+{
+  ProjTrack *tr;
+  VALUE obj = TypedData_Make_Struct(klass, ProjTrack, &track_data_type, tr);
+  tr->vproj  = Qnil;
+  tr->tracks = Qnil;
+  return obj;
+}
+
+static ProjTrack *
+track_get (VALUE self)
+{
+  ProjTrack *tr;
+  TypedData_Get_Struct(self, ProjTrack, &track_data_type, tr);
+  if ( NIL_P(tr->vproj) ) {
+    rb_raise(rb_eRuntimeError, "uninitialized tracker");
+  }
+  return tr;
+}
+
+/*
+Bound of |d^T H d| / |d|^2 (max norm of d) for the second derivatives of
+both outputs.
+*/
+static double
+track_hnorm (const double h[2][3])
+{
+  double kx, ky;
+  kx = fabs(h[0][0]) + 2.0 * fabs(h[0][1]) + fabs(h[0][2]);
+  ky = fabs(h[1][0]) + 2.0 * fabs(h[1][1]) + fabs(h[1][2]);
+  return hypot(kx, ky);
+}
+
+/*
+Transforms (u, v) exactly and sets it as the new anchor of the track.
+Returns non-zero if the point itself can not be transformed.
+*/
+static int
+track_anchor (ProjTrack *tr, PJ *ref, track_state *st, double u, double v)
+{
+  double pu[TRACK_NPOINTS], pv[TRACK_NPOINTS];
+  double s = tr->step, k[2], k2, k3, r;
+  int i, c, ok = 1;
+
+  pu[0] = u;     pv[0] = v;
+  pu[1] = u + s; pv[1] = v;
+  pu[2] = u - s; pv[2] = v;
+  pu[3] = u;     pv[3] = v + s;
+  pu[4] = u;     pv[4] = v - s;
+  pu[5] = u + s; pv[5] = v + s;
+  pu[6] = u + s; pv[6] = v - s;
+  pu[7] = u - s; pv[7] = v + s;
+  pu[8] = u - s; pv[8] = v - s;
+  pu[9]  = u + 2*s; pv[9]  = v;
+  pu[10] = u - 2*s; pv[10] = v;
+  pu[11] = u;       pv[11] = v + 2*s;
+  pu[12] = u;       pv[12] = v - 2*s;
+
+  for (i=0; i<TRACK_NPOINTS; i++) {
+    pu[i] *= tr->factor_in;
+    pv[i] *= tr->factor_in;
+  }
+
+  proj_trans_generic(ref, tr->direction,
+                     pu, sizeof(double), TRACK_NPOINTS,
+                     pv, sizeof(double), TRACK_NPOINTS,
+                     NULL, 0, 0, NULL, 0, 0);
+
+  if ( pu[0] == HUGE_VAL || pv[0] == HUGE_VAL ) {
+    return 1;
+  }
+
+  for (i=0; i<TRACK_NPOINTS; i++) {
+    if ( pu[i] == HUGE_VAL || pv[i] == HUGE_VAL ) {
+      ok = 0;
+      break;
+    }
+    pu[i] *= tr->factor_out;
+    pv[i] *= tr->factor_out;
+  }
+
+  st->u0 = u;
+  st->v0 = v;
+  st->x0 = pu[0];
+  st->y0 = pv[0];
+
+  /* near the boundary of the domain every point is transformed exactly */
+  if ( ! ok ) {
+    st->has_h  = 0;
+    st->radius = 0.0;
+    return 0;
+  }
+
+  for (c=0; c<2; c++) {
+    double *f = ( c == 0 ) ? pu : pv;
+    st->j[c][0] = (f[1] - f[2]) / (2.0 * s);
+    st->j[c][1] = (f[3] - f[4]) / (2.0 * s);
+    st->h[c][0] = (f[1] - 2.0 * f[0] + f[2]) / (s * s);
+    st->h[c][1] = (f[5] - f[6] - f[7] + f[8]) / (4.0 * s * s);
+    st->h[c][2] = (f[3] - 2.0 * f[0] + f[4]) / (s * s);
+    /* |T d^3| <= (|fuuu| + 3|fuuv| + 3|fuvv| + |fvvv|) |d|^3 */
+    k[c] = fabs(f[9] - 2.0 * f[1] + 2.0 * f[2] - f[10])
+         + 3.0 * fabs(f[5] - 2.0 * f[3] + f[7] - f[6] + 2.0 * f[4] - f[8])
+         + 3.0 * fabs(f[5] - 2.0 * f[1] + f[6] - f[7] + 2.0 * f[2] - f[8])
+         + fabs(f[11] - 2.0 * f[3] + 2.0 * f[4] - f[12]);
+    k[c] /= 2.0 * s * s * s;
+  }
+  st->has_h = 1;
+
+  if ( tr->order == 1 ) {
+    k2 = track_hnorm(st->h);
+    r  = ( k2 > 0.0 ) ? sqrt(2.0 * tr->max_error / k2) : HUGE_VAL;
+  }
+  else {
+    k3 = hypot(k[0], k[1]);
+    r  = ( k3 > 0.0 ) ? cbrt(6.0 * tr->max_error / k3) : HUGE_VAL;
+  }
+
+  st->radius = fmin(r, tr->max_distance);
+
+  return 0;
+}
+
+static track_state *
+track_lookup (ProjTrack *tr, VALUE vid, int *has_prev)
+{
+  VALUE vst;
+
+  vst = rb_hash_lookup2(tr->tracks, vid, Qnil);
+  if ( NIL_P(vst) ) {
+    vst = rb_str_new(NULL, sizeof(track_state));
+    memset(RSTRING_PTR(vst), 0, sizeof(track_state));
+    rb_hash_aset(tr->tracks, vid, vst);
+    *has_prev = 0;
+  }
+  else {
+    *has_prev = 1;
+  }
+
+  return (track_state *) RSTRING_PTR(vst);
+}
+
+/*
+Transforms a point of the track. Returns non-zero if the point can not be
+transformed, and the track is forgotten in that case.
+*/
+static int
+track_point (ProjTrack *tr, PJ *ref, VALUE vid, double u, double v,
+             double *x, double *y)
+{
+  track_state *st;
+  double du, dv;
+  int has_prev;
+
+  st = track_lookup(tr, vid, &has_prev);
+
+  if ( has_prev && st->has_h ) {
+    du = u - st->u0;
+    dv = v - st->v0;
+    if ( fabs(du) <= st->radius && fabs(dv) <= st->radius ) {
+      *x = st->x0 + st->j[0][0] * du + st->j[0][1] * dv;
+      *y = st->y0 + st->j[1][0] * du + st->j[1][1] * dv;
+      if ( tr->order == 2 ) {
+        *x += 0.5 * (st->h[0][0] * du * du + 2.0 * st->h[0][1] * du * dv + st->h[0][2] * dv * dv);
+        *y += 0.5 * (st->h[1][0] * du * du + 2.0 * st->h[1][1] * du * dv + st->h[1][2] * dv * dv);
+      }
+      tr->n_approx++;
+      return 0;
+    }
+  }
+
+  if ( track_anchor(tr, ref, st, u, v) ) {
+    rb_hash_delete(tr->tracks, vid);
+    return 1;
+  }
+  tr->n_exact++;
+  *x = st->x0;
+  *y = st->y0;
+
+  return 0;
+}
+
+/*
+Creates a tracker which transforms points of tracks by the PROJ object.
+
+The coordinates follow the units of the method given by `method`
+(:forward, :inverse, :transform or :transform_inverse). `max_error` and
+`step` are in units of the output and input coordinates respectively.
+
+@overload initialize(proj, max_error: 0.001, max_distance: nil, order: 1, step: nil, method: :forward)
+  @param proj [PROJ]
+  @param max_error [Numeric] error bound of extrapolation
+  @param max_distance [Numeric, nil] maximum distance from the anchor in each input coordinate
+  @param order [Integer] order of extrapolation (1 or 2)
+  @param step [Numeric, nil] step of finite differences (default 1e-3 degrees, 1e-5 radians or 1e-2 otherwise)
+  @param method [Symbol] :forward, :inverse, :transform or :transform_inverse
+*/
+static VALUE
+rb_track_initialize (int argc, VALUE *argv, VALUE self)
+{
+  volatile VALUE vproj, vopts;
+  ID kw_ids[5];
+  VALUE kw_vals[5];
+  ProjTrack *tr;
+  Proj *proj;
+  ID id;
+  int in_ang = 0, out_ang = 0;
+
+  rb_scan_args(argc, argv, "1:", (VALUE *)&vproj, (VALUE *)&vopts);
+
+  TypedData_Get_Struct(self, ProjTrack, &track_data_type, tr);
+
+  if ( ! rb_obj_is_kind_of(vproj, rb_cProj) ) {
+    rb_raise(rb_eTypeError, "PROJ object required");
+  }
+  proj = rb_proj_get_struct(vproj);
+
+  kw_ids[0] = rb_intern("max_error");
+  kw_ids[1] = rb_intern("max_distance");
+  kw_ids[2] = rb_intern("order");
+  kw_ids[3] = rb_intern("step");
+  kw_ids[4] = rb_intern("method");
+  rb_get_kwargs(vopts, kw_ids, 0, 5, kw_vals);
+
+  tr->method = TRACK_FORWARD;
+  if ( kw_vals[4] != Qundef && ! NIL_P(kw_vals[4]) ) {
+    id = rb_to_id(kw_vals[4]);
+    if ( id == id_forward ) {
+      tr->method = TRACK_FORWARD;
+    }
+    else if ( id == id_inverse ) {
+      tr->method = TRACK_INVERSE;
+    }
+    else if ( id == rb_intern("transform") ) {
+      tr->method = TRACK_TRANSFORM;
+    }
+    else if ( id == rb_intern("transform_inverse") ) {
+      tr->method = TRACK_TRANSFORM_INVERSE;
+    }
+    else {
+      rb_raise(rb_eArgError, "invalid method");
+    }
+  }
+
+  switch ( tr->method ) {
+  case TRACK_FORWARD:
+    if ( ! proj->forward ) {
+      rb_raise(rb_eRuntimeError, "requires latlong src crs. use method: :transform instead of :forward.");
+    }
+    tr->direction = PJ_FWD;
+    break;
+  case TRACK_INVERSE:
+    if ( ! proj->inverse ) {
+      rb_raise(rb_eRuntimeError, "requires latlong src crs. use method: :transform_inverse instead of :inverse.");
+    }
+    tr->direction = PJ_INV;
+    break;
+  case TRACK_TRANSFORM:
+    tr->direction = PJ_FWD;
+    break;
+  default:
+    tr->direction = PJ_INV;
+    break;
+  }
+
+  /* units follow #forward and #inverse */
+  if ( tr->method == TRACK_FORWARD || tr->method == TRACK_INVERSE ) {
+    in_ang  = ( proj_angular_input(proj->ref, tr->direction) == 1 );
+    out_ang = ( proj_angular_output(proj->ref, tr->direction) == 1 );
+  }
+  tr->factor_in  = ( in_ang ) ? TRACK_DEG_TO_RAD : 1.0;
+  tr->factor_out = ( out_ang ) ? TRACK_RAD_TO_DEG : 1.0;
+
+  tr->max_error = ( kw_vals[0] == Qundef ) ? 0.001 : NUM2DBL(kw_vals[0]);
+  if ( ! ( tr->max_error > 0.0 ) ) {
+    rb_raise(rb_eArgError, "max_error should be positive");
+  }
+
+  tr->max_distance = HUGE_VAL;
+  if ( kw_vals[1] != Qundef && ! NIL_P(kw_vals[1]) ) {
+    tr->max_distance = NUM2DBL(kw_vals[1]);
+    if ( ! ( tr->max_distance >= 0.0 ) ) {
+      rb_raise(rb_eArgError, "invalid max_distance");
+    }
+  }
+
+  tr->order = ( kw_vals[2] == Qundef ) ? 1 : NUM2INT(kw_vals[2]);
+  if ( tr->order != 1 && tr->order != 2 ) {
+    rb_raise(rb_eArgError, "order should be 1 or 2");
+  }
+
+  if ( kw_vals[3] == Qundef || NIL_P(kw_vals[3]) ) {
+    if ( in_ang || proj_degree_input(proj->ref, tr->direction) == 1 ) {
+      tr->step = 1e-3;
+    }
+    else if ( proj_angular_input(proj->ref, tr->direction) == 1 ) {
+      tr->step = 1e-5;
+    }
+    else {
+      tr->step = 1e-2;
+    }
+  }
+  else {
+    tr->step = NUM2DBL(kw_vals[3]);
+    if ( ! ( tr->step > 0.0 ) ) {
+      rb_raise(rb_eArgError, "step should be positive");
+    }
+  }
+
+  tr->n_exact  = 0;
+  tr->n_approx = 0;
+
+  RB_OBJ_WRITE(self, &tr->vproj, vproj);
+  RB_OBJ_WRITE(self, &tr->tracks, rb_hash_new());
+
+  return Qnil;
+}
+
+/*
+Returns the PROJ object.
+
+@return [PROJ]
+*/
+static VALUE
+rb_track_proj (VALUE self)
+{
+  return track_get(self)->vproj;
+}
+
+/*
+Returns the error bound of extrapolation.
+
+@return [Float]
+*/
+static VALUE
+rb_track_max_error (VALUE self)
+{
+  return rb_float_new(track_get(self)->max_error);
+}
+
+/*
+Returns the maximum distance from the anchor (nil if unlimited).
+
+@return [Float, nil]
+*/
+static VALUE
+rb_track_max_distance (VALUE self)
+{
+  ProjTrack *tr = track_get(self);
+  return isinf(tr->max_distance) ? Qnil : rb_float_new(tr->max_distance);
+}
+
+/*
+Returns the order of extrapolation.
+
+@return [Integer]
+*/
+static VALUE
+rb_track_order (VALUE self)
+{
+  return INT2NUM(track_get(self)->order);
+}
+
+/*
+Transforms a point of the track. The first point of a track, and points
+too far from the current anchor, are transformed exactly.
+
+@overload transform(track_id, u, v)
+  @param track_id [Object] key of the track (compared as Hash keys)
+  @param u [Numeric] first coordinate (longitude in degrees for :forward)
+  @param v [Numeric] second coordinate (latitude in degrees for :forward)
+
+@return [Array] [x, y]
+
+@example
+  tracker = PROJ::Tracker.new(PROJ.new("EPSG:3857"), max_error: 0.01)
+  feed.each do |id, lon, lat|
+    x, y = tracker.transform(id, lon, lat)
+  end
+*/
+static VALUE
+rb_track_transform (VALUE self, VALUE vid, VALUE vu, VALUE vv)
+{
+  ProjTrack *tr = track_get(self);
+  Proj *proj = rb_proj_get_struct(tr->vproj);
+  double x, y;
+  int errno;
+
+  if ( track_point(tr, proj->ref, vid, NUM2DBL(vu), NUM2DBL(vv), &x, &y) ) {
+    errno = proj_errno(proj->ref);
+    rb_raise(rb_eRuntimeError, "%s", proj_errno_string(errno));
+  }
+
+  return rb_assoc_new(rb_float_new(x), rb_float_new(y));
+}
+
+typedef struct {
+  ProjTrack *tr;
+  PJ *ref;
+  VALUE vids;
+  rb_proj_buffer in[2];
+  double *x, *y;
+  long len;
+} track_batch_args;
+
+static VALUE
+track_batch_run (VALUE arg)
+{
+  track_batch_args *a = (track_batch_args *) arg;
+  long i;
+
+  for (i=0; i<a->len; i++) {
+    if ( track_point(a->tr, a->ref, RARRAY_AREF(a->vids, i),
+                     a->in[0].ptr[i], a->in[1].ptr[i], &a->x[i], &a->y[i]) ) {
+      a->x[i] = a->y[i] = NAN;
+    }
+  }
+
+  return Qnil;
+}
+
+static VALUE
+track_batch_release (VALUE arg)
+{
+  track_batch_args *a = (track_batch_args *) arg;
+
+  rb_proj_buffer_release(&a->in[0]);
+  rb_proj_buffer_release(&a->in[1]);
+
+  return Qnil;
+}
+
+/*
+Transforms points of tracks in order, as #transform does for each point.
+Points which can not be transformed give NaN.
+
+@overload transform_batch(track_ids, us, vs)
+  @param track_ids [Array] key of the track of each point
+  @param us [String, CArray, Array] first coordinates
+  @param vs [String, CArray, Array] second coordinates
+
+@return [Array] [xbuf, ybuf]
+*/
+static VALUE
+rb_track_transform_batch (VALUE self, VALUE vids, VALUE vus, VALUE vvs)
+{
+  volatile VALUE vx, vy;
+  track_batch_args a;
+  long n;
+
+  memset(&a, 0, sizeof(track_batch_args));
+  a.tr   = track_get(self);
+  a.ref  = rb_proj_get_struct(a.tr->vproj)->ref;
+  a.vids = rb_Array(vids);
+
+  rb_proj_buffer_get_pair(vus, vvs, &a.in[0], &a.in[1]);
+
+  n = ( a.in[0].len < a.in[1].len ) ? a.in[0].len : a.in[1].len;
+  if ( RARRAY_LEN(a.vids) < n ) {
+    n = RARRAY_LEN(a.vids);
+  }
+  a.len = n;
+
+  vx = rb_proj_buffer_new(n, &a.x);
+  vy = rb_proj_buffer_new(n, &a.y);
+
+  rb_ensure(track_batch_run, (VALUE) &a, track_batch_release, (VALUE) &a);
+
+  RB_GC_GUARD(a.vids);
+
+  return rb_assoc_new(vx, vy);
+}
+
+/*
+Forgets the anchor of the track (all tracks if omitted).
+
+@overload reset(track_id = nil)
+
+@return [self]
+*/
+static VALUE
+rb_track_reset (int argc, VALUE *argv, VALUE self)
+{
+  ProjTrack *tr = track_get(self);
+  VALUE vid;
+
+  rb_scan_args(argc, argv, "01", &vid);
+
+  if ( argc == 0 ) {
+    rb_hash_clear(tr->tracks);
+  }
+  else {
+    rb_hash_delete(tr->tracks, vid);
+  }
+
+  return self;
+}
+
+/*
+Returns the statistics of the tracker.
+
+@return [Hash] {tracks:, exact:, extrapolated:}
+*/
+static VALUE
+rb_track_stats (VALUE self)
+{
+  ProjTrack *tr = track_get(self);
+  VALUE vstats = rb_hash_new();
+
+  rb_hash_aset(vstats, ID2SYM(rb_intern("tracks")), LONG2NUM(RHASH_SIZE(tr->tracks)));
+  rb_hash_aset(vstats, ID2SYM(rb_intern("exact")), ULONG2NUM(tr->n_exact));
+  rb_hash_aset(vstats, ID2SYM(rb_intern("extrapolated")), ULONG2NUM(tr->n_approx));
+
+  return vstats;
+}
+
+void
+Init_simple_proj_track (void)
+{
+  rb_cProjTrack = rb_define_class_under(rb_cProj, "Tracker", rb_cObject);
+
+  rb_define_alloc_func(rb_cProjTrack, rb_track_s_allocate);
+  rb_define_method(rb_cProjTrack, "initialize", rb_track_initialize, -1);
+  rb_define_method(rb_cProjTrack, "proj", rb_track_proj, 0);
+  rb_define_method(rb_cProjTrack, "max_error", rb_track_max_error, 0);
+  rb_define_method(rb_cProjTrack, "max_distance", rb_track_max_distance, 0);
+  rb_define_method(rb_cProjTrack, "order", rb_track_order, 0);
+  rb_define_method(rb_cProjTrack, "transform", rb_track_transform, 3);
+  rb_define_method(rb_cProjTrack, "transform_batch", rb_track_transform_batch, 3);
+  rb_define_method(rb_cProjTrack, "reset", rb_track_reset, -1);
+  rb_define_method(rb_cProjTrack, "stats", rb_track_stats, 0);
+}
@@ -0,0 +1,329 @@
+#include "ruby.h"
+#include "rb_proj.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+Batch transformation between WGS84 longitude/latitude and UTM.
+
+Zones are signed integers (positive for the northern hemisphere, negative
+for the southern hemisphere, 0 for points outside of UTM coverage).
+The points are grouped by zone, and each group is transformed by an
+operation built at the first use and cached for the process.
+*/
+
+#define UTM_NZONES 60
+
+static VALUE utm_cache;   /* Array indexed by zone + UTM_NZONES */
+
+static int
+utm_zone (double lon, double lat)
+{
+  int zone;
+
+  if ( ! ( lat >= -80.0 && lat <= 84.0 ) || ! isfinite(lon) ) {
+    return 0;
+  }
+
+  lon = fmod(lon + 180.0, 360.0);
+  if ( lon < 0.0 ) {
+    lon += 360.0;
+  }
+  lon -= 180.0;
+
+  zone = (int) floor((lon + 180.0) / 6.0) + 1;
+  if ( zone > UTM_NZONES ) {
+    zone = UTM_NZONES;
+  }
+
+  /* exception for southwest Norway */
+  if ( lat >= 56.0 && lat < 64.0 && lon >= 3.0 && lon < 12.0 ) {
+    zone = 32;
+  }
+
+  /* exceptions for Svalbard */
+  if ( lat >= 72.0 ) {
+    if ( lon >= 0.0 && lon < 9.0 ) {
+      zone = 31;
+    }
+    else if ( lon >= 9.0 && lon < 21.0 ) {
+      zone = 33;
+    }
+    else if ( lon >= 21.0 && lon < 33.0 ) {
+      zone = 35;
+    }
+    else if ( lon >= 33.0 && lon < 42.0 ) {
+      zone = 37;
+    }
+  }
+
+  return ( lat < 0.0 ) ? -zone : zone;
+}
+
+static int
+utm_check_zone (VALUE vzone)
+{
+  int zone = NUM2INT(vzone);
+  if ( zone == 0 || zone < -UTM_NZONES || zone > UTM_NZONES ) {
+    rb_raise(rb_eArgError, "invalid UTM zone %d", zone);
+  }
+  return zone;
+}
+
+static VALUE
+utm_get_proj (int zone)
+{
+  volatile VALUE vproj;
+  char def[32];
+
+  vproj = RARRAY_AREF(utm_cache, zone + UTM_NZONES);
+  if ( NIL_P(vproj) ) {
+    snprintf(def, sizeof(def), "EPSG:%d", ( zone > 0 ) ? 32600 + zone : 32700 - zone);
+    vproj = rb_funcall(rb_cProj, rb_intern("new"), 1, rb_str_new2(def));
+    rb_ary_store(utm_cache, zone + UTM_NZONES, vproj);
+  }
+  return vproj;
+}
+
+/*
+Returns the UTM zone of the point (0 if outside of UTM coverage).
+The exceptions for Norway and Svalbard are taken into account.
+
+@overload utm_zone(lon, lat)
+  @param lon [Numeric] longitude in degrees
+  @param lat [Numeric] latitude in degrees
+
+@return [Integer] zone (negative for the southern hemisphere)
+*/
+static VALUE
+rb_proj_s_utm_zone (VALUE klass, VALUE vlon, VALUE vlat)
+{
+  return INT2NUM(utm_zone(NUM2DBL(vlon), NUM2DBL(vlat)));
+}
+
+/*
+Returns the cached PROJ object which transforms longitude/latitude
+into the UTM zone (EPSG:326xx or EPSG:327xx).
+
+@overload utm(zone)
+  @param zone [Integer] zone (negative for the southern hemisphere)
+
+@return [PROJ]
+*/
+static VALUE
+rb_proj_s_utm (VALUE klass, VALUE vzone)
+{
+  return utm_get_proj(utm_check_zone(vzone));
+}
+
+/*
+Transforms the points grouped by zone. (a, b) are sorted by zone in place
+and the results are scattered into (oa, ob) following the index.
+*/
+static void
+utm_trans_groups (PJ_DIRECTION direction, const int32_t *zones, long n,
+                  double *a, double *b, long *index, double *oa, double *ob)
+{
+  long count[2*UTM_NZONES+2], start[2*UTM_NZONES+2], i, k, m;
+  int z, in_ang, out_ang;
+  Proj *proj;
+  PJ *ref;
+
+  memset(count, 0, sizeof(count));
+  for (i=0; i<n; i++) {
+    count[zones[i] + UTM_NZONES]++;
+  }
+  start[0] = 0;
+  for (k=1; k<2*UTM_NZONES+2; k++) {
+    start[k] = start[k-1] + count[k-1];
+  }
+  for (i=0; i<n; i++) {
+    index[start[zones[i] + UTM_NZONES]++] = i;
+  }
+  for (k=0; k<2*UTM_NZONES+1; k++) {     /* start[k] is now the end of group k */
+    start[k] -= count[k];
+  }
+
+  /* gather the coordinates in order of zone */
+  for (i=0; i<n; i++) {
+    oa[i] = a[index[i]];
+    ob[i] = b[index[i]];
+  }
+  memcpy(a, oa, n * sizeof(double));
+  memcpy(b, ob, n * sizeof(double));
+
+  for (k=0; k<2*UTM_NZONES+1; k++) {
+    z = (int) k - UTM_NZONES;
+    m = count[k];
+    if ( m == 0 ) {
+      continue;
+    }
+    if ( z == 0 ) {
+      for (i=start[k]; i<start[k]+m; i++) {
+        a[i] = b[i] = NAN;
+      }
+      continue;
+    }
+    proj = rb_proj_get_struct(utm_get_proj(z));
+    ref  = proj->ref;
+    in_ang  = ( proj_angular_input(ref, direction) == 1 );
+    out_ang = ( proj_angular_output(ref, direction) == 1 );
+    if ( in_ang ) {
+      for (i=start[k]; i<start[k]+m; i++) {
+        a[i] = proj_torad(a[i]);
+        b[i] = proj_torad(b[i]);
+      }
+    }
+    proj_trans_generic(ref, direction,
+                       a + start[k], sizeof(double), m,
+                       b + start[k], sizeof(double), m,
+                       NULL, 0, 0, NULL, 0, 0);
+    for (i=start[k]; i<start[k]+m; i++) {
+      if ( a[i] == HUGE_VAL || b[i] == HUGE_VAL ) {
+        a[i] = b[i] = NAN;
+      }
+      else if ( out_ang ) {
+        a[i] = proj_todeg(a[i]);
+        b[i] = proj_todeg(b[i]);
+      }
+    }
+  }
+
+  /* scatter the results */
+  for (i=0; i<n; i++) {
+    oa[index[i]] = a[i];
+    ob[index[i]] = b[i];
+  }
+}
+
+/*
+Transforms WGS84 longitudes/latitudes into the UTM zone of each point.
+Points outside of UTM coverage (zone 0) give NaN.
+
+@overload utm_forward_batch(lons, lats)
+  @param lons [String, CArray, Array] longitudes in degrees
+  @param lats [String, CArray, Array] latitudes in degrees
+
+@return [Array] [xbuf, ybuf, zones] (zones is a String packed with int32)
+
+@example
+  x, y, zones = PROJ.utm_forward_batch([139.7, -3.7], [35.7, 40.4])
+  zones.unpack("l*")   # => [54, 30]
+*/
+static VALUE
+rb_proj_s_utm_forward_batch (VALUE klass, VALUE vlons, VALUE vlats)
+{
+  volatile VALUE vx, vy, vzones, va, vb, vindex;
+  rb_proj_buffer blon, blat;
+  double *x, *y, *a, *b;
+  int32_t *zones;
+  long n, i;
+
+  rb_proj_buffer_get_pair(vlons, vlats, &blon, &blat);
+  n = ( blon.len < blat.len ) ? blon.len : blat.len;
+
+  vx = rb_proj_buffer_new(n, &x);
+  vy = rb_proj_buffer_new(n, &y);
+  va = rb_proj_buffer_new(n, &a);
+  vb = rb_proj_buffer_new(n, &b);
+  vzones = rb_str_new(NULL, n * sizeof(int32_t));
+  vindex = rb_str_new(NULL, n * sizeof(long));
+  zones = (int32_t *) RSTRING_PTR(vzones);
+
+  for (i=0; i<n; i++) {
+    a[i] = blon.ptr[i];
+    b[i] = blat.ptr[i];
+    zones[i] = utm_zone(a[i], b[i]);
+  }
+  rb_proj_buffer_release(&blon);
+  rb_proj_buffer_release(&blat);
+
+  utm_trans_groups(PJ_FWD, zones, n, a, b, (long *) RSTRING_PTR(vindex), x, y);
+
+  RB_GC_GUARD(va);
+  RB_GC_GUARD(vb);
+  RB_GC_GUARD(vindex);
+
+  return rb_ary_new3(3, vx, vy, vzones);
+}
+
+/*
+Transforms UTM coordinates into WGS84 longitudes/latitudes.
+Points with zone 0 give NaN.
+
+@overload utm_inverse_batch(xs, ys, zones)
+  @param xs [String, CArray, Array] eastings
+  @param ys [String, CArray, Array] northings
+  @param zones [String, Array<Integer>] zones (String packed with int32 or Array)
+
+@return [Array] [lonbuf, latbuf]
+*/
+static VALUE
+rb_proj_s_utm_inverse_batch (VALUE klass, VALUE vxs, VALUE vys, VALUE vzones)
+{
+  volatile VALUE vlon, vlat, va, vb, vindex, vz = Qnil;
+  rb_proj_buffer bx, by;
+  double *lon, *lat, *a, *b;
+  int32_t *zones;
+  long n, nz, i;
+
+  if ( RB_TYPE_P(vzones, T_STRING) ) {
+    nz = RSTRING_LEN(vzones) / sizeof(int32_t);
+    vz = rb_str_new(RSTRING_PTR(vzones), nz * sizeof(int32_t));
+  }
+  else {
+    vzones = rb_Array(vzones);
+    nz = RARRAY_LEN(vzones);
+    vz = rb_str_new(NULL, nz * sizeof(int32_t));
+    for (i=0; i<nz; i++) {
+      ((int32_t *) RSTRING_PTR(vz))[i] = NUM2INT(RARRAY_AREF(vzones, i));
+    }
+  }
+  zones = (int32_t *) RSTRING_PTR(vz);
+  for (i=0; i<nz; i++) {
+    if ( zones[i] < -UTM_NZONES || zones[i] > UTM_NZONES ) {
+      rb_raise(rb_eArgError, "invalid UTM zone %d", (int) zones[i]);
+    }
+  }
+
+  rb_proj_buffer_get_pair(vxs, vys, &bx, &by);
+  n = ( bx.len < by.len ) ? bx.len : by.len;
+  if ( nz < n ) {
+    n = nz;
+  }
+
+  vlon = rb_proj_buffer_new(n, &lon);
+  vlat = rb_proj_buffer_new(n, &lat);
+  va = rb_proj_buffer_new(n, &a);
+  vb = rb_proj_buffer_new(n, &b);
+  vindex = rb_str_new(NULL, n * sizeof(long));
+
+  memcpy(a, bx.ptr, n * sizeof(double));
+  memcpy(b, by.ptr, n * sizeof(double));
+  rb_proj_buffer_release(&bx);
+  rb_proj_buffer_release(&by);
+
+  utm_trans_groups(PJ_INV, zones, n, a, b, (long *) RSTRING_PTR(vindex), lon, lat);
+
+  RB_GC_GUARD(va);
+  RB_GC_GUARD(vb);
+  RB_GC_GUARD(vz);
+  RB_GC_GUARD(vindex);
+
+  return rb_ary_new3(2, vlon, vlat);
+}
+
+void
+Init_simple_proj_utm (void)
+{
+  utm_cache = rb_ary_new_capa(2 * UTM_NZONES + 1);
+  rb_ary_store(utm_cache, 2 * UTM_NZONES, Qnil);
+  rb_global_variable(&utm_cache);
+
+  rb_define_singleton_method(rb_cProj, "utm_zone", rb_proj_s_utm_zone, 2);
+  rb_define_singleton_method(rb_cProj, "utm", rb_proj_s_utm, 1);
+  rb_define_singleton_method(rb_cProj, "utm_forward_batch", rb_proj_s_utm_forward_batch, 2);
+  rb_define_singleton_method(rb_cProj, "utm_inverse_batch", rb_proj_s_utm_inverse_batch, 3);
+}
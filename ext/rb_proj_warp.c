@@ -0,0 +1,618 @@
+#include "ruby.h"
+#include "ruby/thread.h"
+#include "rb_proj.h"
+
+#include <math.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/*
+Raster warping.
+
+The destination raster is split into bands of rows. For each band the
+pixel centers are inversely transformed to the source CRS by the grid
+engine (rb_proj_grid_run), then the source raster is resampled at those
+points. With more than one thread, each worker owns a PJ cloned into its
+own PJ_CONTEXT and the work runs without GVL (the Strings of the rasters are
+locked meanwhile). If the PJ can't be cloned (operations with several
+candidates on PROJ < 8.2), the work runs in the calling thread.
+*/
+
+/* number of rows transformed at once */
+#define WARP_CHUNK_ROWS 64
+
+/* maximum number of worker threads */
+#define WARP_MAX_THREADS 16
+
+enum {
+  WARP_NEAREST = 0,
+  WARP_BILINEAR,
+  WARP_CUBIC
+};
+
+typedef struct {
+  const double *src;
+  long src_nrow, src_ncol;
+  double src_inv[6];
+  double dst_gt[6];
+  long dst_nrow, dst_ncol;
+  double *dst;
+  int resampling;
+  int has_nodata;
+  double nodata;
+  double dst_nodata;
+  double max_error;
+  volatile int interrupted;
+} warp_params;
+
+typedef struct {
+  warp_params *w;
+  PJ_CONTEXT *ctx;
+  PJ *ref;
+  long r0, r1;
+  int status;
+} warp_band;
+
+#define WARP_IS_NODATA(w, v) ( isnan(v) || ( (w)->has_nodata && (v) == (w)->nodata ) )
+
+static double
+warp_nearest (const warp_params *w, double px, double py)
+{
+  long c, r;
+  double v;
+
+  c = (long) floor(px);
+  r = (long) floor(py);
+  if ( c < 0 || c >= w->src_ncol || r < 0 || r >= w->src_nrow ) {
+    return w->dst_nodata;
+  }
+  v = w->src[r * w->src_ncol + c];
+
+  return WARP_IS_NODATA(w, v) ? w->dst_nodata : v;
+}
+
+static double
+warp_bilinear (const warp_params *w, double px, double py)
+{
+  double fx = px - 0.5, fy = py - 0.5;
+  double tx, ty, wt, v, sum = 0.0, wsum = 0.0;
+  long c0, r0, c, r;
+  int i, j;
+
+  if ( px < 0 || px > w->src_ncol || py < 0 || py > w->src_nrow ) {
+    return w->dst_nodata;
+  }
+
+  c0 = (long) floor(fx);
+  r0 = (long) floor(fy);
+  tx = fx - c0;
+  ty = fy - r0;
+
+  for (i=0; i<2; i++) {
+    r = r0 + i;
+    if ( r < 0 || r >= w->src_nrow ) continue;
+    for (j=0; j<2; j++) {
+      c = c0 + j;
+      if ( c < 0 || c >= w->src_ncol ) continue;
+      v = w->src[r * w->src_ncol + c];
+      if ( WARP_IS_NODATA(w, v) ) continue;
+      wt = ( i ? ty : 1.0 - ty ) * ( j ? tx : 1.0 - tx );
+      sum  += wt * v;
+      wsum += wt;
+    }
+  }
+
+  return ( wsum > 1e-10 ) ? sum / wsum : w->dst_nodata;
+}
+
+/* Keys cubic convolution kernel (a = -0.5) */
+static double
+warp_cubic_weight (double t)
+{
+  t = fabs(t);
+  if ( t <= 1.0 ) {
+    return (1.5 * t - 2.5) * t * t + 1.0;
+  }
+  else if ( t < 2.0 ) {
+    return ((-0.5 * t + 2.5) * t - 4.0) * t + 2.0;
+  }
+  return 0.0;
+}
+
+static double
+warp_cubic (const warp_params *w, double px, double py)
+{
+  double fx = px - 0.5, fy = py - 0.5;
+  double wx[4], wy[4], v, sum = 0.0;
+  long c0, r0, c, r;
+  int i, j;
+
+  if ( px < 0 || px > w->src_ncol || py < 0 || py > w->src_nrow ) {
+    return w->dst_nodata;
+  }
+
+  c0 = (long) floor(fx) - 1;
+  r0 = (long) floor(fy) - 1;
+
+  /* falls back to bilinear near the edges */
+  if ( c0 < 0 || c0 + 3 >= w->src_ncol || r0 < 0 || r0 + 3 >= w->src_nrow ) {
+    return warp_bilinear(w, px, py);
+  }
+
+  for (i=0; i<4; i++) {
+    wx[i] = warp_cubic_weight(fx - (c0 + i));
+    wy[i] = warp_cubic_weight(fy - (r0 + i));
+  }
+
+  for (i=0; i<4; i++) {
+    r = r0 + i;
+    for (j=0; j<4; j++) {
+      c = c0 + j;
+      v = w->src[r * w->src_ncol + c];
+      if ( WARP_IS_NODATA(w, v) ) {
+        /* and also where nodata is in the kernel */
+        return warp_bilinear(w, px, py);
+      }
+      sum += wy[i] * wx[j] * v;
+    }
+  }
+
+  return sum;
+}
+
+static void
+warp_band_run (warp_band *band)
+{
+  warp_params *w = band->w;
+  const double *gt = w->dst_gt, *inv = w->src_inv;
+  rb_proj_grid g;
+  double *x, *y, px, py, v;
+  long r, r1, n, k;
+
+  n = ( band->r1 - band->r0 < WARP_CHUNK_ROWS ) ? band->r1 - band->r0 : WARP_CHUNK_ROWS;
+  n *= w->dst_ncol;
+  x = malloc(n * sizeof(double));
+  y = malloc(n * sizeof(double));
+  if ( ! x || ! y ) {
+    band->status = -1;
+    goto out;
+  }
+
+  for (r=band->r0; r<band->r1; r=r1) {
+    if ( w->interrupted ) {
+      break;
+    }
+    r1 = ( r + WARP_CHUNK_ROWS < band->r1 ) ? r + WARP_CHUNK_ROWS : band->r1;
+
+    memset(&g, 0, sizeof(rb_proj_grid));
+    g.ref       = band->ref;
+    g.direction = PJ_INV;
+    g.x0        = gt[0] + 0.5 * gt[1] + (r + 0.5) * gt[2];
+    g.y0        = gt[3] + 0.5 * gt[4] + (r + 0.5) * gt[5];
+    g.xc        = gt[1];
+    g.xr        = gt[2];
+    g.yc        = gt[4];
+    g.yr        = gt[5];
+    g.nrow      = r1 - r;
+    g.ncol      = w->dst_ncol;
+    g.max_error = w->max_error;
+    g.x         = x;
+    g.y         = y;
+
+    band->status = rb_proj_grid_run(&g);
+    rb_proj_grid_free(&g);
+    if ( band->status ) {
+      goto out;
+    }
+
+    n = (r1 - r) * w->dst_ncol;
+    for (k=0; k<n; k++) {
+      if ( ! isfinite(x[k]) || ! isfinite(y[k]) ) {
+        v = w->dst_nodata;
+      }
+      else {
+        px = inv[0] + x[k] * inv[1] + y[k] * inv[2];
+        py = inv[3] + x[k] * inv[4] + y[k] * inv[5];
+        switch ( w->resampling ) {
+        case WARP_BILINEAR:
+          v = warp_bilinear(w, px, py);
+          break;
+        case WARP_CUBIC:
+          v = warp_cubic(w, px, py);
+          break;
+        default:
+          v = warp_nearest(w, px, py);
+          break;
+        }
+      }
+      w->dst[r * w->dst_ncol + k] = v;
+    }
+  }
+
+out:
+  free(x);
+  free(y);
+}
+
+#ifdef HAVE_PTHREAD_H
+
+typedef struct {
+  warp_band *bands;
+  int nthreads;
+} warp_job;
+
+static void *
+warp_thread_main (void *arg)
+{
+  warp_band_run((warp_band *) arg);
+  return NULL;
+}
+
+static void *
+warp_run_threads (void *arg)
+{
+  warp_job *job = (warp_job *) arg;
+  pthread_t threads[WARP_MAX_THREADS];
+  int started[WARP_MAX_THREADS];
+  int i;
+
+  for (i=0; i<job->nthreads; i++) {
+    started[i] = ( pthread_create(&threads[i], NULL, warp_thread_main, &job->bands[i]) == 0 );
+    if ( ! started[i] ) {
+      /* runs in this thread instead */
+      warp_band_run(&job->bands[i]);
+    }
+  }
+  for (i=0; i<job->nthreads; i++) {
+    if ( started[i] ) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+
+  return NULL;
+}
+
+static void
+warp_interrupt (void *arg)
+{
+  warp_job *job = (warp_job *) arg;
+  job->bands[0].w->interrupted = 1;
+}
+
+#endif
+
+static int
+warp_default_threads (long nrow)
+{
+  long n = 1;
+
+#if defined(HAVE_PTHREAD_H) && defined(_SC_NPROCESSORS_ONLN)
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if ( n > nrow / WARP_CHUNK_ROWS ) {
+    n = nrow / WARP_CHUNK_ROWS;
+  }
+  if ( n > WARP_MAX_THREADS ) {
+    n = WARP_MAX_THREADS;
+  }
+  return ( n < 1 ) ? 1 : (int) n;
+}
+
+static void
+rb_proj_get_geotransform (VALUE vgt, double *gt)
+{
+  int i;
+
+  vgt = rb_Array(vgt);
+  if ( RARRAY_LEN(vgt) != 6 ) {
+    rb_raise(rb_eArgError, "geotransform should be an array with 6 elements");
+  }
+  for (i=0; i<6; i++) {
+    gt[i] = NUM2DBL(RARRAY_AREF(vgt, i));
+  }
+}
+
+typedef struct {
+  Proj *proj;
+  warp_params w;
+  rb_proj_buffer bsrc, bdst;
+  VALUE vsrc, vout;
+  long src_nrow, src_ncol;
+  long dst_len;
+  warp_band bands[WARP_MAX_THREADS];
+  int nthreads;
+  int status;
+} warp_args;
+
+static void
+warp_get_buffers (warp_args *a)
+{
+  rb_proj_buffer_get(a->vsrc, &a->bsrc, 0);
+  if ( a->bsrc.ndim == 2 && a->src_nrow < 0 ) {
+    a->src_nrow = a->bsrc.shape[0];
+    a->src_ncol = a->bsrc.shape[1];
+  }
+  if ( a->src_nrow <= 0 || a->src_ncol <= 0 ||
+       a->src_nrow > a->bsrc.len / a->src_ncol ) {
+    rb_raise(rb_eArgError, "invalid or missing src_shape");
+  }
+  a->w.src      = a->bsrc.ptr;
+  a->w.src_nrow = a->src_nrow;
+  a->w.src_ncol = a->src_ncol;
+
+  if ( ! a->w.dst ) {
+    rb_proj_buffer_get(a->vout, &a->bdst, 1);
+    if ( a->bdst.len < a->dst_len ) {
+      rb_raise(rb_eArgError, "output buffer is too small");
+    }
+    a->w.dst = a->bdst.ptr;
+  }
+}
+
+/* destroys the contexts and the clones of the bands */
+static void
+warp_destroy_bands (warp_args *a)
+{
+  int i;
+
+  for (i=0; i<a->nthreads; i++) {
+    if ( a->bands[i].ctx ) {
+      if ( a->bands[i].ref ) {
+        proj_destroy(a->bands[i].ref);
+      }
+      proj_context_destroy(a->bands[i].ctx);
+    }
+    a->bands[i].ctx = NULL;
+    a->bands[i].ref = NULL;
+  }
+}
+
+static VALUE
+warp_run (VALUE arg)
+{
+  warp_args *a = (warp_args *) arg;
+  long nrow = a->w.dst_nrow;
+  int i;
+
+  warp_get_buffers(a);
+
+  for (i=0; i<a->nthreads; i++) {
+    a->bands[i].w  = &a->w;
+    a->bands[i].r0 = nrow * i / a->nthreads;
+    a->bands[i].r1 = nrow * (i + 1) / a->nthreads;
+  }
+
+#ifdef HAVE_PTHREAD_H
+  if ( a->nthreads > 1 ) {
+    for (i=0; i<a->nthreads; i++) {
+      a->bands[i].ctx = proj_context_create();
+      a->bands[i].ref = a->bands[i].ctx ? proj_clone(a->bands[i].ctx, a->proj->ref) : NULL;
+      if ( ! a->bands[i].ref ) {
+        /* e.g. operation with several candidates on PROJ < 8.2 */
+        warp_destroy_bands(a);
+        a->nthreads = 1;
+        a->bands[0].r0 = 0;
+        a->bands[0].r1 = nrow;
+        break;
+      }
+    }
+  }
+  if ( a->nthreads > 1 ) {
+    warp_job job;
+    /* the Strings are used without GVL */
+    rb_proj_buffer_lock(&a->bsrc);
+    if ( a->bdst.obj != a->bsrc.obj ) {
+      rb_proj_buffer_lock(&a->bdst);
+    }
+    job.bands    = a->bands;
+    job.nthreads = a->nthreads;
+    rb_thread_call_without_gvl(warp_run_threads, &job, warp_interrupt, &job);
+  }
+  else
+#endif
+  {
+    a->bands[0].ref = a->proj->ref;
+    warp_band_run(&a->bands[0]);
+  }
+
+  for (i=0; i<a->nthreads; i++) {
+    if ( a->bands[i].status ) {
+      a->status = -1;
+    }
+  }
+
+  return Qnil;
+}
+
+static VALUE
+warp_cleanup (VALUE arg)
+{
+  warp_args *a = (warp_args *) arg;
+
+  warp_destroy_bands(a);
+  rb_proj_buffer_release(&a->bsrc);
+  rb_proj_buffer_release(&a->bdst);
+
+  return Qnil;
+}
+
+/*
+Reprojects a raster from the source CRS to the target CRS of the object.
+
+The centers of the destination pixels are inversely transformed
+(as #transform_inverse does) to the source CRS, and the source raster is
+resampled there. The geotransforms follow the GDAL convention,
+i.e. the coordinates of the corner of pixel (row, col) are
+
+    x = gt[0] + col*gt[1] + row*gt[2]
+    y = gt[3] + col*gt[4] + row*gt[5]
+
+The source raster is a 2-dimensional MemoryView of doubles (e.g. CArray),
+or a String packed with native doubles in row-major order with `src_shape`.
+Source values equal to `nodata` or NaN are treated as missing, and output
+pixels that can not be computed are set to `nodata` (NaN if not given).
+With `max_error`, the inverse transformation is approximated
+as #transform_grid does.
+
+@overload warp(src, src_geotransform, dst_geotransform, dst_shape, resampling: :nearest, src_shape: nil, nodata: nil, max_error: 0.0, threads: nil, out: nil)
+  @param src [String, CArray] source raster
+  @param src_geotransform [Array] geotransform of source raster
+  @param dst_geotransform [Array] geotransform of destination raster
+  @param dst_shape [Array] [nrow, ncol] of destination raster
+  @param resampling [Symbol] :nearest, :bilinear or :cubic
+  @param src_shape [Array, nil] [nrow, ncol] of source raster
+  @param nodata [Numeric, nil] nodata value
+  @param max_error [Numeric] error bound of the approximation in source CRS units
+  @param threads [Integer, nil] number of worker threads
+  @param out [String, CArray, nil] output buffer
+
+@return [String, CArray] output buffer
+
+@example
+  pj  = PROJ.new("EPSG:4326", "EPSG:3857")
+  dst = pj.warp(src, [90, 0.1, 0, -180, 0, 0.1], [-2e7, 1e4, 0, 2e7, 0, -1e4], [4000, 4000],
+                src_shape: [1800, 3600], resampling: :bilinear)
+*/
+static VALUE
+rb_proj_warp (int argc, VALUE *argv, VALUE self)
+{
+  volatile VALUE vsrc, vsrc_gt, vdst_gt, vdst_shape, vopts, vout;
+  ID kw_ids[6];
+  VALUE kw_vals[6];
+  warp_args a;
+  double gt[6], det;
+  long src_nrow, src_ncol, dst_len;
+  int nthreads;
+  ID id_resampling;
+
+  rb_scan_args(argc, argv, "4:", (VALUE *)&vsrc, (VALUE *)&vsrc_gt,
+               (VALUE *)&vdst_gt, (VALUE *)&vdst_shape, (VALUE *)&vopts);
+
+  memset(&a, 0, sizeof(warp_args));
+
+  a.proj = rb_proj_get_struct(self);
+
+  kw_ids[0] = rb_intern("resampling");
+  kw_ids[1] = rb_intern("src_shape");
+  kw_ids[2] = rb_intern("nodata");
+  kw_ids[3] = rb_intern("max_error");
+  kw_ids[4] = rb_intern("threads");
+  kw_ids[5] = rb_intern("out");
+  rb_get_kwargs(vopts, kw_ids, 0, 6, kw_vals);
+
+  a.w.resampling = WARP_NEAREST;
+  if ( kw_vals[0] != Qundef ) {
+    id_resampling = rb_to_id(kw_vals[0]);
+    if ( id_resampling == rb_intern("bilinear") ) {
+      a.w.resampling = WARP_BILINEAR;
+    }
+    else if ( id_resampling == rb_intern("cubic") ) {
+      a.w.resampling = WARP_CUBIC;
+    }
+    else if ( id_resampling != rb_intern("nearest") ) {
+      rb_raise(rb_eArgError, "invalid resampling method");
+    }
+  }
+
+  rb_proj_get_geotransform(vsrc_gt, gt);
+  det = gt[1] * gt[5] - gt[2] * gt[4];
+  if ( det == 0.0 ) {
+    rb_raise(rb_eArgError, "source geotransform is not invertible");
+  }
+  a.w.src_inv[0] = (gt[2] * gt[3] - gt[0] * gt[5]) / det;
+  a.w.src_inv[1] =  gt[5] / det;
+  a.w.src_inv[2] = -gt[2] / det;
+  a.w.src_inv[3] = (gt[0] * gt[4] - gt[1] * gt[3]) / det;
+  a.w.src_inv[4] = -gt[4] / det;
+  a.w.src_inv[5] =  gt[1] / det;
+
+  rb_proj_get_geotransform(vdst_gt, a.w.dst_gt);
+
+  vdst_shape = rb_Array(vdst_shape);
+  if ( RARRAY_LEN(vdst_shape) != 2 ) {
+    rb_raise(rb_eArgError, "dst_shape should be an array with 2 elements");
+  }
+  a.w.dst_nrow = NUM2LONG(RARRAY_AREF(vdst_shape, 0));
+  a.w.dst_ncol = NUM2LONG(RARRAY_AREF(vdst_shape, 1));
+  if ( a.w.dst_nrow <= 0 || a.w.dst_ncol <= 0 ) {
+    rb_raise(rb_eArgError, "invalid dst_shape");
+  }
+  dst_len = rb_proj_shape_size(a.w.dst_nrow, a.w.dst_ncol);
+
+  src_nrow = src_ncol = -1;
+  if ( kw_vals[1] != Qundef && ! NIL_P(kw_vals[1]) ) {
+    VALUE vsrc_shape = rb_Array(kw_vals[1]);
+    if ( RARRAY_LEN(vsrc_shape) != 2 ) {
+      rb_raise(rb_eArgError, "src_shape should be an array with 2 elements");
+    }
+    src_nrow = NUM2LONG(RARRAY_AREF(vsrc_shape, 0));
+    src_ncol = NUM2LONG(RARRAY_AREF(vsrc_shape, 1));
+  }
+
+  if ( kw_vals[2] != Qundef && ! NIL_P(kw_vals[2]) ) {
+    a.w.has_nodata = 1;
+    a.w.nodata     = NUM2DBL(kw_vals[2]);
+    a.w.dst_nodata = a.w.nodata;
+  }
+  else {
+    a.w.dst_nodata = NAN;
+  }
+
+  a.w.max_error = ( kw_vals[3] == Qundef ) ? 0.0 : NUM2DBL(kw_vals[3]);
+
+  if ( kw_vals[4] != Qundef && ! NIL_P(kw_vals[4]) ) {
+    nthreads = NUM2INT(kw_vals[4]);
+    if ( nthreads < 1 ) {
+      nthreads = 1;
+    }
+    if ( nthreads > WARP_MAX_THREADS ) {
+      nthreads = WARP_MAX_THREADS;
+    }
+    if ( nthreads > a.w.dst_nrow ) {
+      nthreads = (int) a.w.dst_nrow;
+    }
+  }
+  else {
+    nthreads = warp_default_threads(a.w.dst_nrow);
+  }
+#ifndef HAVE_PTHREAD_H
+  nthreads = 1;
+#endif
+  a.nthreads = nthreads;
+
+  if ( kw_vals[5] == Qundef || NIL_P(kw_vals[5]) ) {
+    vout = rb_proj_buffer_new(dst_len, &a.w.dst);
+  }
+  else {
+    vout = kw_vals[5];
+  }
+
+  a.vsrc     = vsrc;
+  a.vout     = vout;
+  a.src_nrow = src_nrow;
+  a.src_ncol = src_ncol;
+  a.dst_len  = dst_len;
+
+  rb_ensure(warp_run, (VALUE) &a, warp_cleanup, (VALUE) &a);
+
+  /* the bands fail only on allocation */
+  if ( a.status ) {
+    rb_memerror();
+  }
+  if ( a.w.interrupted ) {
+    rb_thread_check_ints();
+  }
+
+  return vout;
+}
+
+void
+Init_simple_proj_warp (void)
+{
+  rb_define_method(rb_cProj, "warp", rb_proj_warp, -1);
+}
@@ -0,0 +1,722 @@
+#include "ruby.h"
+#include "ruby/thread.h"
+#include "rb_proj.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/*
+Transformation of WKB/EWKB geometries.
+
+Each geometry is parsed three times: to count the points, to read the
+coordinates into a batch, and to write the transformed coordinates back
+at the same offsets (the layout of the geometry does not change).
+The blobs are copied into one arena which worker threads process without
+GVL, each with a PJ cloned into its own PJ_CONTEXT. If the PJ can't be
+cloned (operations with several candidates on PROJ < 8.2), the blobs are
+processed in the calling thread.
+*/
+
+/* maximum number of worker threads */
+#define WKB_MAX_THREADS 16
+
+/* maximum nesting level of collections */
+#define WKB_MAX_DEPTH 32
+
+#define WKB_FLAG_Z    0x80000000U
+#define WKB_FLAG_M    0x40000000U
+#define WKB_FLAG_SRID 0x20000000U
+
+enum {
+  WKB_COUNT = 0,
+  WKB_READ,
+  WKB_WRITE
+};
+
+/* status of a blob other than PROJ error numbers */
+enum {
+  WKB_OK = 0,
+  WKB_ENOMEM = -1,
+  WKB_EMALFORMED = -2,
+  WKB_EFAILED = -3
+};
+
+#ifdef WORDS_BIGENDIAN
+#define WKB_NATIVE_ORDER 0
+#else
+#define WKB_NATIVE_ORDER 1
+#endif
+
+typedef struct {
+  unsigned char *data;
+  long len;
+  int mode;
+  long k;
+  double *x, *y, *z;
+} wkb_pass;
+
+typedef struct {
+  PJ_DIRECTION direction;
+  int in_ang, out_ang, latlon;
+} wkb_opts;
+
+typedef struct {
+  long offset, len;
+  int status;
+} wkb_item;
+
+static inline uint32_t
+wkb_get_u32 (const unsigned char *p, int swap)
+{
+  uint32_t v;
+  memcpy(&v, p, 4);
+  if ( swap ) {
+    v = ( (v & 0xFF) << 24 ) | ( (v & 0xFF00) << 8 ) |
+        ( (v >> 8) & 0xFF00 ) | ( v >> 24 );
+  }
+  return v;
+}
+
+static inline void
+wkb_put_u32 (unsigned char *p, uint32_t v, int swap)
+{
+  if ( swap ) {
+    v = ( (v & 0xFF) << 24 ) | ( (v & 0xFF00) << 8 ) |
+        ( (v >> 8) & 0xFF00 ) | ( v >> 24 );
+  }
+  memcpy(p, &v, 4);
+}
+
+static inline double
+wkb_get_double (const unsigned char *p, int swap)
+{
+  unsigned char b[8];
+  double v;
+  int i;
+  if ( swap ) {
+    for (i=0; i<8; i++) b[i] = p[7-i];
+    memcpy(&v, b, 8);
+  }
+  else {
+    memcpy(&v, p, 8);
+  }
+  return v;
+}
+
+static inline void
+wkb_put_double (unsigned char *p, double v, int swap)
+{
+  unsigned char b[8];
+  int i;
+  if ( swap ) {
+    memcpy(b, &v, 8);
+    for (i=0; i<8; i++) p[i] = b[7-i];
+  }
+  else {
+    memcpy(p, &v, 8);
+  }
+}
+
+/*
+Parses the header of a geometry at *pos. The geometry type is returned
+without the dimension flags (EWKB) or offsets (ISO).
+*/
+static int
+wkb_header (const unsigned char *data, long len, long *pos,
+            int *swap, uint32_t *type, int *has_z, int *has_m, int *has_srid)
+{
+  uint32_t t;
+
+  if ( *pos + 5 > len || data[*pos] > 1 ) {
+    return WKB_EMALFORMED;
+  }
+  *swap = ( data[*pos] != WKB_NATIVE_ORDER );
+  t = wkb_get_u32(data + *pos + 1, *swap);
+  *pos += 5;
+
+  *has_z    = ( t & WKB_FLAG_Z ) != 0;
+  *has_m    = ( t & WKB_FLAG_M ) != 0;
+  *has_srid = ( t & WKB_FLAG_SRID ) != 0;
+  t &= 0x0FFFFFFFU;
+  if ( t >= 3000 ) {
+    *has_z = *has_m = 1;
+  }
+  else if ( t >= 2000 ) {
+    *has_m = 1;
+  }
+  else if ( t >= 1000 ) {
+    *has_z = 1;
+  }
+  *type = t % 1000;
+
+  if ( *has_srid ) {
+    if ( *pos + 4 > len ) {
+      return WKB_EMALFORMED;
+    }
+    *pos += 4;
+  }
+
+  return WKB_OK;
+}
+
+static int
+wkb_points (wkb_pass *s, long *pos, long n, int swap, int has_z, int has_m)
+{
+  long size = 8 * (2 + has_z + has_m);
+  unsigned char *p;
+  long i;
+
+  if ( n < 0 || n > ( s->len - *pos ) / size ) {
+    return WKB_EMALFORMED;
+  }
+
+  p = s->data + *pos;
+  for (i=0; i<n; i++, p+=size, s->k++) {
+    switch ( s->mode ) {
+    case WKB_READ:
+      s->x[s->k] = wkb_get_double(p, swap);
+      s->y[s->k] = wkb_get_double(p + 8, swap);
+      s->z[s->k] = ( has_z ) ? wkb_get_double(p + 16, swap) : 0.0;
+      break;
+    case WKB_WRITE:
+      wkb_put_double(p, s->x[s->k], swap);
+      wkb_put_double(p + 8, s->y[s->k], swap);
+      if ( has_z ) {
+        wkb_put_double(p + 16, s->z[s->k], swap);
+      }
+      break;
+    }
+  }
+  *pos += n * size;
+
+  return WKB_OK;
+}
+
+static int
+wkb_u32_at (wkb_pass *s, long *pos, int swap, long *n)
+{
+  if ( *pos + 4 > s->len ) {
+    return WKB_EMALFORMED;
+  }
+  *n = (long) wkb_get_u32(s->data + *pos, swap);
+  *pos += 4;
+  return WKB_OK;
+}
+
+static int
+wkb_geometry (wkb_pass *s, long *pos, int depth)
+{
+  uint32_t type;
+  long n, m, i;
+  int swap, has_z, has_m, has_srid, status;
+
+  if ( depth > WKB_MAX_DEPTH ) {
+    return WKB_EMALFORMED;
+  }
+
+  status = wkb_header(s->data, s->len, pos, &swap, &type, &has_z, &has_m, &has_srid);
+  if ( status ) {
+    return status;
+  }
+
+  switch ( type ) {
+  case 1:                      /* Point */
+    return wkb_points(s, pos, 1, swap, has_z, has_m);
+  case 2:                      /* LineString */
+  case 8:                      /* CircularString */
+    if ( ( status = wkb_u32_at(s, pos, swap, &n) ) ) {
+      return status;
+    }
+    return wkb_points(s, pos, n, swap, has_z, has_m);
+  case 3:                      /* Polygon */
+  case 17:                     /* Triangle */
+    if ( ( status = wkb_u32_at(s, pos, swap, &n) ) ) {
+      return status;
+    }
+    for (i=0; i<n; i++) {
+      if ( ( status = wkb_u32_at(s, pos, swap, &m) ) ||
+           ( status = wkb_points(s, pos, m, swap, has_z, has_m) ) ) {
+        return status;
+      }
+    }
+    return WKB_OK;
+  case 4:  case 5:  case 6:  case 7:       /* Multi*, GeometryCollection */
+  case 9:  case 10: case 11: case 12:      /* curves and surfaces */
+  case 15: case 16:                        /* PolyhedralSurface, TIN */
+    if ( ( status = wkb_u32_at(s, pos, swap, &n) ) ) {
+      return status;
+    }
+    for (i=0; i<n; i++) {
+      if ( ( status = wkb_geometry(s, pos, depth + 1) ) ) {
+        return status;
+      }
+    }
+    return WKB_OK;
+  default:
+    return WKB_EMALFORMED;
+  }
+}
+
+static int
+wkb_run_pass (wkb_pass *s, int mode)
+{
+  long pos = 0;
+  int status;
+
+  s->mode = mode;
+  s->k    = 0;
+  status  = wkb_geometry(s, &pos, 0);
+  if ( status == WKB_OK && pos != s->len ) {
+    status = WKB_EMALFORMED;
+  }
+  return status;
+}
+
+/* transforms the coordinates of a blob in place (called without GVL) */
+static int
+wkb_transform_blob (PJ *ref, const wkb_opts *o, unsigned char *data, long len)
+{
+  wkb_pass s;
+  double *buf, *t;
+  long n, i;
+  int status;
+
+  memset(&s, 0, sizeof(s));
+  s.data = data;
+  s.len  = len;
+
+  if ( ( status = wkb_run_pass(&s, WKB_COUNT) ) ) {
+    return status;
+  }
+  n = s.k;
+  if ( n == 0 ) {
+    return WKB_OK;
+  }
+
+  buf = malloc(3 * n * sizeof(double));
+  if ( ! buf ) {
+    return WKB_ENOMEM;
+  }
+  s.x = buf;
+  s.y = buf + n;
+  s.z = buf + 2 * n;
+  wkb_run_pass(&s, WKB_READ);
+
+  /* as #forward_latlon, coordinates are given as (lat, lon) */
+  if ( o->latlon && o->direction == PJ_FWD ) {
+    t = s.x; s.x = s.y; s.y = t;
+  }
+  if ( o->in_ang ) {
+    for (i=0; i<n; i++) {
+      s.x[i] = proj_torad(s.x[i]);
+      s.y[i] = proj_torad(s.y[i]);
+    }
+  }
+
+  proj_errno_reset(ref);
+  proj_trans_generic(ref, o->direction,
+                     s.x, sizeof(double), n,
+                     s.y, sizeof(double), n,
+                     s.z, sizeof(double), n,
+                     NULL, 0, 0);
+
+  for (i=0; i<n; i++) {
+    if ( s.x[i] == HUGE_VAL || s.y[i] == HUGE_VAL ) {
+      status = proj_errno(ref);
+      free(buf);
+      return ( status ) ? status : WKB_EFAILED;
+    }
+  }
+
+  if ( o->out_ang ) {
+    for (i=0; i<n; i++) {
+      s.x[i] = proj_todeg(s.x[i]);
+      s.y[i] = proj_todeg(s.y[i]);
+    }
+  }
+  /* as #inverse_latlon, coordinates are returned as (lat, lon) */
+  if ( o->latlon && o->direction == PJ_INV ) {
+    t = s.x; s.x = s.y; s.y = t;
+  }
+
+  wkb_run_pass(&s, WKB_WRITE);
+  free(buf);
+
+  return WKB_OK;
+}
+
+typedef struct {
+  PJ_CONTEXT *ctx;
+  PJ *ref;
+  const wkb_opts *opts;
+  unsigned char *arena;
+  wkb_item *items;
+  long i0, i1;
+  volatile int *interrupted;
+} wkb_worker;
+
+static void
+wkb_worker_run (wkb_worker *wk)
+{
+  long i;
+
+  for (i=wk->i0; i<wk->i1; i++) {
+    if ( *wk->interrupted ) {
+      break;
+    }
+    wk->items[i].status = wkb_transform_blob(wk->ref, wk->opts,
+                                             wk->arena + wk->items[i].offset,
+                                             wk->items[i].len);
+  }
+}
+
+#ifdef HAVE_PTHREAD_H
+
+typedef struct {
+  wkb_worker *workers;
+  int nthreads;
+  volatile int *interrupted;
+} wkb_job;
+
+static void *
+wkb_thread_main (void *arg)
+{
+  wkb_worker_run((wkb_worker *) arg);
+  return NULL;
+}
+
+static void *
+wkb_run_threads (void *arg)
+{
+  wkb_job *job = (wkb_job *) arg;
+  pthread_t threads[WKB_MAX_THREADS];
+  int started[WKB_MAX_THREADS];
+  int i;
+
+  for (i=0; i<job->nthreads; i++) {
+    started[i] = ( pthread_create(&threads[i], NULL, wkb_thread_main, &job->workers[i]) == 0 );
+    if ( ! started[i] ) {
+      /* runs in this thread instead */
+      wkb_worker_run(&job->workers[i]);
+    }
+  }
+  for (i=0; i<job->nthreads; i++) {
+    if ( started[i] ) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+
+  return NULL;
+}
+
+static void
+wkb_interrupt (void *arg)
+{
+  wkb_job *job = (wkb_job *) arg;
+  *job->interrupted = 1;
+}
+
+#endif
+
+static int
+wkb_default_threads (long nblobs)
+{
+  long n = 1;
+
+#if defined(HAVE_PTHREAD_H) && defined(_SC_NPROCESSORS_ONLN)
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if ( n > nblobs ) {
+    n = nblobs;
+  }
+  if ( n > WKB_MAX_THREADS ) {
+    n = WKB_MAX_THREADS;
+  }
+  return ( n < 1 ) ? 1 : (int) n;
+}
+
+typedef struct {
+  Proj *proj;
+  wkb_opts opts;
+  unsigned char *arena;
+  wkb_item *items;
+  long nitems;
+  wkb_worker workers[WKB_MAX_THREADS];
+  int nthreads;
+  volatile int interrupted;
+} wkb_args;
+
+/* destroys the contexts and the clones of the workers */
+static void
+wkb_destroy_workers (wkb_args *a)
+{
+  int i;
+
+  for (i=0; i<a->nthreads; i++) {
+    if ( a->workers[i].ctx ) {
+      if ( a->workers[i].ref ) {
+        proj_destroy(a->workers[i].ref);
+      }
+      proj_context_destroy(a->workers[i].ctx);
+    }
+    a->workers[i].ctx = NULL;
+    a->workers[i].ref = NULL;
+  }
+}
+
+static VALUE
+wkb_run (VALUE arg)
+{
+  wkb_args *a = (wkb_args *) arg;
+  int i;
+
+  for (i=0; i<a->nthreads; i++) {
+    a->workers[i].opts  = &a->opts;
+    a->workers[i].arena = a->arena;
+    a->workers[i].items = a->items;
+    a->workers[i].i0    = a->nitems * i / a->nthreads;
+    a->workers[i].i1    = a->nitems * (i + 1) / a->nthreads;
+    a->workers[i].interrupted = &a->interrupted;
+  }
+
+#ifdef HAVE_PTHREAD_H
+  if ( a->nthreads > 1 ) {
+    for (i=0; i<a->nthreads; i++) {
+      a->workers[i].ctx = proj_context_create();
+      a->workers[i].ref = a->workers[i].ctx ? proj_clone(a->workers[i].ctx, a->proj->ref) : NULL;
+      if ( ! a->workers[i].ref ) {
+        /* e.g. operation with several candidates on PROJ < 8.2 */
+        wkb_destroy_workers(a);
+        a->nthreads = 1;
+        a->workers[0].i0 = 0;
+        a->workers[0].i1 = a->nitems;
+        break;
+      }
+    }
+  }
+  if ( a->nthreads > 1 ) {
+    wkb_job job;
+    job.workers     = a->workers;
+    job.nthreads    = a->nthreads;
+    job.interrupted = &a->interrupted;
+    rb_thread_call_without_gvl(wkb_run_threads, &job, wkb_interrupt, &job);
+  }
+  else
+#endif
+  {
+    a->workers[0].ref = a->proj->ref;
+    wkb_worker_run(&a->workers[0]);
+  }
+
+  return Qnil;
+}
+
+static VALUE
+wkb_cleanup (VALUE arg)
+{
+  wkb_destroy_workers((wkb_args *) arg);
+  return Qnil;
+}
+
+/* sets SRID of the top-level geometry (EWKB), the blob may be extended */
+static VALUE
+wkb_set_srid (VALUE vblob, uint32_t srid)
+{
+  const unsigned char *data = (const unsigned char *) RSTRING_PTR(vblob);
+  unsigned char header[9];
+  uint32_t type, base;
+  int swap;
+
+  if ( RSTRING_LEN(vblob) < 5 || data[0] > 1 ) {
+    rb_raise(rb_eArgError, "malformed WKB");
+  }
+  swap = ( data[0] != WKB_NATIVE_ORDER );
+  type = wkb_get_u32(data + 1, swap);
+
+  if ( type & WKB_FLAG_SRID ) {
+    if ( RSTRING_LEN(vblob) < 9 ) {
+      rb_raise(rb_eArgError, "malformed WKB");
+    }
+    wkb_put_u32((unsigned char *) RSTRING_PTR(vblob) + 5, srid, swap);
+    return vblob;
+  }
+
+  /* ISO type codes are converted into EWKB flags */
+  base = type & 0x0FFFFFFFU;
+  type &= ~0x0FFFFFFFU;
+  if ( base >= 3000 ) {
+    type |= WKB_FLAG_Z | WKB_FLAG_M;
+  }
+  else if ( base >= 2000 ) {
+    type |= WKB_FLAG_M;
+  }
+  else if ( base >= 1000 ) {
+    type |= WKB_FLAG_Z;
+  }
+  type |= ( base % 1000 ) | WKB_FLAG_SRID;
+
+  header[0] = data[0];
+  wkb_put_u32(header + 1, type, swap);
+  wkb_put_u32(header + 5, srid, swap);
+  rb_str_update(vblob, 0, 5, rb_str_new((const char *) header, 9));
+
+  return vblob;
+}
+
+/*
+Transforms WKB/EWKB blobs. See PROJ#transform_wkb.
+
+@private
+*/
+static VALUE
+rb_proj_transform_wkb (VALUE self, VALUE vblobs, VALUE vinplace, VALUE vdir,
+                       VALUE vlatlon, VALUE vsrid, VALUE vthreads)
+{
+  volatile VALUE varena, vitems, vstrs, vout, vblob;
+  wkb_args a;
+  long total = 0, i;
+  int status, nthreads;
+
+  memset(&a, 0, sizeof(a));
+  a.proj = rb_proj_get_struct(self);
+
+  Check_Type(vblobs, T_ARRAY);
+
+  if ( rb_to_id(vdir) == id_forward ) {
+    a.opts.direction = PJ_FWD;
+  }
+  else if ( rb_to_id(vdir) == id_inverse ) {
+    a.opts.direction = PJ_INV;
+  }
+  else {
+    rb_raise(rb_eArgError, "invalid direction");
+  }
+  a.opts.latlon = RTEST(vlatlon);
+
+  /* units follow #forward and #inverse if the source is latlong */
+  if ( a.proj->forward ) {
+    a.opts.in_ang  = ( proj_angular_input(a.proj->ref, a.opts.direction) == 1 );
+    a.opts.out_ang = ( proj_angular_output(a.proj->ref, a.opts.direction) == 1 );
+  }
+
+  /* the Strings are kept in a private Array, as the elements of vblobs
+     may be converted (to_str) or replaced by other threads meanwhile */
+  a.nitems = RARRAY_LEN(vblobs);
+  vstrs = rb_ary_new_capa(a.nitems);
+  for (i=0; i<a.nitems; i++) {
+    vblob = RARRAY_AREF(vblobs, i);
+    if ( RTEST(vinplace) ) {
+      Check_Type(vblob, T_STRING);
+      rb_str_modify(vblob);
+    }
+    else {
+      vblob = rb_str_to_str(vblob);
+    }
+    rb_ary_push(vstrs, vblob);
+  }
+
+  vitems = rb_str_new(NULL, a.nitems * sizeof(wkb_item));
+  a.items = (wkb_item *) RSTRING_PTR(vitems);
+  for (i=0; i<a.nitems; i++) {
+    vblob = RARRAY_AREF(vstrs, i);
+    a.items[i].offset = total;
+    a.items[i].len    = RSTRING_LEN(vblob);
+    a.items[i].status = WKB_OK;
+    total += RSTRING_LEN(vblob);
+  }
+
+  /* the workers process the copies in the arena */
+  varena = rb_str_new(NULL, total);
+  a.arena = (unsigned char *) RSTRING_PTR(varena);
+  for (i=0; i<a.nitems; i++) {
+    vblob = RARRAY_AREF(vstrs, i);
+    memcpy(a.arena + a.items[i].offset, RSTRING_PTR(vblob), a.items[i].len);
+  }
+
+  if ( NIL_P(vthreads) ) {
+    nthreads = wkb_default_threads(a.nitems);
+  }
+  else {
+    nthreads = NUM2INT(vthreads);
+    if ( nthreads > a.nitems ) {
+      nthreads = (int) a.nitems;
+    }
+    if ( nthreads > WKB_MAX_THREADS ) {
+      nthreads = WKB_MAX_THREADS;
+    }
+    if ( nthreads < 1 ) {
+      nthreads = 1;
+    }
+  }
+#ifndef HAVE_PTHREAD_H
+  nthreads = 1;
+#endif
+  a.nthreads = nthreads;
+
+  rb_ensure(wkb_run, (VALUE) &a, wkb_cleanup, (VALUE) &a);
+
+  if ( a.interrupted ) {
+    rb_thread_check_ints();
+  }
+
+  for (i=0; i<a.nitems; i++) {
+    status = a.items[i].status;
+    if ( status == WKB_ENOMEM ) {
+      rb_memerror();
+    }
+    else if ( status == WKB_EMALFORMED ) {
+      rb_raise(rb_eArgError, "malformed WKB (index %ld)", i);
+    }
+    else if ( status == WKB_EFAILED ) {
+      rb_raise(rb_eRuntimeError, "transformation failed (index %ld)", i);
+    }
+    else if ( status ) {
+      rb_raise(rb_eRuntimeError, "%s (index %ld)", proj_errno_string(status), i);
+    }
+  }
+
+  /* the blobs may be modified by other threads while GVL is released */
+  if ( RTEST(vinplace) ) {
+    for (i=0; i<a.nitems; i++) {
+      vblob = RARRAY_AREF(vstrs, i);
+      rb_str_modify(vblob);
+      if ( RSTRING_LEN(vblob) != a.items[i].len ) {
+        rb_raise(rb_eRuntimeError, "WKB modified during transformation (index %ld)", i);
+      }
+    }
+  }
+
+  vout = rb_ary_new_capa(a.nitems);
+  for (i=0; i<a.nitems; i++) {
+    if ( RTEST(vinplace) ) {
+      vblob = RARRAY_AREF(vstrs, i);
+      memcpy(RSTRING_PTR(vblob), a.arena + a.items[i].offset, a.items[i].len);
+    }
+    else {
+      vblob = rb_str_new((const char *) a.arena + a.items[i].offset, a.items[i].len);
+    }
+    if ( ! NIL_P(vsrid) ) {
+      wkb_set_srid(vblob, NUM2UINT(vsrid));
+    }
+    rb_ary_push(vout, vblob);
+  }
+
+  RB_GC_GUARD(varena);
+  RB_GC_GUARD(vitems);
+  RB_GC_GUARD(vstrs);
+
+  return vout;
+}
+
+void
+Init_simple_proj_wkb (void)
+{
+  rb_define_private_method(rb_cProj, "_transform_wkb", rb_proj_transform_wkb, 6);
+}
@@ -2,6 +2,8 @@ require 'simple_proj_ext'
 require 'json'
 require 'bindata'
 require 'ostruct'
+require 'digest'
+require 'fileutils'
 
 class PROJ
 
@@ -14,6 +16,14 @@ class PROJ
     return OpenStruct.new(_info)
   end
 
+  # Creates a PROJ object whose construction is deferred until the first use.
+  # Same as PROJ.new(def1, def2, lazy: true).
+  #
+  # @return [PROJ]
+  def self.lazy (*args)
+    return new(*args, lazy: true)
+  end
+
   alias transform_forward transform
   
   alias forward_lonlat forward
@@ -100,6 +110,79 @@ class PROJ
     return FACTORS.read(_factors(lon, lat))
   end
 
+  # Transforms the coordinates of GeoJSON object.
+  #
+  # A Hash (parsed GeoJSON) is modified in place and returned, and a String
+  # is parsed and the transformed object is returned as a JSON String.
+  # Positions are transformed as #forward (or #inverse) does. If `latlon` is 
+  # true, positions are regarded as (lat, lon) in the same way as 
+  # #forward_latlon (or #inverse_latlon). "bbox" members are recomputed.
+  #
+  # @param geojson [Hash, String] GeoJSON object or text
+  # @param direction [Symbol] :forward or :inverse
+  # @param latlon [Boolean] 
+  #
+  # @return [Hash, String]
+  def transform_geojson (geojson, direction: :forward, latlon: false)
+    if geojson.is_a?(String)
+      return JSON.generate(_transform_geojson(JSON.parse(geojson), direction, latlon))
+    else
+      return _transform_geojson(geojson, direction, latlon)
+    end
+  end
+
+  # Transforms the coordinates of WKB/EWKB geometry and returns a new String.
+  #
+  # Both byte orders and 2D/Z/M/ZM geometries are supported (M values are 
+  # left unchanged). Coordinates are handled as #transform_geojson does.
+  # If `srid` is given, the SRID of EWKB is set to it (plain WKB is converted 
+  # into EWKB). If `srid` is true, the code of the target CRS (source CRS 
+  # for :inverse) is used.
+  #
+  # @param wkb [String] WKB/EWKB binary
+  # @param direction [Symbol] :forward or :inverse
+  # @param latlon [Boolean]
+  # @param srid [Integer, true, nil]
+  #
+  # @return [String]
+  def transform_wkb (wkb, direction: :forward, latlon: false, srid: nil)
+    srid = _wkb_srid(srid, direction)
+    return _transform_wkb([wkb], false, direction, latlon, srid, 1)[0]
+  end
+
+  # Transforms the coordinates of WKB/EWKB geometry in place. 
+  # See #transform_wkb.
+  #
+  # @return [String] wkb
+  def transform_wkb! (wkb, direction: :forward, latlon: false, srid: nil)
+    srid = _wkb_srid(srid, direction)
+    _transform_wkb([wkb], true, direction, latlon, srid, 1)
+    return wkb
+  end
+
+  # Transforms an Array of WKB/EWKB geometries using worker threads
+  # (the number of processors by default). See #transform_wkb.
+  #
+  # @param wkbs [Array<String>] WKB/EWKB binaries
+  # @param inplace [Boolean] if true, the given Strings are modified
+  #
+  # @return [Array<String>]
+  def transform_wkb_batch (wkbs, direction: :forward, latlon: false, srid: nil, 
+                           inplace: false, threads: nil)
+    srid = _wkb_srid(srid, direction)
+    return _transform_wkb(wkbs.to_a, inplace, direction, latlon, srid, threads)
+  end
+
+  private def _wkb_srid (srid, direction)
+    return srid unless srid == true
+    crs = ( direction == :inverse ) ? source_crs : target_crs
+    code = crs && crs.id_code
+    unless code =~ /\A\d+\z/
+      raise "CRS has no numeric code for SRID"
+    end
+    return code.to_i
+  end
+
 end
 
 class PROJ
@@ -189,6 +272,571 @@ class PROJ::CRS
   
 end
 
+### Context settings
+
+class PROJ
+
+  class << self
+
+    # Returns the path (or SQLite URI) of proj.db used by the default context.
+    #
+    # @return [String, nil]
+    def database_path
+      return _database_path
+    end
+
+    # Mode of the database set by PROJ.use_database (:file by default).
+    #
+    # @return [Symbol]
+    def database_mode
+      return @database_mode || :file
+    end
+
+    # Returns the path of proj.db file on which the database of the context
+    # is based (the original file for :immutable and :memory modes).
+    #
+    # @return [String, nil]
+    def database_source
+      return @database_source || _database_path
+    end
+
+    # Sets proj.db of the default context (and the contexts for worker threads,
+    # which are copied from it) used for the construction of objects.
+    #
+    # Modes are
+    #
+    # * :file      - opens the file as usual
+    # * :immutable - opens the file as immutable SQLite database,
+    #                which skips locking and change detection of the file
+    # * :memory    - copies the file into memory-backed filesystem (tmpdir)
+    #                and opens the copy as immutable database
+    #
+    # @param path [String, nil] path of proj.db (nil for the current one)
+    # @param aux_paths [Array<String>] paths of auxiliary databases
+    # @param mode [Symbol] :file, :immutable or :memory
+    # @param tmpdir [String] directory on memory-backed filesystem for :memory mode
+    #
+    # @example
+    #   PROJ.use_database(mode: :memory)
+    def use_database (path = nil, aux_paths: [], mode: :file, tmpdir: "/dev/shm")
+      path ||= database_source
+      raise ArgumentError, "proj.db not found" unless path and File.file?(path)
+      case mode
+      when :file
+        _set_database_path(path, aux_paths)
+      when :immutable
+        _set_database_path(database_uri(path), aux_paths)
+      when :memory
+        raise ArgumentError, "#{tmpdir} is not a directory" unless File.directory?(tmpdir)
+        copy = File.join(tmpdir, format("simple-proj-%d-%08x.db", Process.pid, rand(1 << 32)))
+        FileUtils.cp(path, copy)
+        begin
+          _set_database_path(database_uri(copy), aux_paths)
+        rescue
+          File.unlink(copy) rescue nil
+          raise
+        end
+        release_memory_database
+        @memory_database = copy
+        @memory_database_pid = Process.pid
+        @memory_database_hook ||= at_exit { release_memory_database }
+      else
+        raise ArgumentError, "invalid database mode '#{mode}'"
+      end
+      release_memory_database unless mode == :memory
+      @database_mode = mode
+      @database_source = File.expand_path(path)
+      return self
+    end
+
+    # Returns the search paths of resource files set by PROJ.search_paths=.
+    #
+    # @return [Array<String>, nil]
+    attr_reader :search_paths
+
+    # Sets the search paths of resource files (grids, init files) of the
+    # default context instead of PROJ_DATA environment variable.
+    def search_paths= (paths)
+      paths = Array(paths).map { |path| File.expand_path(path) }
+      _set_search_paths(paths)
+      @search_paths = paths
+    end
+
+    # Configures the cache of remote grid chunks of the default context.
+    # Omitted settings are left unchanged.
+    #
+    # @param enabled [Boolean]
+    # @param filename [String] path of the cache file
+    # @param max_size [Integer] maximum size in MB
+    # @param ttl [Integer] time-to-live of the cached properties of files in seconds
+    def configure_grid_cache (enabled: nil, filename: nil, max_size: nil, ttl: nil)
+      _set_grid_cache(enabled, filename && File.expand_path(filename), max_size, ttl)
+      return self
+    end
+
+    private
+
+    def database_uri (path)
+      return "file:" + File.expand_path(path).gsub(/[%?#]/) { |c| format("%%%02X", c.ord) } + "?immutable=1"
+    end
+
+    # the copy is owned by the process which made it (not by forked children)
+    def release_memory_database
+      if @memory_database
+        if @memory_database_pid == Process.pid
+          File.unlink(@memory_database) rescue nil
+        end
+        @memory_database = nil
+      end
+    end
+
+  end
+
+end
+
+### CRS search
+
+class PROJ::CRS
+
+  # Lightweight record of a CRS in the database returned by PROJ::CRS.search.
+  # The bbox (west, south, east, north) of the area of use is in degrees,
+  # and west > east if it crosses the antimeridian.
+  Info = Struct.new(:auth_name, :code, :name, :type, :deprecated,
+                    :west, :south, :east, :north, :area_name,
+                    :projection_method_name, :celestial_body_name) do
+
+    # Returns "AUTH:CODE"
+    #
+    # @return [String]
+    def id
+      return auth_name + ":" + code
+    end
+
+    alias to_s id
+
+    def deprecated?
+      return deprecated
+    end
+
+    # Returns true if the area of use contains the point.
+    #
+    # @return [Boolean]
+    def contains? (lon, lat)
+      return false unless west
+      return false if lat < south or lat > north
+      if west <= east
+        return lon >= west && lon <= east
+      else
+        return lon >= west || lon <= east
+      end
+    end
+
+    # Returns the area of bbox in square degrees.
+    #
+    # @return [Float]
+    def bbox_area
+      return Float::INFINITY unless west
+      width = ( west <= east ) ? east - west : east - west + 360
+      return width * ( north - south )
+    end
+
+    # Creates PROJ::CRS object from the record.
+    #
+    # @return [PROJ::CRS]
+    def to_crs
+      return PROJ::CRS.new(id)
+    end
+
+  end
+
+  # In-memory index of CRS records.
+  #
+  # @private
+  class SearchIndex
+
+    CELL = 10            # size of cells of the spatial index in degrees
+
+    LARGE_WIDTH  = 90    # bboxes larger than these are not put in cells
+    LARGE_HEIGHT = 45
+
+    attr_reader :records
+
+    def initialize (records)
+      @records = records
+      @by_id   = {}
+      @by_code = Hash.new { |h, k| h[k] = [] }
+      @tokens  = Hash.new { |h, k| h[k] = [] }
+      @tokens_of = {}.compare_by_identity
+      @cells   = Hash.new { |h, k| h[k] = [] }
+      @large   = []
+      records.each do |rec|
+        @by_id[rec.id.downcase] = rec
+        @by_code[rec.code] << rec
+        tokens = SearchIndex.tokenize(rec.name)
+        @tokens_of[rec] = tokens
+        tokens.each { |token| @tokens[token] << rec }
+        add_to_cells(rec)
+      end
+      @names = records.map { |rec| [rec.name.downcase, rec] }.sort_by!(&:first)
+      @area_rank = {}.compare_by_identity
+      records.sort_by.with_index { |rec, i| [rec.bbox_area, i] }.each_with_index do |rec, i|
+        @area_rank[rec] = i
+      end
+    end
+
+    # Sorts the records from the smallest area of use.
+    def sort_by_area (list)
+      return list.sort_by { |rec| @area_rank[rec] }
+    end
+
+    def self.tokenize (text)
+      return text.to_s.downcase.split(/[^[:alnum:]]+/).reject(&:empty?).uniq
+    end
+
+    # Returns the records with the code ("AUTH:CODE" or "CODE").
+    def by_code (code)
+      code = code.to_s
+      if code.include?(":")
+        rec = @by_id[code.downcase]
+        return rec ? [rec] : []
+      else
+        return @by_code.fetch(code, [])
+      end
+    end
+
+    # Returns the records whose name starts with the prefix (case-insensitive).
+    def by_name (prefix)
+      prefix = prefix.downcase
+      first = @names.bsearch_index { |name, _| name >= prefix }
+      return [] unless first
+      list = []
+      @names[first..].each do |name, rec|
+        break unless name.start_with?(prefix)
+        list << rec
+      end
+      return list
+    end
+
+    # Returns the records whose name contains all tokens of the text.
+    def by_text (text)
+      tokens = SearchIndex.tokenize(text)
+      return [] if tokens.empty?
+      lists = tokens.map { |token| @tokens.fetch(token, []) }.sort_by!(&:size)
+      return lists.first.select { |rec| tokens.all? { |token| @tokens_of[rec].include?(token) } }
+    end
+
+    # Returns the records whose area of use contains the point.
+    def by_point (lon, lat)
+      lon = ( lon + 180 ) % 360 - 180
+      list = @cells.fetch(cell_key(lon, lat), []) + @large
+      return list.select { |rec| rec.contains?(lon, lat) }
+    end
+
+    private
+
+    def cell_key (lon, lat)
+      return [((lon + 180) / CELL).floor.clamp(0, 360/CELL - 1),
+              ((lat + 90) / CELL).floor.clamp(0, 180/CELL - 1)]
+    end
+
+    def add_to_cells (rec)
+      return unless rec.west
+      width = ( rec.west <= rec.east ) ? rec.east - rec.west : rec.east - rec.west + 360
+      if width > LARGE_WIDTH or rec.north - rec.south > LARGE_HEIGHT
+        @large << rec
+        return
+      end
+      ranges = ( rec.west <= rec.east ) ? [[rec.west, rec.east]] : [[rec.west, 180.0], [-180.0, rec.east]]
+      j0 = cell_key(0, rec.south)[1]
+      j1 = cell_key(0, rec.north)[1]
+      ranges.each do |west, east|
+        i0 = cell_key(west, 0)[0]
+        i1 = cell_key(east, 0)[0]
+        (i0..i1).each do |i|
+          (j0..j1).each do |j|
+            list = @cells[[i, j]]
+            list << rec unless list.last.equal?(rec)
+          end
+        end
+      end
+    end
+
+  end
+
+  class << self
+
+    # Searches CRS in the database using an in-memory index, which is built
+    # at the first call (and rebuilt when the database is changed).
+    # The conditions are combined, and deprecated CRS are excluded unless
+    # `deprecated` is true. The results of `point` search are ordered from
+    # the smallest area of use.
+    #
+    # @param code [String, Integer] "AUTH:CODE" or code
+    # @param name [String] prefix of the name (case-insensitive)
+    # @param text [String] words contained in the name (case-insensitive)
+    # @param point [Array<Numeric>] [lon, lat] contained in the area of use
+    # @param auth_name [String] authority name
+    # @param type [Symbol, Array<Symbol>] type of CRS (e.g. :projected_crs)
+    # @param deprecated [Boolean] includes deprecated CRS
+    # @param limit [Integer, nil] maximum number of records
+    #
+    # @return [Array<PROJ::CRS::Info>]
+    #
+    # @example
+    #   PROJ::CRS.search(text: "UTM zone 54N", auth_name: "EPSG")
+    #   PROJ::CRS.search(point: [139.7, 35.7], type: :projected_crs).first.to_crs
+    def search (code: nil, name: nil, text: nil, point: nil, auth_name: nil,
+                type: nil, deprecated: false, limit: nil)
+      index = search_index
+      lists = []
+      lists << index.by_code(code) if code
+      lists << index.by_name(name) if name
+      lists << index.by_text(text) if text
+      lists << index.by_point(*point.map(&:to_f)) if point
+      if lists.empty?
+        list = index.records
+      else
+        list, *rest = lists.sort_by(&:size)
+        rest = rest.map { |l| l.to_h { |rec| [rec, true] }.compare_by_identity }
+        list = list.select { |rec| rest.all? { |h| h.key?(rec) } }
+      end
+      types = type && Array(type)
+      list = list.select { |rec|
+        ( deprecated or not rec.deprecated ) and
+        ( auth_name.nil? or rec.auth_name == auth_name ) and
+        ( types.nil? or types.include?(rec.type) )
+      }
+      if point
+        list = index.sort_by_area(list)
+      elsif name
+        prefix = name.downcase
+        list = list.sort_by.with_index { |rec, i| [rec.name.downcase == prefix ? 0 : 1, i] }
+      end
+      return limit ? list.first(limit) : list
+    end
+
+    # Returns the search index, building it if necessary.
+    #
+    # @private
+    def search_index
+      source = PROJ.database_source
+      @search_lock ||= Mutex.new
+      return @search_lock.synchronize {
+        if @search_index.nil? or @search_source != source
+          records = _crs_info_list(nil).map { |rec| Info.new(*rec).freeze }
+          @search_index = SearchIndex.new(records)
+          @search_source = source
+        end
+        @search_index
+      }
+    end
+
+  end
+
+end
+
+### Persistent pipeline cache
+
+class PROJ
+
+  class << self
+
+    # Directory of the persistent cache of resolved transformation pipelines,
+    # or nil if the cache is disabled (default).
+    #
+    # @return [String, nil]
+    attr_reader :pipeline_cache
+
+    # Enables the persistent cache of resolved transformation pipelines 
+    # in the directory (nil disables the cache).
+    #
+    # PROJ.new with String definitions looks up the cache and rebuilds the 
+    # object from the cached pipeline without searching proj.db.
+    # Operations with several candidate operations are not cached.
+    #
+    # @example
+    #   PROJ.pipeline_cache = "/var/cache/simple-proj"
+    def pipeline_cache= (dir)
+      if dir
+        dir = File.expand_path(dir)
+        FileUtils.mkdir_p(dir)
+      end
+      @pipeline_cache = dir
+    end
+
+  end
+
+  # @private
+  module PipelineCache
+
+    FORMAT = 2
+
+    def initialize (*args, lazy: false)
+      if lazy
+        return super(*args, lazy: true)
+      end
+      dir = PROJ.pipeline_cache
+      unless dir and ( args.size == 1 or args.size == 2 ) and args.all? { |a| a.is_a?(String) }
+        return super(*args)
+      end
+      key = PipelineCache.key(dir, args)
+      entry = PipelineCache.read(dir, key)
+      if entry
+        begin
+          _initialize_pipeline(entry["pipeline"], entry["is_src_latlong"])
+          _set_area(entry["area"], entry["lat_first"])
+          @cached_definitions = entry["definitions"]
+          @cached_area = entry["area"]
+          return
+        rescue RuntimeError
+        end
+      end
+      super(*args)
+      pipeline, is_src_latlong = _pipeline
+      if pipeline and is_src_latlong != 1
+        definitions = ( args.size == 1 ) ? ["+proj=latlong +type=crs", args[0]] : args
+        PipelineCache.write(dir, key, pipeline, is_src_latlong, definitions,
+                            area_of_use, _area_lat_first?)
+      end
+    end
+
+    # Returns source CRS. For the object rebuilt from the cache, 
+    # it is created from the source definition.
+    def source_crs
+      crs = super
+      if crs.nil? and @cached_definitions
+        crs = PROJ::CRS.new(@cached_definitions[0])
+      end
+      return crs
+    end
+
+    # Returns target CRS. For the object rebuilt from the cache, 
+    # it is created from the target definition.
+    def target_crs
+      crs = super
+      if crs.nil? and @cached_definitions
+        crs = PROJ::CRS.new(@cached_definitions[1])
+      end
+      return crs
+    end
+
+    # Returns the area of use. For the object rebuilt from the cache, 
+    # it is the one stored with the pipeline.
+    def area_of_use
+      area = super
+      if area and @cached_area
+        area = @cached_area.dup
+      end
+      return area
+    end
+
+    class << self
+
+      def key (dir, args)
+        material = [FORMAT, PROJ::VERSION, database_checksum(dir), args]
+        return Digest::SHA256.hexdigest(JSON.generate(material)), material
+      end
+
+      # checksum of proj.db, memoized by the path, size and mtime of the file
+      def database_checksum (dir)
+        path = PROJ.database_source
+        return "none" unless path and File.exist?(path)
+        stat  = File.stat(path)
+        stamp = [path, stat.size, stat.mtime.to_r.to_s, stat.ino].join("|")
+        @checksums ||= {}
+        return @checksums[stamp] ||= begin
+          file = File.join(dir, "proj.db-" + Digest::SHA256.hexdigest(stamp))
+          sum = File.read(file) rescue nil
+          unless sum =~ /\A\h{64}\z/
+            sum = Digest::SHA256.file(path).hexdigest
+            atomic_write(file, sum)
+          end
+          sum
+        end
+      end
+
+      def read (dir, key)
+        hexkey, material = key
+        entry = JSON.parse(File.read(File.join(dir, hexkey + ".json")))
+        body  = entry["body"]
+        return nil unless entry["checksum"] == Digest::SHA256.hexdigest(body)
+        body = JSON.parse(body)
+        return nil unless body["key"] == material and 
+                          body["pipeline"].is_a?(String) and
+                          [0, 2].include?(body["is_src_latlong"]) and
+                          body["definitions"].is_a?(Array) and
+                          ( body["area"].nil? or valid_area?(body["area"]) ) and
+                          [true, false].include?(body["lat_first"])
+        return body
+      rescue SystemCallError, JSON::ParserError, TypeError, NoMethodError
+        return nil
+      end
+
+      def valid_area? (area)
+        return ( area.is_a?(Array) and area.size == 5 and 
+                 area[0, 4].all? { |v| v.is_a?(Numeric) } and 
+                 ( area[4].nil? or area[4].is_a?(String) ) )
+      end
+
+      def write (dir, key, pipeline, is_src_latlong, definitions, area, lat_first)
+        hexkey, material = key
+        body = JSON.generate("key" => material,
+                             "pipeline" => pipeline,
+                             "is_src_latlong" => is_src_latlong,
+                             "definitions" => definitions,
+                             "area" => area,
+                             "lat_first" => lat_first)
+        entry = JSON.generate("checksum" => Digest::SHA256.hexdigest(body), "body" => body)
+        atomic_write(File.join(dir, hexkey + ".json"), entry)
+      end
+
+      # writes to a temporary file and renames it to be safe under concurrent writers
+      def atomic_write (file, data)
+        tmp = format("%s.%d.%d.%08x.tmp", file, Process.pid, Thread.current.object_id, rand(1 << 32))
+        File.binwrite(tmp, data)
+        File.rename(tmp, file)
+      rescue SystemCallError
+        File.unlink(tmp) rescue nil
+      end
+
+    end
+
+  end
+
+  prepend PipelineCache
+
+end
+
+### Asynchronous transformation
+
+require "io/wait"
+
+# defined only with PROJ 8.2 or later
+if defined?(PROJ::AsyncTask)
+
+  class PROJ::AsyncTask
+
+    # Waits for the task to finish. Under a fiber scheduler, only the current
+    # fiber waits (IO#wait_readable). Returns false on timeout.
+    def wait (timeout = nil)
+      return true if done?
+      io.wait_readable(timeout)
+      return done?
+    end
+
+    # Waits for the task and returns the result. Raises RuntimeError if the
+    # task failed, or PROJ::AsyncTask::Cancelled if it was cancelled.
+    def value
+      wait
+      return _result
+    ensure
+      io.close if done? and not io.closed?
+    end
+
+  end
+
+end
+
 begin
   require "simple-proj-carray"
 rescue LoadError